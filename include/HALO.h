@@ -47,18 +47,35 @@
 #include "task.h"
 #include "version.h"
 #include "ota_lib.h"
+#include "muestreo.h"
+#include "metricas.h"
+#include "filtros.h"
+#include "registro_cambios.h"
+#include "autocero.h"
+#include "benchmarks.h"
+#include "comandos.h"
+#include "muestras_bin.h"
+#include "compresion.h"
+#include "histograma.h"
+#include "agregados.h"
+#include "recientes.h"
+#include "espacio.h"
 
 // === HARDWARE ===
 #define USER_BUTTON      25     
 #define LED_USER         0   
 #define HX711_DOUT       17      
 #define HX711_SCK        16      
+#define HX711_DOUT_1     27     // DOUT de las celdas adicionales (SCK compartido)
+#define HX711_DOUT_2     14
+#define HX711_DOUT_3     13
 #define I2C_SDA          21     
 #define I2C_SCL          22              
 
 // === ALMACENAMIENTO NVS ===
 #define NVS_NAMESPACE            "halo"              // Namespace principal del sistema
-#define NVS_KEY_ULTIMA           "ultima_muestra"    // Última muestra enviada
+#define NVS_KEY_ULTIMA           "ultima_muestra"    // (LEGADO) Índice de la última muestra enviada
+#define NVS_KEY_CURSOR           "cursor_envio"      // Cursor de envío (blob muestras_bin_cursor_t)
 #define NVS_KEY_HORA_ENVIO       "hora_envio"        // Hora de envío programada
 #define NVS_KEY_MINUTO_ENVIO     "minuto_envio"      // Minuto de envío programado
 #define NVS_KEY_WIFI_SSID        "wifi_ssid"         // (LEGADO) SSID de WiFi guardado
@@ -71,6 +88,12 @@
 #define NVS_KEY_WIFI_PASS_2      "wifi_pass_2"       // PASS slot 2
 #define NVS_MAX_WIFI_CREDENTIALS 3
 #define NVS_KEY_MUESTREO_MS       "muestreo_ms"      // Intervalo de muestreo en ms
+#define NVS_KEY_FILTROS           "filtros"          // Cadena de filtros (texto)
+#define NVS_KEY_REGISTRO          "registro"         // Configuración del registro por cambios (blob)
+#define NVS_KEY_AUTOCERO          "autocero"         // Corrección de cero acumulada (blob)
+#define NVS_KEY_AUTOCERO_CFG      "autocero_cfg"     // Configuración del seguimiento de cero (blob)
+#define NVS_KEY_ESPACIO           "espacio_sd"       // Espacio libre de la SD en caché (blob)
+#define NVS_KEY_ROTACION          "rotacion"         // Segmento de una rotación sin completar (blob)
 
 // === RED ===
 #define EXAMPLE_ESP_MAXIMUM_RETRY    5                   // Máximo número de intentos de conexión
@@ -99,14 +122,20 @@
 #define SISTEMA_LOG_LEVEL_VERBOSE   4                   // Información muy detallada
 
 // === CONFIGURACIONES OPTIMIZADAS DE TAREAS FreeRTOS ===
-#define TAREA_HX711_STACK_SIZE   3072  // solo lectura de sensor
+#define TAREA_HX711_STACK_SIZE   4096  // lectura de sensor y tara con promedio adaptativo
+#define TAREA_MUESTREO_STACK_SIZE 2560 // lectura continua del HX711
 #define TAREA_MQTT_STACK_SIZE    6144  // SSL/TLS requiere más memoria
 #define TAREA_BUTTON_STACK_SIZE  2048  //  lógica mínima
+#define TAREA_COMANDOS_STACK_SIZE 6144 // OTA con TLS desde el ejecutor de comandos
+#define TAREA_SD_STACK_SIZE      4096  // montaje FATFS y escritura de pesos.bin
 
 // === PRIORIDADES DE TAREAS ===
 #define TAREA_HX711_PRIORIDAD    6     // ALTA: sensor crítico del sistema
+#define TAREA_MUESTREO_PRIORIDAD 7     // ALTA+: no perder conversiones del HX711
 #define TAREA_MQTT_PRIORIDAD     4     // MEDIA: red no crítica  
 #define TAREA_BUTTON_PRIORIDAD   8     // MUY ALTA: responsividad del usuario
+#define TAREA_COMANDOS_PRIORIDAD 3     // BAJA: comandos largos sin frenar al cliente MQTT
+#define TAREA_SD_PRIORIDAD       2     // BAJA: escritor único de la SD (las muestras esperan en cola)
 
 // === DISTRIBUCIÓN POR NÚCLEOS ===
 #define NUCLEO_PROTOCOLO          0     // Núcleo dedicado a protocolos (HX711)
@@ -138,8 +167,6 @@ void enviar_mac(void);
 void user_button_init(void);                            
 void guardar_horario_envio(void);                                        
 void restaurar_horario_envio(void);   
-void guardar_ultima_muestra_enviada(void);  
-void restaurar_ultima_muestra_enviada(void); 
 void guardar_muestreo_ms(void);
 void restaurar_muestreo_ms(void);
 
@@ -147,7 +174,7 @@ void restaurar_muestreo_ms(void);
 typedef struct {
     // Configuración de envío MQTT y muestreo
     struct {
-        int ultima_muestra_enviada;     // Índice de última línea enviada del CSV
+        muestras_bin_cursor_t cursor;   // Próxima muestra de pesos.bin a enviar
         int ultimo_dia_envio;           // Día del último envío (-1 = forzar envío)
         int hora_envio;                 // Hora programada para envío diario
         int minuto_envio;               // Minuto programado para envío diario
@@ -165,6 +192,7 @@ typedef struct {
         bool esperando_fecha_hora;      // Esperando fecha/hora por MQTT
         bool esperando_config_horario;  // Esperando configuración de horario
         bool conexion_boton_activa;     // Estado de conexión manual por botón
+        bool envio_en_vivo;             // Publicar muestras en vivo por MQTT
     } estado;
     
     // Sincronización y protección de datos
@@ -0,0 +1,91 @@
+#ifndef AGREGADOS_H
+#define AGREGADOS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include "muestras_bin.h"
+
+// Agregados por minuto, hora y día (cantidad, suma, mínimo, máximo y suma de
+// cuadrados del peso) actualizados al registrar cada muestra. Se guardan en
+// AGREGADOS_RUTA junto a pesos.bin: una tabla circular de casilleros fijos por
+// nivel, así que el casillero de un período es un fseek directo. Una consulta
+// por rango junta días enteros, horas y minutos de los bordes: como mucho unos
+// cientos de casilleros, sin leer las muestras crudas.
+//
+// Los días empiezan a la medianoche local. Alcance de cada nivel: minutos del
+// último día, horas del último mes y días de los últimos dos años; fuera de eso
+// el borde del rango se cuenta en 'faltantes'. El desvío sale de la suma de
+// cuadrados en double: con rangos de meses pierde resolución por debajo del gramo.
+
+#define AGREGADOS_RUTA              "/agreg.bin"
+#define AGREGADOS_MAGIA             "HALA"
+#define AGREGADOS_VERSION           1
+
+typedef enum {
+    AGREGADOS_MINUTO = 0,
+    AGREGADOS_HORA,
+    AGREGADOS_DIA,
+    AGREGADOS_NUM_NIVELES
+} agregados_nivel_t;
+
+#define AGREGADOS_CASILLEROS        { 1440, 744, 731 }      // 1 día, 31 días, 2 años
+#define AGREGADOS_PERIODOS_S        { 60, 3600, 86400 }
+
+typedef struct {
+    uint32_t inicio;                    // Epoch del comienzo del período (0 = vacío)
+    uint32_t n;
+    int32_t min_mg;
+    int32_t max_mg;
+    int64_t suma_mg;
+    double suma_cuadrados;              // mg²
+    uint32_t crc;                       // CRC32 de los campos anteriores
+    uint32_t reservado;
+} agregado_t;
+
+typedef struct {
+    char magia[4];                      // AGREGADOS_MAGIA
+    uint16_t version;
+    uint16_t tam_casillero;             // sizeof(agregado_t)
+    uint16_t casilleros[AGREGADOS_NUM_NIVELES];
+    uint16_t reservado;
+    uint32_t crc;                       // CRC32 de los campos anteriores
+} agregados_cabecera_t;
+
+typedef struct {
+    uint32_t desde;                     // Rango consultado (redondeado a minutos)
+    uint32_t hasta;
+    uint32_t n;
+    int32_t min_mg;
+    int32_t max_mg;
+    int64_t suma_mg;
+    double suma_cuadrados;
+    uint32_t casilleros;                // Casilleros combinados (el costo de la consulta)
+    uint32_t faltantes;                 // Períodos fuera del alcance de su nivel o dañados
+} agregados_resultado_t;
+
+typedef struct {
+    uint32_t muestras;                  // Muestras agregadas
+    uint32_t escrituras;                // Vuelcos de casilleros a la SD
+    uint32_t descartados;               // Casilleros cerrados perdidos sin SD (cola llena)
+    uint32_t consultas;
+    uint32_t consulta_us;               // Última consulta
+    uint32_t consulta_max_us;
+} agregados_stats_t;
+
+// Crea AGREGADOS_RUTA si falta o tiene otro formato (al montar la SD)
+esp_err_t agregados_preparar(void);
+
+// Suma una muestra válida a los casilleros abiertos (tarea escritora, con sistema.mutex_sd)
+void agregados_agregar(const muestra_bin_t *reg);
+
+// Escribe los casilleros cambiados desde el último vuelco (con sistema.mutex_sd;
+// la tarea escritora lo llama tras cada vaciado de pesos.bin)
+esp_err_t agregados_persistir(void);
+
+// Agregado de las muestras con epoch en [desde, hasta) (con sistema.mutex_sd)
+esp_err_t agregados_consultar(uint32_t desde, uint32_t hasta, agregados_resultado_t *res);
+
+void agregados_get_stats(agregados_stats_t *stats);
+
+#endif // AGREGADOS_H
@@ -0,0 +1,75 @@
+#ifndef AUTOCERO_H
+#define AUTOCERO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+// Seguimiento automático del cero: cuando la balanza está asentada cerca de
+// cero, promedia el error (raw - offset) y corrige 'offset' en pasos acotados,
+// sin salir de una ventana de ±max_mg alrededor del offset calibrado.
+// La corrección se guarda en NVS con poca frecuencia (agrupando cambios).
+
+#define AUTOCERO_MIN_MUESTRAS       16          // Muestras asentadas mínimas por ajuste
+#define AUTOCERO_GUARDADO_MS        3600000     // Como mucho un guardado en NVS por hora
+#define AUTOCERO_GUARDADO_MIN_MG    1000        // Cambio mínimo que justifica guardar
+
+typedef struct {
+    uint8_t habilitado;
+    uint8_t reservado[3];
+    uint32_t zona_mg;                   // |peso| máximo para considerar "cerca de cero"
+    uint32_t max_mg;                    // Corrección total máxima respecto a la calibración
+    uint32_t periodo_ms;                // Intervalo mínimo entre ajustes
+} autocero_config_t;
+
+#define AUTOCERO_CONFIG_DEFECTO {   \
+    .habilitado = 1,                \
+    .zona_mg = 50000,               \
+    .max_mg = 500000,               \
+    .periodo_ms = 30000,            \
+}
+
+// Estado del seguidor (separado del global para poder simularlo)
+typedef struct {
+    int32_t offset_base;                // Offset de la última calibración
+    int32_t correccion;                 // Cuentas sumadas a offset_base
+    int64_t error_acum;                 // Suma de (raw - offset) en la zona de cero
+    uint32_t n_acum;
+    uint32_t t_ultimo_ajuste_ms;
+    uint32_t ajustes;
+    uint32_t saturaciones;              // Ajustes recortados por la ventana máxima
+} autocero_estado_t;
+
+typedef struct {
+    int32_t correccion;                 // Cuentas
+    int32_t correccion_mg;
+    uint32_t ajustes;
+    uint32_t saturaciones;
+    uint32_t guardados;                 // Escrituras en NVS
+} autocero_stats_t;
+
+// Paso puro del seguidor; devuelve true si cambió la corrección
+bool autocero_paso(autocero_estado_t *st, const autocero_config_t *cfg, float cuentas_por_kg,
+                   int32_t raw, bool estable, uint32_t ahora_ms);
+
+// Instancia global (llamar después de init_HX711). autocero_actualizar() solo
+// escribe 'offset' con el mutex de calibración de hx711_lib; si está ocupado,
+// salta la muestra.
+void autocero_init(void);
+void autocero_actualizar(int32_t raw, bool estable, uint32_t ahora_ms);
+
+// Descarta la corrección y toma 'offset_nuevo' como base (tras una tara o
+// calibración, con hx711_calibracion_tomar() y antes de soltarlo)
+void autocero_reiniciar(int32_t offset_nuevo);
+
+// Aplica "clave=valor" (autocero, autocero_zona_g, autocero_max_g);
+// ESP_ERR_NOT_FOUND si la clave no es de este módulo
+esp_err_t autocero_configurar(const char *clave_valor);
+
+void autocero_get_stats(autocero_stats_t *stats);
+
+#if CONFIG_HALO_BENCHMARKS
+void autocero_simulacion(void);
+#endif
+
+#endif // AUTOCERO_H
@@ -0,0 +1,18 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+// Micro-benchmarks en el equipo (CONFIG_HALO_BENCHMARKS): se ejecutan una vez
+// al arrancar, antes de crear las tareas, y solo registran resultados en el log.
+
+#define BENCHMARK_HX711_TRAMAS      50      // Tramas leídas por cada camino del HX711
+#define BENCHMARK_CONVERSION_MUESTRAS 1000  // Conversiones cuenta -> peso por camino
+#define BENCHMARK_FILTROS_MUESTRAS  2000    // Muestras sintéticas por tipo de filtro
+#define BENCHMARK_SD_LINEAS         200     // Filas CSV por camino de escritura en la SD
+#define BENCHMARK_SD_ESCRITOR_MUESTRAS 500  // Muestras entregadas en línea y por la cola del escritor
+#define BENCHMARK_SD_PREASIGNACION_MUESTRAS 8192 // Muestras escritas en un archivo que crece y en uno preasignado
+#define BENCHMARK_MUESTRAS_BIN      500     // Muestras decodificadas por formato (CSV / binario)
+#define BENCHMARK_COMPRESION_MUESTRAS 2000  // Muestras codificadas y decodificadas por bloques
+
+void benchmarks_ejecutar(void);
+
+#endif // BENCHMARKS_H
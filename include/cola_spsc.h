@@ -0,0 +1,45 @@
+#ifndef COLA_SPSC_H
+#define COLA_SPSC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Cola circular sin bloqueos para un único productor y un único consumidor.
+// El productor solo escribe 'cabeza' y el consumidor solo escribe 'cola',
+// por lo que basta con orden acquire/release entre núcleos.
+// Si la cola está llena, el elemento nuevo se descarta y se cuenta como desborde.
+typedef struct {
+    uint8_t *buffer;                    // Almacenamiento estático provisto por el dueño
+    size_t tam_elemento;                // Tamaño de cada elemento en bytes
+    uint32_t capacidad;                 // Número de elementos (potencia de 2)
+    atomic_uint_fast32_t cabeza;        // Próxima posición a escribir (productor)
+    atomic_uint_fast32_t cola;          // Próxima posición a leer (consumidor)
+    atomic_uint_fast32_t desbordes;     // Elementos descartados por cola llena
+    atomic_uint_fast32_t max_ocupacion; // Marca de agua alta
+} cola_spsc_t;
+
+typedef struct {
+    uint32_t capacidad;
+    uint32_t ocupacion;
+    uint32_t max_ocupacion;
+    uint32_t desbordes;
+    uint32_t escritos;
+} cola_spsc_stats_t;
+
+// Inicializa la cola; 'capacidad' debe ser potencia de 2
+bool cola_spsc_init(cola_spsc_t *q, void *buffer, size_t tam_elemento, uint32_t capacidad);
+
+// Lado productor
+bool cola_spsc_push(cola_spsc_t *q, const void *elemento);
+
+// Lado consumidor
+bool cola_spsc_pop(cola_spsc_t *q, void *elemento);
+void cola_spsc_vaciar(cola_spsc_t *q);
+
+// Consultas (desde cualquier contexto)
+uint32_t cola_spsc_ocupacion(const cola_spsc_t *q);
+void cola_spsc_get_stats(const cola_spsc_t *q, cola_spsc_stats_t *stats);
+
+#endif // COLA_SPSC_H
@@ -0,0 +1,49 @@
+#ifndef COMANDOS_H
+#define COMANDOS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+// Ejecutor asíncrono de comandos MQTT: el manejador de eventos de esp-mqtt solo
+// valida y encola; una tarea propia ejecuta el trabajo (calibración, OTA,
+// rollback, reinicio...) y publica en COMANDOS_TOPIC_ESTADO el avance y el
+// resultado de cada comando con su id. Así el cliente MQTT sigue atendiendo
+// keepalives y PUBACK mientras un comando tarda segundos o minutos.
+
+#define COMANDOS_TOPIC_ESTADO       "esp32/halo/command_status"
+#define COMANDOS_COLA_LONGITUD      4
+#define COMANDOS_TEXTO_MAX          128     // Cabe "99 " + OTA_URL_MAX_LENGTH
+#define COMANDOS_AVANCE_MS          2000    // Mínimo entre publicaciones de avance de un comando
+
+typedef enum {
+    COMANDO_MENU = 0,                   // esp32/command (menu_mqtt)
+    COMANDO_OTA,                        // esp32/command_ota con URL
+    COMANDO_ROLLBACK,                   // esp32/command_ota "ROLLBACK"
+} comando_tipo_t;
+
+typedef struct {
+    uint32_t encolados;
+    uint32_t rechazados;                // Cola llena o texto demasiado largo
+    uint32_t completados;
+    uint32_t manejador_us;              // Último tiempo dentro del manejador MQTT (evento DATA)
+    uint32_t manejador_max_us;
+    uint32_t ejecucion_us;              // Última duración de un comando (antes bloqueaba el manejador)
+    uint32_t ejecucion_max_us;
+} comandos_stats_t;
+
+// Crea la cola y la tarea ejecutora (antes de arrancar el cliente MQTT)
+void create_task_comandos(void);
+
+// Encola un comando y publica "encolado" con su id; ESP_ERR_NO_MEM si la cola está llena
+esp_err_t comandos_encolar(comando_tipo_t tipo, const char *texto, uint32_t *id);
+
+// Publica el avance del comando en curso; se ignora fuera de la tarea ejecutora
+void comandos_publicar_avance(int porcentaje, const char *detalle);
+
+// Registra el tiempo que pasó el manejador de eventos MQTT con un mensaje
+void comandos_registrar_manejador(uint32_t us);
+
+void comandos_get_stats(comandos_stats_t *stats);
+
+#endif // COMANDOS_H
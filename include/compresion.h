@@ -0,0 +1,95 @@
+#ifndef COMPRESION_H
+#define COMPRESION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include "muestras_bin.h"
+
+// Codificación por bloques de series de muestras (segmentos del histórico).
+// Cada muestra se guarda como diferencias respecto de la anterior del bloque,
+// en varints con zigzag:
+//   epoch        delta de delta (0 con intervalo regular: 1 byte)
+//   peso, raw,   delta (el peso cambia poco entre muestras: 1-3 bytes)
+//   celdas, mV
+//   flags        1 byte
+// Los bloques miden COMPRESION_BLOQUE_BYTES (un sector FAT de 4 KB) y empiezan
+// con una cabecera con el rango horario y CRC32, así que se decodifican por
+// separado y un lector puede saltar los que quedan fuera del rango pedido.
+// La memoria es estática: un bloque por escritor o lector, sin malloc.
+
+#define COMPRESION_MAGIA            "HALZ"
+#define COMPRESION_VERSION          1
+#define COMPRESION_BLOQUE_BYTES     4096
+// Peor caso de una muestra: 5 varints de hasta 5 bytes más flags
+#define COMPRESION_MUESTRA_MAX      (4 * 5 + 1 + 5 * HX711_NUM_CANALES)
+
+typedef struct {
+    char magia[4];                      // COMPRESION_MAGIA
+    uint8_t version;                    // COMPRESION_VERSION
+    uint8_t num_canales;                // HX711_NUM_CANALES al codificar
+    uint16_t muestras;
+    uint16_t bytes;                     // Bytes de datos usados tras la cabecera
+    uint16_t reservado;
+    uint32_t primera;                   // Epoch de la primera muestra del bloque
+    uint32_t ultima;                    // Epoch de la última muestra del bloque
+    uint32_t crc;                       // CRC32 de la cabecera (hasta aquí) y los datos
+} compresion_bloque_t;
+
+#define COMPRESION_DATOS_BYTES      (COMPRESION_BLOQUE_BYTES - sizeof(compresion_bloque_t))
+
+// Valores de la muestra anterior (se reinician al empezar cada bloque)
+typedef struct {
+    uint32_t epoch;
+    int32_t delta_epoch;
+    int32_t raw;
+    int32_t peso_mg;
+    int32_t bateria_mv;
+#if HX711_NUM_CANALES > 1
+    int32_t raw_canal[HX711_NUM_CANALES];
+#endif
+} compresion_estado_t;
+
+typedef struct {
+    FILE *f;
+    compresion_estado_t previo;
+    compresion_bloque_t cab;            // Cabecera del bloque en curso
+    size_t usado;                       // Bytes de datos del bloque en curso
+    uint32_t muestras;                  // Totales del escritor
+    uint32_t bloques;
+    uint8_t bloque[COMPRESION_BLOQUE_BYTES];
+} compresion_escritor_t;
+
+typedef struct {
+    FILE *f;
+    compresion_estado_t previo;
+    size_t pos;
+    size_t bytes;                       // Bytes de datos del bloque actual
+    uint16_t restantes;                 // Muestras sin leer del bloque actual
+    uint32_t bloques_saltados;          // Fuera de rango (sin decodificar)
+    uint32_t bloques_invalidos;         // CRC o cabecera incorrectos
+    uint8_t bloque[COMPRESION_BLOQUE_BYTES];
+} compresion_lector_t;
+
+// Codifica una muestra tras 'previo' (que se actualiza); devuelve los bytes usados
+size_t compresion_codificar(compresion_estado_t *previo, const muestra_bin_t *reg, uint8_t *salida);
+// Decodifica una muestra (sellada con CRC); 0 si los datos están truncados
+size_t compresion_decodificar(compresion_estado_t *previo, const uint8_t *entrada, size_t len, muestra_bin_t *reg);
+
+// Escritura secuencial: los bloques se escriben enteros (el último con relleno)
+void compresion_escritor_iniciar(compresion_escritor_t *e, FILE *f);
+esp_err_t compresion_escritor_agregar(compresion_escritor_t *e, const muestra_bin_t *reg);
+esp_err_t compresion_escritor_terminar(compresion_escritor_t *e);
+
+// Lectura secuencial de las muestras con epoch >= 'desde' (0 = todas).
+// Devuelve ESP_ERR_NOT_FOUND al final del archivo.
+void compresion_lector_iniciar(compresion_lector_t *l, FILE *f);
+esp_err_t compresion_lector_siguiente(compresion_lector_t *l, uint32_t desde, muestra_bin_t *reg);
+
+#if CONFIG_HALO_BENCHMARKS
+void compresion_benchmark(int muestras);
+#endif
+
+#endif // COMPRESION_H
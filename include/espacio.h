@@ -0,0 +1,62 @@
+#ifndef ESPACIO_H
+#define ESPACIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+// Espacio libre y total de la SD sin recorrer la FAT al montar. La capa de
+// registro informa cada archivo que crece, se recorta o se borra
+// (espacio_cambio/espacio_archivo/espacio_remove) y las cifras se ajustan en
+// clústeres. Se guardan en la NVS junto con la identidad de la tarjeta
+// (CID y capacidad). Con otra tarjeta, o sin cifras guardadas, el espacio queda
+// desconocido hasta el recuento.
+//
+// El recuento completo (f_getfree, que en una FAT32 grande a 1 MHz tarda
+// segundos) lo hace solo la tarea escritora: con la cola vacía, pasados
+// ESPACIO_RECUENTO_DEMORA_MS desde el montaje y si las cifras son desconocidas o
+// tienen más de CONFIG_HALO_SD_RECUENTO_HORAS. Así corrige también lo que
+// escriben otros (la tarjeta en una PC, los benchmarks).
+
+#define ESPACIO_RECUENTO_DEMORA_MS  30000       // Recuento no antes de esto tras montar (arranque y remontajes)
+#define ESPACIO_GUARDAR_MS          600000      // Guardado en la NVS de las cifras ajustadas, como mucho cada tanto
+
+typedef struct {
+    bool valido;                        // Cifras recontadas o restauradas de la NVS
+    uint64_t total_bytes;
+    uint64_t libres_bytes;
+    uint32_t cluster_bytes;
+    uint32_t recuento_epoch;            // Hora del último recuento completo (0 = sin hora)
+} espacio_t;
+
+typedef struct {
+    uint32_t restauradas;               // Montajes que usaron las cifras de la NVS
+    uint32_t cambios;                   // Ajustes de la capa de registro
+    uint32_t recuentos;
+    uint32_t recuento_ms;               // Último recuento completo
+    uint32_t recuento_max_ms;
+    int32_t desvio_clusters;            // Caché menos recuento en el último (+ = se sobrestimaba lo libre)
+    uint32_t guardados;                 // Escrituras en la NVS
+} espacio_stats_t;
+
+// Adopta las cifras de la NVS si son de esta tarjeta (al montar, sin leer la FAT)
+void espacio_montar(void);
+
+// Tamaño de 'ruta' en bytes (0 si no existe)
+uint64_t espacio_tam(const char *ruta);
+// Un archivo pasó de 'antes' a 'despues' bytes (0 = sin clústeres o borrado)
+void espacio_cambio(uint64_t antes, uint64_t despues);
+// espacio_cambio() de 'antes' al tamaño actual de 'ruta'
+void espacio_archivo(const char *ruta, uint64_t antes);
+// remove() que descuenta el archivo borrado
+int espacio_remove(const char *ruta);
+
+// Recuento pendiente y guardado en la NVS (tarea escritora, con sistema.mutex_sd y la cola vacía)
+void espacio_mantener(void);
+// Guarda las cifras si cambiaron (al cerrar los registros)
+esp_err_t espacio_guardar(void);
+
+void espacio_get(espacio_t *espacio);
+void espacio_get_stats(espacio_stats_t *stats);
+
+#endif // ESPACIO_H
@@ -0,0 +1,75 @@
+#ifndef FILTROS_H
+#define FILTROS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+// Cadena de filtros digitales entre la lectura cruda del HX711 y el registro.
+// Cada etapa trabaja en cuentas crudas y guarda su estado en memoria estática
+// (sin asignaciones por muestra). La cadena se describe con texto:
+//   "mediana:5,media:8:4,iir:0.2,kalman:4:400"   o   "ninguno"
+//   mediana:N        Rechazo de picos con ventana N (impar, 3..15)
+//   media:N[:D]      Media móvil de N muestras (1..32), una salida cada D
+//   iir:A            Paso bajo de un polo, y += A*(x - y), 0 < A <= 1 (Q16)
+//   kalman:Q:R       Kalman 1-D con ruido de proceso Q y de medida R (cuentas²)
+
+#define FILTROS_MAX_ETAPAS          4
+#define FILTROS_MEDIANA_MAX         15
+#define FILTROS_MEDIA_MAX           32
+#define FILTROS_TEXTO_MAX           96
+#define FILTROS_CONFIG_DEFECTO      "mediana:5,media:4"
+
+typedef enum {
+    FILTRO_MEDIANA = 0,
+    FILTRO_MEDIA,
+    FILTRO_IIR,
+    FILTRO_KALMAN,
+} filtro_tipo_t;
+
+typedef struct {
+    filtro_tipo_t tipo;
+    union {
+        struct { uint8_t ventana; } mediana;
+        struct { uint8_t ventana; uint8_t decimacion; } media;
+        struct { uint32_t alfa_q16; } iir;
+        struct { float q; float r; } kalman;
+    };
+} filtro_etapa_cfg_t;
+
+typedef struct {
+    uint8_t num_etapas;
+    filtro_etapa_cfg_t etapas[FILTROS_MAX_ETAPAS];
+} filtros_config_t;
+
+typedef struct {
+    uint32_t entradas;                  // Muestras recibidas por la cadena
+    uint32_t salidas;                   // Muestras entregadas (tras decimación)
+} filtros_stats_t;
+
+// Carga la cadena desde NVS (o la de defecto) y la deja lista
+void filtros_init(void);
+
+// Pasa una muestra por la cadena; false si la decimación no produjo salida.
+// Solo debe llamarse desde el consumidor de registro.
+bool filtros_procesar(int32_t entrada, int32_t *salida);
+
+// Descarta el estado de todas las etapas (p. ej. tras recalibrar)
+void filtros_reiniciar(void);
+
+// Conversión entre texto y configuración
+esp_err_t filtros_config_desde_texto(const char *texto, filtros_config_t *cfg);
+int filtros_config_a_texto(const filtros_config_t *cfg, char *buffer, size_t tam);
+
+// Aplica una cadena nueva (la toma el consumidor en su próxima muestra) y la guarda en NVS
+esp_err_t filtros_configurar(const char *texto);
+
+void filtros_get_config(filtros_config_t *cfg);
+void filtros_get_stats(filtros_stats_t *stats);
+
+#if CONFIG_HALO_BENCHMARKS
+void filtros_benchmark(int muestras);
+#endif
+
+#endif // FILTROS_H
@@ -0,0 +1,27 @@
+#ifndef HISTOGRAMA_H
+#define HISTOGRAMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Histograma de latencias en microsegundos con cubetas fijas (límites en
+// HISTOGRAMA_LIMITES_US, la última sin límite). Sin bloqueos: lo actualiza un
+// solo escritor y los lectores copian la estructura (puede quedar desfasada en una muestra).
+
+#define HISTOGRAMA_CUBETAS      8
+#define HISTOGRAMA_LIMITES_US   { 100, 500, 1000, 5000, 10000, 50000, 100000 }
+
+typedef struct {
+    uint32_t cubetas[HISTOGRAMA_CUBETAS];
+    uint32_t n;
+    uint32_t max_us;
+    uint64_t suma_us;
+} histograma_t;
+
+void histograma_agregar(histograma_t *h, uint32_t us);
+uint32_t histograma_media_us(const histograma_t *h);
+
+// Cuentas como arreglo JSON ("[a,b,...]"); devuelve lo que devolvió snprintf
+int histograma_a_texto(const histograma_t *h, char *buffer, size_t tam);
+
+#endif // HISTOGRAMA_H
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "freertos/FreeRTOS.h"
 #include "mqtt_client.h"
 #include <time.h>
 
@@ -29,6 +30,7 @@ typedef struct hx711_handle_s
     void (*enable_irq)(void);
     void (*disable_irq)(void);
     void (*debug_print)(const char *const fmt, ...);
+    uint8_t (*wait_ready)(uint32_t timeout_ms);     // Opcional: espera bloqueante de DOUT bajo (NULL = sondeo)
     uint8_t inited;
     uint8_t mode;
 } hx711_handle_t;
@@ -57,6 +59,106 @@ typedef struct hx711_info_s
 #define DRIVER_HX711_LINK_ENABLE_IRQ(HANDLE, FUC)  (HANDLE)->enable_irq = FUC
 #define DRIVER_HX711_LINK_DISABLE_IRQ(HANDLE, FUC) (HANDLE)->disable_irq = FUC
 #define DRIVER_HX711_LINK_DEBUG_PRINT(HANDLE, FUC) (HANDLE)->debug_print = FUC
+#define DRIVER_HX711_LINK_WAIT_READY(HANDLE, FUC)  (HANDLE)->wait_ready = FUC
+
+#define HX711_TIMEOUT_LISTO_MS      5000    // Máxima espera de dato listo (equivale al sondeo de 50000 x 100 us)
+
+// Varias celdas con SCK compartido: cada bit se lee de todos los DOUT con una
+// sola lectura de GPIO_IN_REG. El peso usa la suma de canales con su ajuste de
+// ganancia; el desglose por celda se registra aparte.
+#ifndef CONFIG_HX711_NUM_CANALES
+#define CONFIG_HX711_NUM_CANALES    1
+#endif
+#define HX711_NUM_CANALES           CONFIG_HX711_NUM_CANALES
+#define HX711_MAX_CANALES           4
+#define HX711_ESPERA_CANALES_MS     150     // Espera máxima del resto de DOUT tras el primero (> 1 periodo a 10 SPS)
+#define HX711_GANANCIA_UNIDAD_Q16   65536
+
+// Calibración por canal: raw combinado = sum(ganancia_c * raw_c) >> 16
+typedef struct {
+    int32_t ganancia_q16[HX711_MAX_CANALES];    // Ajuste de esquina de cada celda (Q16)
+    int32_t cero[HX711_MAX_CANALES];            // Cuentas de cada celda vacía (se toman al tarar)
+} hx711_canales_cal_t;
+
+// Fondo de escala por modo de ganancia en nV: tension_nV = (raw * FS) >> 24
+#define HX711_FS_NV_GAIN_128        20000000LL
+#define HX711_FS_NV_GAIN_64         40000000LL
+#define HX711_FS_NV_GAIN_32         80000000LL
+
+// Calibración en punto fijo: peso_mg = ((raw - offset) * mult) >> shift.
+// Se recalcula una sola vez cada vez que cambian offset/scale.
+typedef struct {
+    int32_t offset;                     // Cuentas con la celda vacía
+    int32_t mult;                       // mg por cuenta escalado por 2^shift
+    uint8_t shift;                      // Desplazamiento a la derecha
+    float c2_mg;                        // Término cuadrático en mg/cuenta² (0 = lineal)
+} hx711_cal_fija_t;
+
+// Calibración de N puntos: kg = x/scale + c2*x², con x = raw - offset.
+// Se guarda completa (coeficientes, puntos y residuos) en un único blob con CRC.
+#define HX711_CAL_VERSION           2
+#define HX711_CAL_MAX_PUNTOS        8
+
+typedef enum {
+    HX711_CAL_LINEAL = 1,
+    HX711_CAL_CUADRATICO = 2,
+} hx711_cal_modelo_t;
+
+typedef struct {
+    int32_t raw;                        // Promedio de cuentas con la masa apoyada
+    float masa_kg;                      // Masa conocida
+    float residuo_kg;                   // Masa conocida - masa según el modelo
+} hx711_cal_punto_t;
+
+typedef struct {
+    uint16_t version;                   // HX711_CAL_VERSION
+    uint8_t modelo;                     // hx711_cal_modelo_t
+    uint8_t num_puntos;                 // Incluye el punto de cero
+    int32_t offset;                     // Cuentas con la celda vacía
+    float scale;                        // Cuentas por kg (término lineal)
+    float c2;                           // kg por cuenta² (0 en el modelo lineal)
+    uint32_t timestamp;                 // Epoch del último ajuste
+    float residuo_rms_kg;
+    float residuo_max_kg;
+    hx711_cal_punto_t puntos[HX711_CAL_MAX_PUNTOS];
+    uint32_t crc;                       // CRC32 de todos los campos anteriores
+} hx711_cal_blob_t;
+
+// Promedio adaptativo para tara y calibración: lee a la tasa nativa del HX711
+// y termina cuando el error estándar de la media baja del objetivo o se agota
+// el presupuesto de tiempo. Las muestras se centran en la mediana de una
+// semilla y se descartan las que se alejan más de K desviaciones.
+#define HX711_PROMEDIO_SEMILLA          7       // Muestras iniciales para mediana y MAD
+#define HX711_PROMEDIO_MIN_MUESTRAS     16      // Mínimo de muestras aceptadas antes de evaluar el error
+#define HX711_PROMEDIO_ERROR_CUENTAS    8       // Error estándar objetivo de la media (cuentas)
+#define HX711_PROMEDIO_MAX_MS           15000   // Presupuesto de tiempo por promedio
+#define HX711_PROMEDIO_K_ATIPICO        4       // Umbral de descarte en desviaciones
+
+typedef struct {
+    int32_t media;                      // Media de las muestras aceptadas (suma combinada)
+    int32_t media_canal[HX711_NUM_CANALES];
+    uint16_t aceptadas;
+    uint16_t descartadas;               // Atípicas respecto de la mediana de la semilla
+    float desviacion;                   // Desviación típica de las aceptadas (cuentas)
+    float error_estandar;               // desviacion / sqrt(aceptadas)
+    uint32_t duracion_ms;
+    bool objetivo_alcanzado;            // false si terminó por presupuesto de tiempo
+} hx711_promedio_t;
+
+// Estadísticas de adquisición (latencia de despertar y tiempo de CPU por muestra)
+typedef struct {
+    uint32_t muestras;                  // Tramas leídas correctamente
+    uint32_t timeouts;                  // Esperas de dato listo vencidas
+    uint32_t latencia_despertar_us;     // Flanco de DOUT -> tarea ejecutándose (última)
+    uint32_t latencia_despertar_max_us; // Máxima latencia de despertar observada
+    uint64_t latencia_despertar_suma_us;// Acumulado para calcular la media
+    uint32_t cpu_us;                    // Tiempo activo (no bloqueado) de la última muestra
+    uint32_t cpu_max_us;                // Máximo tiempo activo por muestra
+    uint64_t cpu_suma_us;               // Acumulado para calcular la media
+    uint32_t irq_off_ciclos;            // Ciclos con interrupciones deshabilitadas en la última trama
+    uint32_t irq_off_ventana_max_ciclos;// Ventana contigua más larga sin interrupciones
+    uint32_t espera_canales_max_us;     // Mayor desfase entre el primer y el último DOUT listo
+} hx711_stats_t;
 
 // Variables globales externas
 extern hx711_handle_t hx711;
@@ -67,14 +169,39 @@ extern float scale;
 // Funciones de la librería HX711
 void init_HX711(void);
 float hx711_leer_peso(void);
+esp_err_t hx711_leer_raw(int32_t *raw);
+esp_err_t hx711_leer_raw_canales(int32_t *raw, int32_t raw_canal[HX711_NUM_CANALES]);
+int32_t hx711_calcular_peso_canal_mg(int canal, int32_t raw_canal);
+float hx711_calcular_peso(int32_t raw);
+int32_t hx711_calcular_peso_mg(int32_t raw);
+int32_t hx711_raw_a_nanovoltios(int32_t raw, uint8_t mode);
+// Mutex de offset/scale entre la calibración y el autocero
+bool hx711_calibracion_tomar(TickType_t espera);
+void hx711_calibracion_soltar(void);
+void hx711_actualizar_calibracion_fija(void);
 void hx711_calibrar_inicial(void);
-void hx711_continuar_calibracion_peso(void);
+void hx711_continuar_calibracion_peso(float masa_kg, bool cuadratico);
 ////void write_weight_to_sd(float peso, struct tm *timeinfo);
 
+// Estadísticas de adquisición
+void hx711_get_stats(hx711_stats_t *stats);
+void hx711_reset_stats(void);
+void hx711_log_stats(void);
+void hx711_stats_registrar_despertar(uint32_t latencia_us);
+#if CONFIG_HALO_BENCHMARKS
+void hx711_benchmark_irq(int tramas);
+void hx711_benchmark_conversion(int muestras);
+#endif
+
 // Funciones de persistencia de calibración
 esp_err_t hx711_guardar_calibracion(void);
 esp_err_t hx711_cargar_calibracion(void);
 int hx711_tiene_calibracion_guardada(void);
+void hx711_get_calibracion(hx711_cal_blob_t *cal);
+
+// Aplica "ganancia_cN=<factor>" y guarda en NVS; ESP_ERR_NOT_FOUND si la clave no es de este módulo
+esp_err_t hx711_configurar_canal(const char *clave_valor);
+void hx711_get_canales(hx711_canales_cal_t *cal);
 
 // Función para verificar conexión MQTT
 bool mqtt_is_connected(void);
@@ -0,0 +1,27 @@
+#ifndef HX711_SIM_H
+#define HX711_SIM_H
+
+#include <stdint.h>
+#include "hx711_lib.h"
+
+// Backend HX711 simulado: modela DOUT/SCK en software a través de los
+// punteros de función de hx711_handle_t. Permite medir latencia de
+// despertar y tiempo de CPU por muestra sin celda de carga.
+//
+// Corre en el ESP32 (CONFIG_HX711_SIM_BACKEND): el tiempo sale de esp_timer y
+// la espera de dato listo duerme con vTaskDelay. No hay build para el host.
+
+#ifndef CONFIG_HX711_SIM_SPS
+#define CONFIG_HX711_SIM_SPS 10
+#endif
+
+// Enlaza las funciones simuladas en el handle
+void hx711_sim_link(hx711_handle_t *handle);
+
+// Valor crudo (cuentas) que entregará la próxima conversión y ruido pico en cuentas
+void hx711_sim_set_valor(int32_t raw, int32_t ruido);
+
+// Conversiones completadas por el simulador
+uint32_t hx711_sim_get_conversiones(void);
+
+#endif // HX711_SIM_H
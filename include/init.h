@@ -20,9 +20,7 @@ bool hay_datos_pendientes_envio(void);
 
 void inicializar_sistema(void);                    
 void enviar_mac(void);
-void guardar_ultima_muestra_enviada(void); 
 int leer_ultimas_muestras_sd(int n, float *pesos, struct tm *tiempos);
-void restaurar_ultima_muestra_enviada(void);
 void guardar_horario_envio(void);
 void restaurar_horario_envio(void);  
 #endif // INIT_H 
\ No newline at end of file
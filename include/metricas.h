@@ -0,0 +1,16 @@
+#ifndef METRICAS_H
+#define METRICAS_H
+
+#include <esp_err.h>
+#include <stddef.h>
+
+#define METRICAS_TOPIC          "esp32/halo/metrics"
+#define METRICAS_BUFFER_SIZE    3072
+
+// Construye un JSON con las métricas internas del sistema
+int metricas_generar_json(char *buffer, size_t tam);
+
+// Publica las métricas en METRICAS_TOPIC (requiere MQTT conectado)
+esp_err_t metricas_publicar(void);
+
+#endif // METRICAS_H
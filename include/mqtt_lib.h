@@ -14,6 +14,7 @@ esp_err_t mqtt_enviar_datos(float peso, struct tm *timeinfo, const char* mensaje
 void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
 bool mqtt_is_connected(void);
 esp_err_t mqtt_test_connection(void);
+void mqtt_enviar_en_vivo(void);
 
 // Funciones de procesamiento de comandos
 void menu_mqtt(const char* comando);
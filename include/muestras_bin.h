@@ -0,0 +1,179 @@
+#ifndef MUESTRAS_BIN_H
+#define MUESTRAS_BIN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include "hx711_lib.h"
+
+// Registro binario de muestras en la SD: una cabecera versionada seguida de
+// registros de tamaño fijo con CRC. El índice de una muestra da su posición
+// en el archivo (cabecera + índice * tam_registro), así que contar no lee la SD
+// y leer desde la última enviada es un fseek. La exportación a CSV para los
+// técnicos se hace a pedido (comando 5, a /export.csv).
+//
+// Al migrar desde el registro CSV anterior (/pesos.csv, cabecera
+// "Fecha,Hora,Peso_kg" que no cuenta como fila enviada), las filas sin enviar se importan al pesos.bin recién creado y el CSV se renombra a
+// /legado.csv: nada pendiente se pierde y la exportación nunca lo pisa.
+//
+// Tras cada envío lo ya enviado se archiva comprimido (compresion.h) como
+// segmento en /hist (un archivo por ciclo de envío, nombrado AAMMDDNN.cmp por la
+// fecha de su primera muestra) y pesos.bin queda solo con lo pendiente. El manifiesto /hist/indice.csv guarda
+// el rango horario de cada segmento para abrir solo los que pide una exportación.
+//
+// pesos.bin se crea preasignado: un tramo contiguo de clústeres (f_expand) con
+// lugar para un día de muestras, rellenado con ceros. Escribir dentro de ese
+// tramo no busca clústeres libres ni toca la FAT. El fin lógico se lleva en RAM;
+// tras un corte es el primer registro en cero (búsqueda binaria, porque detrás
+// del fin solo hay ceros). Al cerrar el archivo se recorta al fin lógico y la
+// tarea escritora vuelve a extender la reserva de a pasos.
+
+#define MUESTRAS_BIN_RUTA           "/pesos.bin"
+#define MUESTRAS_BIN_RUTA_CSV       "/export.csv"   // Destino de la exportación
+#define MUESTRAS_BIN_RUTA_CSV_ANTERIOR "/pesos.csv" // Registro CSV de firmwares anteriores
+#define MUESTRAS_BIN_RUTA_LEGADO    "/legado.csv"   // pesos.csv apartado tras importar lo pendiente
+#define MUESTRAS_BIN_RUTA_ANTERIOR  "/pesos.old"    // Archivo con cabecera incompatible
+#define MUESTRAS_BIN_RUTA_TEMP      "/pesos.tmp"    // Cola sin enviar durante la rotación
+#define MUESTRAS_BIN_DIR_HISTORICO  "/hist"         // Segmentos ya enviados
+#define MUESTRAS_BIN_RUTA_MANIFIESTO "/hist/indice.csv"
+#define MUESTRAS_BIN_MAGIA          "HALB"
+#define MUESTRAS_BIN_VERSION        1
+
+// Bits de 'flags'
+#define MUESTRA_BIN_ESTABLE         0x01    // Peso estable según registro_cambios
+#define MUESTRA_BIN_SIN_RTC         0x02    // Hora tomada del reloj del sistema o del arranque
+#define MUESTRA_BIN_SIN_BATERIA     0x04    // No se pudo leer el medidor de batería
+
+typedef struct {
+    char magia[4];                      // MUESTRAS_BIN_MAGIA
+    uint16_t version;                   // MUESTRAS_BIN_VERSION
+    uint16_t tam_cabecera;              // sizeof(muestras_bin_cabecera_t)
+    uint16_t tam_registro;              // sizeof(muestra_bin_t)
+    uint8_t num_canales;                // HX711_NUM_CANALES al crear el archivo
+    uint8_t segmento;                   // Byte bajo de muestras_bin_cursor_t.segmento (0 en archivos anteriores)
+    uint32_t creado;                    // Epoch de creación
+    uint32_t crc;                       // CRC32 de los campos anteriores
+} muestras_bin_cabecera_t;
+
+typedef struct {
+    uint32_t epoch;                     // Hora local de la muestra (mktime)
+    int32_t raw;                        // Cuentas crudas (suma combinada)
+    int32_t peso_mg;                    // Peso calibrado al registrar
+    uint16_t bateria_mv;
+    uint8_t flags;                      // MUESTRA_BIN_*
+    uint8_t reservado;
+#if HX711_NUM_CANALES > 1
+    int32_t raw_canal[HX711_NUM_CANALES];
+#endif
+    uint32_t crc;                       // CRC32 de los campos anteriores
+} muestra_bin_t;
+
+// Byte de un registro en el archivo
+#define MUESTRAS_BIN_POSICION(indice)   ((long)(sizeof(muestras_bin_cabecera_t) + (size_t)(indice) * sizeof(muestra_bin_t)))
+
+// Vista de lectura del registro activo: los registros por debajo de 'total' no
+// cambian mientras la generación sea la misma (la SD solo agrega al final), así
+// que el envío puede soltar sistema.mutex_sd entre lecturas mientras la tarea
+// escritora sigue agregando
+typedef struct {
+    uint32_t total;                     // Registros confirmados (con fsync) al tomar la vista
+    uint32_t generacion;                // Cambia al recrear, recortar o rotar MUESTRAS_BIN_RUTA
+} muestras_bin_vista_t;
+
+// Cursor de envío: próxima muestra a enviar como archivo, byte y número de
+// secuencia. Junto con el contador de muestras agregadas da lo pendiente sin
+// leer la SD. Se guarda en la NVS (NVS_KEY_CURSOR) agrupando los avances.
+typedef struct {
+    uint32_t segmento;                  // Encarnación de MUESTRAS_BIN_RUTA (sube al crearlo o rotarlo)
+    uint32_t offset;                    // Byte de la próxima muestra a enviar
+    uint32_t secuencia;                 // Muestras enviadas desde el primer arranque
+} muestras_bin_cursor_t;
+
+#define MUESTRAS_BIN_CURSOR_INICIAL     { 0, sizeof(muestras_bin_cabecera_t), 0 }
+#define MUESTRAS_BIN_CURSOR_GUARDAR_MS  60000   // Mínimo entre escrituras de avances en la NVS
+
+typedef struct {
+    uint32_t recuperacion_us;           // Revisión de la cola al montar
+    uint32_t recuperacion_revisados;    // Registros leídos en esa revisión
+    uint32_t recuperacion_recortados;   // Registros finales con CRC inválido eliminados
+    uint32_t cursor_guardados;          // Escrituras del cursor en la NVS
+    uint32_t preasignacion_us;          // Última creación preasignada (f_expand + ceros)
+    uint32_t preasignaciones_contiguas; // Creaciones con f_expand (el resto, clústeres sueltos)
+} muestras_bin_stats_t;
+
+// Crea la cabecera si falta y recorta un registro a medio escribir y los
+// registros finales con CRC inválido (solo revisa el último búfer escrito);
+// con cabecera incompatible renombra el archivo a MUESTRAS_BIN_RUTA_ANTERIOR.
+// También completa o descarta una rotación interrumpida.
+esp_err_t muestras_bin_preparar(void);
+
+void muestras_bin_get_stats(muestras_bin_stats_t *stats);
+
+// Rellena el CRC de un registro ya completo
+void muestras_bin_sellar(muestra_bin_t *reg);
+bool muestras_bin_valido(const muestra_bin_t *reg);
+
+// Número de registros confirmados con fsync en MUESTRAS_BIN_RUTA (los que
+// siguen en el búfer de RAM o sin sincronizar no cuentan)
+uint32_t muestras_bin_contar(void);
+
+// Fin lógico y espacio asignado de MUESTRAS_BIN_RUTA, en registros (los lleva
+// la tarea escritora: agregadas, sincronizado y asignados_actualizar)
+uint32_t muestras_bin_registros(void);
+uint32_t muestras_bin_asignados(void);
+void muestras_bin_asignados_actualizar(uint32_t registros);
+void muestras_bin_sincronizado(void);
+// Registros a tener preasignados por delante: un día al intervalo de muestreo,
+// hasta CONFIG_HALO_SD_PREASIGNAR_KB (0 = sin preasignación)
+uint32_t muestras_bin_preasignar_objetivo(void);
+
+// Cursor de envío (sistema.envio.cursor): restaurar al arrancar, antes de montar la SD
+void muestras_bin_cursor_restaurar(void);
+// Escribe el cursor en la NVS si cambió; sin 'forzar', como mucho cada MUESTRAS_BIN_CURSOR_GUARDAR_MS
+esp_err_t muestras_bin_cursor_guardar(bool forzar);
+uint32_t muestras_bin_cursor_indice(const muestras_bin_cursor_t *cursor);
+void muestras_bin_cursor_avanzar(muestras_bin_cursor_t *cursor, uint32_t muestras);
+
+// Contador de muestras escritas en MUESTRAS_BIN_RUTA (lo avanza el vaciado del
+// registro; al montar se reconstruye con el cursor y el largo del archivo)
+void muestras_bin_agregadas(uint32_t muestras);
+// Muestras en la SD sin enviar: O(1), sin tocar la SD ni sistema.mutex_sd
+uint32_t muestras_bin_pendientes(void);
+
+// Lee hasta 'max' registros desde 'indice'; *leidos = 0 al final del archivo.
+// Con sistema.mutex_sd: sin él la SD puede desmontarse con el archivo abierto
+esp_err_t muestras_bin_leer(uint32_t indice, muestra_bin_t *regs, size_t max, size_t *leidos);
+
+// Toma una vista (con sistema.mutex_sd, tras sdcard_registros_vaciar(true) para
+// que la cuenta incluya lo escrito y sincronizado)
+void muestras_bin_vista(muestras_bin_vista_t *vista);
+// false si el archivo cambió desde la vista o la SD se desmontó (con sistema.mutex_sd)
+bool muestras_bin_vista_vigente(const muestras_bin_vista_t *vista);
+
+// Primer índice en [desde, hasta) con epoch > 'epoch' (hasta si no hay ninguno).
+// Búsqueda binaria: log2(n) lecturas de un registro. Supone epochs crecientes;
+// si el reloj retrocedió el resultado es aproximado (el envío sigue comprobando cada hora).
+uint32_t muestras_bin_buscar_epoch(uint32_t desde, uint32_t hasta, uint32_t epoch, uint32_t *lecturas);
+
+// Archiva lo ya enviado en /hist y deja en MUESTRAS_BIN_RUTA solo lo pendiente
+// (el cursor pasa al segmento siguiente); aplica la retención al terminar
+esp_err_t muestras_bin_rotar(void);
+
+// Borra los segmentos con más de CONFIG_HALO_SD_RETENCION_DIAS días (0 = conservar todo)
+// y, con menos de CONFIG_HALO_SD_LIBRE_MIN_MB libres en caché, los más viejos
+esp_err_t muestras_bin_depurar(void);
+
+// Escribe MUESTRAS_BIN_RUTA_CSV con las columnas del formato anterior (más mV y raw).
+// 'desde' = 0: solo el registro activo; si no, muestras con epoch >= desde del
+// histórico (solo los segmentos que lo alcanzan) y del registro activo.
+// Llamar sin sistema.mutex_sd: lo toma y lo suelta por tandas, así que el
+// registro y el envío siguen mientras tanto.
+#define MUESTRAS_BIN_EXPORTAR_DIAS_MAX  31      // Período máximo del comando "5 [días]"
+esp_err_t muestras_bin_exportar_csv(uint32_t desde, uint32_t *exportadas);
+
+#if CONFIG_HALO_BENCHMARKS
+void muestras_bin_benchmark(int muestras);
+#endif
+
+#endif // MUESTRAS_BIN_H
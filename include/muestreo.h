@@ -0,0 +1,56 @@
+#ifndef MUESTREO_H
+#define MUESTREO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include "cola_spsc.h"
+#include "hx711_lib.h"
+
+// Muestreador continuo del HX711: una tarea dedicada lee cada conversión
+// (despertada por dato listo) y la publica, con marca de tiempo, en una
+// cola SPSC por consumidor. Cada consumidor drena su cola a su propio ritmo.
+
+#ifndef CONFIG_HALO_MUESTREO_CAPACIDAD
+#define CONFIG_HALO_MUESTREO_CAPACIDAD 512
+#endif
+
+#define MUESTREO_DRENAJE_MS     250     // Periodo sugerido de drenaje para los consumidores
+
+// Muestra cruda con marca de tiempo
+typedef struct {
+    int64_t t_us;           // esp_timer_get_time() al completar la lectura
+    uint32_t epoch;         // Hora del sistema (segundos)
+    int32_t raw;            // Cuentas crudas del HX711
+    uint32_t secuencia;     // Número de muestra desde el arranque
+#if HX711_NUM_CANALES > 1
+    int32_t raw_canal[HX711_NUM_CANALES];   // Cuentas de cada celda ('raw' es su suma combinada)
+#endif
+} muestra_t;
+
+// Consumidores de la cola de muestras
+typedef enum {
+    MUESTREO_CONSUMIDOR_REGISTRO = 0,   // Filtrado y registro en SD (task_HX711)
+    MUESTREO_CONSUMIDOR_VIVO,           // Publicación en vivo por MQTT
+    MUESTREO_NUM_CONSUMIDORES
+} muestreo_consumidor_t;
+
+typedef struct {
+    uint32_t muestras;                  // Lecturas correctas del HX711
+    uint32_t errores;                   // Lecturas fallidas
+    cola_spsc_stats_t colas[MUESTREO_NUM_CONSUMIDORES];
+} muestreo_stats_t;
+
+void create_task_muestreo(void);
+void task_muestreo(void *pvParameters);
+
+// Habilita/deshabilita la alimentación de un consumidor (deshabilitado = no acumula)
+void muestreo_habilitar(muestreo_consumidor_t consumidor, bool habilitado);
+
+// Extrae la muestra más antigua pendiente del consumidor; false si no hay
+bool muestreo_leer(muestreo_consumidor_t consumidor, muestra_t *muestra);
+
+void muestreo_get_stats(muestreo_stats_t *stats);
+void muestreo_log_stats(void);
+
+#endif // MUESTREO_H
@@ -0,0 +1,47 @@
+#ifndef RECIENTES_H
+#define RECIENTES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "muestras_bin.h"
+
+// Caché de las últimas CONFIG_HALO_RECIENTES_MUESTRAS muestras registradas, en
+// RAM (o en la memoria RTC con CONFIG_HALO_RECIENTES_RTC, que sobrevive a los
+// reinicios por software). "Última muestra" y "últimas N" salen de aquí en
+// microsegundos sin tocar la SD; solo lo anterior a la ventana se lee de pesos.bin.
+//
+// Cada muestra tiene un número de secuencia creciente: leer por secuencia no se
+// desordena si task_HX711 agrega otra mientras tanto (como mucho la más vieja
+// ya no está y la lectura devuelve false).
+
+#define RECIENTES_MAGIA     0x52434E54u     // "RCNT"
+
+typedef struct {
+    uint32_t agregadas;                 // Muestras agregadas desde el arranque
+    uint32_t restauradas;               // Muestras válidas encontradas en la memoria RTC al arrancar
+    uint32_t de_cache;                  // Muestras servidas desde la caché
+    uint32_t de_sd;                     // Muestras que hubo que leer de la SD (fuera de la ventana)
+} recientes_stats_t;
+
+// Valida lo que quedó en la memoria RTC o vacía la caché (antes de crear las tareas)
+void recientes_init(void);
+
+// Agrega una muestra ya sellada (task_HX711, tras sdcard_log_muestra)
+void recientes_agregar(const muestra_bin_t *reg);
+
+// Secuencia siguiente a la última muestra; *primera = secuencia de la más vieja retenida
+uint32_t recientes_ventana(uint32_t *primera);
+// Copia la muestra de 'secuencia'; false si ya salió de la ventana o no existe
+bool recientes_leer(uint32_t secuencia, muestra_bin_t *reg);
+
+bool recientes_ultima(muestra_bin_t *reg);
+// Copia las últimas 'max' muestras (la más vieja primero); devuelve cuántas
+size_t recientes_ultimas(muestra_bin_t *regs, size_t max);
+
+// Cuenta muestras servidas fuera de la caché (lecturas de la SD de quien la usa)
+void recientes_contar_sd(uint32_t muestras);
+
+void recientes_get_stats(recientes_stats_t *stats);
+
+#endif // RECIENTES_H
@@ -0,0 +1,70 @@
+#ifndef REGISTRO_CAMBIOS_H
+#define REGISTRO_CAMBIOS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+// Decide qué muestras filtradas se registran en /pesos.bin.
+//  - Modo periódico: una fila cada 'muestreo_ms' (comportamiento original).
+//  - Modo por cambios: una fila cuando el peso estable sale de la banda
+//    muerta alrededor del último valor guardado, o cuando vence el latido.
+// El detector de estabilidad marca como "asentada" una lectura cuando las
+// últimas N muestras filtradas caben en una ventana de 'estable_mg'.
+
+#define REGISTRO_ESTABLE_MAX_N      32
+
+typedef enum {
+    REGISTRO_MODO_PERIODICO = 0,
+    REGISTRO_MODO_CAMBIOS,
+} registro_modo_t;
+
+typedef struct {
+    uint8_t modo;                       // registro_modo_t
+    uint8_t estable_n;                  // Muestras que deben caber en la ventana
+    uint16_t reservado;
+    uint32_t banda_mg;                  // Banda muerta alrededor del último valor guardado
+    uint32_t latido_s;                  // Máximo tiempo sin guardar una fila
+    uint32_t estable_mg;                // Ancho máximo de la ventana de estabilidad
+} registro_config_t;
+
+#define REGISTRO_CONFIG_DEFECTO { \
+    .modo = REGISTRO_MODO_CAMBIOS,  \
+    .estable_n = 8,                 \
+    .banda_mg = 20000,              \
+    .latido_s = 900,                \
+    .estable_mg = 10000,            \
+}
+
+typedef struct {
+    uint32_t evaluadas;                 // Pasadas de decisión con muestra disponible
+    uint32_t guardadas;                 // Filas escritas
+    uint32_t por_banda;                 // Filas por salir de la banda muerta
+    uint32_t por_latido;                // Filas por vencer el latido
+    uint32_t estables;                  // Filas marcadas como asentadas
+    uint32_t equivalentes;              // Filas que habría escrito el modo periódico
+} registro_stats_t;
+
+void registro_init(void);
+
+// Alimenta el detector de estabilidad con cada muestra filtrada
+void registro_actualizar(int32_t peso_mg);
+
+// Estado del detector de estabilidad con las muestras recibidas hasta ahora
+bool registro_estable(void);
+
+// true si hay que guardar ahora; 'estable' indica si la lectura está asentada.
+// En modo periódico devuelve true al vencer el intervalo aunque no haya muestra.
+bool registro_evaluar(bool hay_muestra, int32_t peso_mg, uint32_t ahora_ms, bool *estable);
+
+// Confirma que la fila se escribió (nueva referencia de banda y latido)
+void registro_confirmar(int32_t peso_mg, bool estable);
+
+// Aplica "clave=valor" (modo, banda_g, latido_s, estable_g, estable_n) y guarda en NVS;
+// ESP_ERR_NOT_FOUND si la clave no es de este módulo
+esp_err_t registro_configurar(const char *clave_valor);
+
+void registro_get_config(registro_config_t *cfg);
+void registro_get_stats(registro_stats_t *stats);
+
+#endif // REGISTRO_CAMBIOS_H
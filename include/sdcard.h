@@ -3,11 +3,13 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdbool.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
 #include "esp_vfs_fat.h"
 #include "sdmmc_cmd.h"
 #include "esp_log.h"
+#include "muestras_bin.h"
 
 // Configuración de pines SPI para SD
 #define PIN_NUM_MISO  19
@@ -16,6 +18,10 @@
 #define PIN_NUM_CS    5
 
 #define MOUNT_POINT "/sdcard"
+#define SDCARD_REMONTAJE_MIN_MS     1000    // Primera espera tras un corte (se duplica hasta CONFIG_HALO_SD_REMONTAJE_MAX_MS)
+#define SDCARD_RESERVA_LOTE         32      // Muestras de la cola por toma de mutex_sd al drenar
+#define SDCARD_ESCRITOR_PERIODO_MS  1000    // Despertar de la tarea escritora sin muestras nuevas (umbrales de vaciado)
+#define SDCARD_PREASIGNAR_PASO_BYTES 8192   // Ceros agregados a pesos.bin por vuelta de la tarea escritora
 #define EXAMPLE_MAX_CHAR_SIZE 64
 
 // Estructura para información de la tarjeta SD
@@ -25,6 +31,35 @@ typedef struct {
     const char *mount_point;
 } sdcard_info_t;
 
+// Registro con archivos abiertos y búfer en RAM: los registros se acumulan y se
+// escriben con una sola llamada al llenarse el búfer o al vencer
+// CONFIG_HALO_SD_FLUSH_MS; fsync según CONFIG_HALO_SD_SYNC_MS. Se vacía y
+// cierra al desmontar y al reiniciar (manejador de apagado).
+// Las muestras llegan por una cola en RAM y solo las escribe la tarea
+// SD_Escritor, así que quien registra nunca espera a la FAT.
+typedef enum {
+    SDCARD_REGISTRO_PESOS = 0,          // /pesos.bin (registros muestra_bin_t)
+    SDCARD_NUM_REGISTROS
+} sdcard_registro_t;
+
+typedef struct {
+    uint32_t lineas;                    // Filas o registros aceptados en el búfer
+    uint32_t perdidas;                  // Muestras descartadas con la cola de RAM llena
+    uint32_t bytes;                     // Bytes escritos en la SD
+    uint32_t escrituras;                // Llamadas a fwrite (una por vaciado)
+    uint32_t syncs;
+    uint32_t aperturas;                 // fopen de los registros (1 por archivo salvo errores)
+    uint32_t vaciado_us;                // Último vaciado (escritura + sync)
+    uint32_t vaciado_max_us;
+    uint32_t reservadas;                // Muestras encoladas para la tarea escritora
+    uint32_t reserva_ocupacion;         // Muestras esperando en la cola ahora
+    uint32_t reserva_max;
+    uint32_t cortes;                    // Cortes de la SD detectados
+    uint32_t remontajes;                // Intentos de remontaje
+    uint32_t corte_ms;                  // Duración del corte en curso o del último
+    uint32_t corte_max_ms;
+} sdcard_stats_t;
+
 // Funciones de inicialización
 esp_err_t sdcard_init(void);
 esp_err_t sdcard_deinit(void);
@@ -32,12 +67,27 @@ esp_err_t sdcard_unmount(void);
 
 // Funciones de archivos
 esp_err_t sdcard_write_file(const char *path, const char *data);
-esp_err_t sdcard_append_file(const char *path, const char *data);
 esp_err_t sdcard_append_fileV(const char *pathg, const char *datag);
 bool sdcard_file_exists(const char *path);
 
+// Funciones del registro con búfer (llamar con sistema.mutex_sd tomado)
+esp_err_t sdcard_registrar_bytes(sdcard_registro_t registro, const void *datos, size_t len);
+esp_err_t sdcard_registros_vaciar(bool sincronizar);    // Cola y búfer a la SD (p. ej. antes de leer pesos.bin)
+esp_err_t sdcard_registros_mantener(void);              // Vacía/sincroniza lo vencido por tiempo (tarea escritora)
+void sdcard_registros_cerrar(void);
+void sdcard_get_stats(sdcard_stats_t *stats);
+#if CONFIG_HALO_BENCHMARKS
+void sdcard_benchmark(int lineas);
+void sdcard_escritor_benchmark(int muestras);
+void sdcard_preasignacion_benchmark(int muestras);
+#endif
+
 // Funciones específicas para datos de peso
-esp_err_t sdcard_log_peso(float peso, struct tm *timeinfo);
+// Sella el CRC del registro y lo encola (CONFIG_HALO_SD_RESERVA_MUESTRAS) para
+// /pesos.bin; no requiere sistema.mutex_sd. Durante un corte espera al remontaje
+esp_err_t sdcard_log_muestra(muestra_bin_t *reg);
+// Marca la SD como caída; la tarea escritora la remonta con espera creciente
+void sdcard_falla_iniciar(void);
 esp_err_t sdcard_log_error(const char *error_msg, struct tm *timeinfo);
 
 // Funciones de utilidad
@@ -12,11 +12,14 @@
 #include "esp_http_client.h"
 #include <limits.h>
 #include "freertos/portmacro.h"
+#include "histograma.h"
 
 void create_task_HX711(void);
 void create_task_MQTT(void);
 void task_MQTT(void *pvParameters); 
 void task_HX711(void *pvParameters);                      
+// Desvío del periodo de registro de task_HX711 respecto de MUESTREO_DRENAJE_MS
+void task_HX711_get_jitter(histograma_t *out);
 void user_button_init(void);
 void user_button_task(void* arg);
 void IRAM_ATTR user_button_isr_handler(void* arg);
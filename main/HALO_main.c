@@ -14,6 +14,10 @@ void app_main(void) {
 
          
     inicializar_sistema();
+#if CONFIG_HALO_BENCHMARKS
+    benchmarks_ejecutar();
+#endif
+    create_task_muestreo();
     create_task_HX711();
     create_task_MQTT();
     printf("========================================\n");
@@ -0,0 +1,414 @@
+#include "../include/agregados.h"
+#include "../include/HALO.h"
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+#include <stddef.h>
+
+static const char *AGREGADOS_TAG = "AGREGADOS";
+
+// El formato en disco no debe depender del relleno del compilador
+_Static_assert(sizeof(agregado_t) == 40, "casillero con relleno inesperado");
+_Static_assert(sizeof(agregados_cabecera_t) == 20, "cabecera de agregados con relleno inesperado");
+
+#define AGREGADOS_EPOCH_MIN     1704067200u // 2024-01-01: antes de esto la hora no es confiable
+#define AGREGADOS_PENDIENTES    16          // Casilleros cerrados a la espera del próximo vuelco
+#define AGREGADOS_LOTE          16          // Casilleros por lectura en una consulta
+
+static const uint16_t casilleros[AGREGADOS_NUM_NIVELES] = AGREGADOS_CASILLEROS;
+static const uint32_t periodos[AGREGADOS_NUM_NIVELES] = AGREGADOS_PERIODOS_S;
+
+// Período en curso de cada nivel (inicio = 0: ninguno desde el arranque)
+static agregado_t abiertos[AGREGADOS_NUM_NIVELES];
+static bool abiertos_cambiados[AGREGADOS_NUM_NIVELES];
+// Períodos ya cerrados sin escribir todavía
+static agregado_t pendientes[AGREGADOS_PENDIENTES];
+static uint8_t pendientes_nivel[AGREGADOS_PENDIENTES];
+static uint32_t num_pendientes = 0;
+// Hora local - UTC en segundos (los días empiezan a la medianoche local)
+static int32_t desfase_s = 0;
+static agregados_stats_t stats;
+
+// Búfer de lectura de las consultas (todo el módulo va con sistema.mutex_sd)
+static agregado_t lote[AGREGADOS_LOTE];
+static int lote_nivel = -1;
+static uint32_t lote_primero = 0;
+static uint32_t lote_cantidad = 0;
+
+static void agregados_ruta(char *buffer, size_t tam) {
+    snprintf(buffer, tam, "%s%s", sdcard_info.mount_point, AGREGADOS_RUTA);
+}
+
+static uint32_t agregados_crc_cabecera(const agregados_cabecera_t *cab) {
+    return esp_rom_crc32_le(0, (const uint8_t *)cab, offsetof(agregados_cabecera_t, crc));
+}
+
+static void agregados_sellar(agregado_t *a) {
+    a->crc = esp_rom_crc32_le(0, (const uint8_t *)a, offsetof(agregado_t, crc));
+}
+
+static bool agregados_valido(const agregado_t *a) {
+    return a->crc == esp_rom_crc32_le(0, (const uint8_t *)a, offsetof(agregado_t, crc));
+}
+
+// Inicio del período de 'nivel' que contiene 'epoch'
+static uint32_t agregados_inicio(uint32_t epoch, int nivel) {
+    return epoch - (uint32_t)(((int64_t)epoch + desfase_s) % periodos[nivel]);
+}
+
+static uint32_t agregados_casillero(uint32_t inicio, int nivel) {
+    return (uint32_t)((((int64_t)inicio + desfase_s) / periodos[nivel]) % casilleros[nivel]);
+}
+
+static long agregados_posicion(int nivel, uint32_t casillero) {
+    uint32_t indice = casillero;
+    for (int i = 0; i < nivel; i++) {
+        indice += casilleros[i];
+    }
+    return (long)(sizeof(agregados_cabecera_t) + indice * sizeof(agregado_t));
+}
+
+// Desfase de la zona horaria configurada (rtc_lib.c la fija antes de montar la SD)
+static int32_t agregados_calcular_desfase(void) {
+    time_t ahora = time(NULL);
+    if (ahora < (time_t)AGREGADOS_EPOCH_MIN) {
+        ahora = (time_t)AGREGADOS_EPOCH_MIN;
+    }
+    struct tm utc;
+    gmtime_r(&ahora, &utc);
+    utc.tm_isdst = -1;
+    // mktime toma los campos UTC como hora local: la diferencia es el desfase
+    return (int32_t)(ahora - mktime(&utc));
+}
+
+static bool agregados_cabecera_valida(const agregados_cabecera_t *cab) {
+    if (memcmp(cab->magia, AGREGADOS_MAGIA, sizeof(cab->magia)) != 0 ||
+        cab->version != AGREGADOS_VERSION ||
+        cab->tam_casillero != sizeof(agregado_t) ||
+        cab->crc != agregados_crc_cabecera(cab)) {
+        return false;
+    }
+    for (int i = 0; i < AGREGADOS_NUM_NIVELES; i++) {
+        if (cab->casilleros[i] != casilleros[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+esp_err_t agregados_preparar(void) {
+    char ruta[128];
+    agregados_ruta(ruta, sizeof(ruta));
+    desfase_s = agregados_calcular_desfase();
+    lote_nivel = -1;
+
+    uint32_t total = 0;
+    for (int i = 0; i < AGREGADOS_NUM_NIVELES; i++) {
+        total += casilleros[i];
+    }
+    long tam_esperado = (long)(sizeof(agregados_cabecera_t) + total * sizeof(agregado_t));
+
+    agregados_cabecera_t cab;
+    struct stat st;
+    FILE *f = fopen(ruta, "rb");
+    if (f != NULL) {
+        bool valido = fread(&cab, sizeof(cab), 1, f) == 1 && agregados_cabecera_valida(&cab);
+        fclose(f);
+        if (valido && stat(ruta, &st) == 0 && st.st_size == tam_esperado) {
+            ESP_LOGI(AGREGADOS_TAG, "%s: %u casilleros (desfase %d s)", ruta, (unsigned)total, (int)desfase_s);
+            return ESP_OK;
+        }
+        ESP_LOGW(AGREGADOS_TAG, "%s con otro formato; se recrea", ruta);
+    }
+
+    // Archivo nuevo con todos los casilleros vacíos (inicio = 0)
+    memset(&cab, 0, sizeof(cab));
+    memcpy(cab.magia, AGREGADOS_MAGIA, sizeof(cab.magia));
+    cab.version = AGREGADOS_VERSION;
+    cab.tam_casillero = sizeof(agregado_t);
+    for (int i = 0; i < AGREGADOS_NUM_NIVELES; i++) {
+        cab.casilleros[i] = casilleros[i];
+    }
+    cab.crc = agregados_crc_cabecera(&cab);
+
+    uint64_t antes = espacio_tam(ruta);
+    f = fopen(ruta, "wb");
+    if (f == NULL) {
+        ESP_LOGE(AGREGADOS_TAG, "Error al crear %s", ruta);
+        return ESP_FAIL;
+    }
+    bool ok = fwrite(&cab, sizeof(cab), 1, f) == 1;
+    memset(lote, 0, sizeof(lote));
+    for (uint32_t escritos = 0; ok && escritos < total; escritos += AGREGADOS_LOTE) {
+        size_t n = (total - escritos < AGREGADOS_LOTE) ? total - escritos : AGREGADOS_LOTE;
+        ok = fwrite(lote, sizeof(agregado_t), n, f) == n;
+    }
+    bool cerrado = fclose(f) == 0;
+    espacio_archivo(ruta, antes);
+    if (!cerrado || !ok) {
+        ESP_LOGE(AGREGADOS_TAG, "Error al inicializar %s", ruta);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(AGREGADOS_TAG, "%s creado: %u casilleros de %u bytes", ruta,
+             (unsigned)total, (unsigned)sizeof(agregado_t));
+    return ESP_OK;
+}
+
+// Lee el casillero de 'inicio' en 'nivel'; false si no tiene ese período
+static bool agregados_leer(FILE *f, int nivel, uint32_t inicio, agregado_t *a, bool *danado) {
+    uint32_t casillero = agregados_casillero(inicio, nivel);
+    if (lote_nivel != nivel || casillero < lote_primero || casillero >= lote_primero + lote_cantidad) {
+        // Las consultas recorren casilleros consecutivos: se leen de a AGREGADOS_LOTE
+        lote_nivel = -1;
+        uint32_t n = casilleros[nivel] - casillero;
+        if (n > AGREGADOS_LOTE) {
+            n = AGREGADOS_LOTE;
+        }
+        if (f == NULL || fseek(f, agregados_posicion(nivel, casillero), SEEK_SET) != 0) {
+            return false;
+        }
+        lote_cantidad = (uint32_t)fread(lote, sizeof(agregado_t), n, f);
+        if (lote_cantidad == 0) {
+            return false;
+        }
+        lote_nivel = nivel;
+        lote_primero = casillero;
+    }
+    *a = lote[casillero - lote_primero];
+    if (a->inicio != inicio) {
+        return false;
+    }
+    if (!agregados_valido(a)) {
+        if (danado != NULL) {
+            *danado = true;
+        }
+        return false;
+    }
+    return true;
+}
+
+// Copia en RAM del período (abierto o cerrado sin escribir); NULL si no hay
+static const agregado_t *agregados_en_ram(int nivel, uint32_t inicio) {
+    if (abiertos[nivel].inicio == inicio) {
+        return &abiertos[nivel];
+    }
+    for (int i = (int)num_pendientes - 1; i >= 0; i--) {
+        if (pendientes_nivel[i] == nivel && pendientes[i].inicio == inicio) {
+            return &pendientes[i];
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t agregados_escribir(FILE *f, int nivel, agregado_t *a) {
+    agregados_sellar(a);
+    if (fseek(f, agregados_posicion(nivel, agregados_casillero(a->inicio, nivel)), SEEK_SET) != 0 ||
+        fwrite(a, sizeof(*a), 1, f) != 1) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t agregados_persistir(void) {
+    bool cambios = num_pendientes > 0;
+    for (int i = 0; i < AGREGADOS_NUM_NIVELES; i++) {
+        cambios = cambios || abiertos_cambiados[i];
+    }
+    if (!cambios) {
+        return ESP_OK;
+    }
+    if (!sdcard_info.is_mounted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    char ruta[128];
+    agregados_ruta(ruta, sizeof(ruta));
+    FILE *f = fopen(ruta, "r+b");
+    if (f == NULL) {
+        ESP_LOGE(AGREGADOS_TAG, "Error al abrir %s", ruta);
+        return ESP_FAIL;
+    }
+    esp_err_t ret = ESP_OK;
+    for (uint32_t i = 0; i < num_pendientes && ret == ESP_OK; i++) {
+        ret = agregados_escribir(f, pendientes_nivel[i], &pendientes[i]);
+    }
+    for (int i = 0; i < AGREGADOS_NUM_NIVELES && ret == ESP_OK; i++) {
+        if (abiertos_cambiados[i]) {
+            ret = agregados_escribir(f, i, &abiertos[i]);
+        }
+    }
+    if (fclose(f) != 0) {
+        ret = ESP_FAIL;
+    }
+    lote_nivel = -1;
+    if (ret != ESP_OK) {
+        ESP_LOGE(AGREGADOS_TAG, "Error al escribir %s", ruta);
+        return ret;
+    }
+    num_pendientes = 0;
+    memset(abiertos_cambiados, 0, sizeof(abiertos_cambiados));
+    stats.escrituras++;
+    return ESP_OK;
+}
+
+// Pasa el período abierto a la cola de escritura
+static void agregados_cerrar(int nivel) {
+    if (num_pendientes == AGREGADOS_PENDIENTES && agregados_persistir() != ESP_OK) {
+        // Sin SD: se pierde el cerrado más antiguo (el registro crudo sigue en la cola de la SD)
+        memmove(&pendientes[0], &pendientes[1], (AGREGADOS_PENDIENTES - 1) * sizeof(pendientes[0]));
+        memmove(&pendientes_nivel[0], &pendientes_nivel[1], AGREGADOS_PENDIENTES - 1);
+        num_pendientes--;
+        stats.descartados++;
+    }
+    pendientes[num_pendientes] = abiertos[nivel];
+    pendientes_nivel[num_pendientes] = (uint8_t)nivel;
+    num_pendientes++;
+    abiertos_cambiados[nivel] = false;
+}
+
+// Abre el período de 'inicio': si ya tiene casillero (reinicio a mitad del período
+// o reloj atrasado) se sigue sumando sobre él
+static void agregados_abrir(int nivel, uint32_t inicio) {
+    const agregado_t *previo = agregados_en_ram(nivel, inicio);
+    agregado_t leido;
+    if (previo == NULL && sdcard_info.is_mounted) {
+        char ruta[128];
+        agregados_ruta(ruta, sizeof(ruta));
+        FILE *f = fopen(ruta, "rb");
+        if (f != NULL) {
+            if (agregados_leer(f, nivel, inicio, &leido, NULL)) {
+                previo = &leido;
+            }
+            fclose(f);
+        }
+    }
+    if (previo != NULL) {
+        abiertos[nivel] = *previo;
+    } else {
+        memset(&abiertos[nivel], 0, sizeof(abiertos[nivel]));
+        abiertos[nivel].inicio = inicio;
+    }
+}
+
+void agregados_agregar(const muestra_bin_t *reg) {
+    if (reg == NULL || !muestras_bin_valido(reg) || reg->epoch < AGREGADOS_EPOCH_MIN) {
+        return;
+    }
+    for (int nivel = 0; nivel < AGREGADOS_NUM_NIVELES; nivel++) {
+        uint32_t inicio = agregados_inicio(reg->epoch, nivel);
+        agregado_t *a = &abiertos[nivel];
+        if (a->inicio != inicio) {
+            if (a->inicio != 0 && a->n > 0) {
+                agregados_cerrar(nivel);
+            }
+            agregados_abrir(nivel, inicio);
+        }
+        if (a->n == 0 || reg->peso_mg < a->min_mg) {
+            a->min_mg = reg->peso_mg;
+        }
+        if (a->n == 0 || reg->peso_mg > a->max_mg) {
+            a->max_mg = reg->peso_mg;
+        }
+        a->n++;
+        a->suma_mg += reg->peso_mg;
+        a->suma_cuadrados += (double)reg->peso_mg * reg->peso_mg;
+        abiertos_cambiados[nivel] = true;
+    }
+    stats.muestras++;
+}
+
+static void agregados_combinar(agregados_resultado_t *res, const agregado_t *a) {
+    if (a->n == 0) {
+        return;
+    }
+    if (res->n == 0 || a->min_mg < res->min_mg) {
+        res->min_mg = a->min_mg;
+    }
+    if (res->n == 0 || a->max_mg > res->max_mg) {
+        res->max_mg = a->max_mg;
+    }
+    res->n += a->n;
+    res->suma_mg += a->suma_mg;
+    res->suma_cuadrados += a->suma_cuadrados;
+}
+
+// El casillero de 't' aún no fue reutilizado por un período posterior a 'referencia'
+static bool agregados_alcanzable(int nivel, uint32_t t, uint32_t referencia) {
+    uint32_t actual = agregados_inicio(referencia, nivel);
+    return t > actual || actual - t < (uint32_t)casilleros[nivel] * periodos[nivel];
+}
+
+/**
+ * @brief Agregado de [desde, hasta) combinando casilleros de distinto nivel
+ *
+ * Recorre el rango de izquierda a derecha tomando en cada paso el período más
+ * largo que empieza ahí y cabe entero: minutos hasta la primera hora, horas
+ * hasta el primer día, días, y lo mismo al revés en el otro borde. Un rango de
+ * un año son ~365 casilleros de días más a lo sumo 46 de horas y 118 de minutos.
+ */
+esp_err_t agregados_consultar(uint32_t desde, uint32_t hasta, agregados_resultado_t *res) {
+    if (res == NULL || hasta <= desde) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int64_t t_inicio = esp_timer_get_time();
+    memset(res, 0, sizeof(*res));
+    res->desde = agregados_inicio(desde, AGREGADOS_MINUTO);
+    res->hasta = agregados_inicio(hasta - 1, AGREGADOS_MINUTO) + periodos[AGREGADOS_MINUTO];
+
+    // El período abierto más reciente marca qué casilleros siguen vigentes
+    uint32_t referencia = abiertos[AGREGADOS_MINUTO].inicio;
+    if (referencia == 0) {
+        referencia = (uint32_t)time(NULL);
+    }
+
+    FILE *f = NULL;
+    if (sdcard_info.is_mounted) {
+        char ruta[128];
+        agregados_ruta(ruta, sizeof(ruta));
+        f = fopen(ruta, "rb");
+    }
+    lote_nivel = -1;
+
+    uint64_t t = res->desde;
+    while (t < res->hasta) {
+        int nivel = AGREGADOS_DIA;
+        while (nivel > AGREGADOS_MINUTO &&
+               (agregados_inicio((uint32_t)t, nivel) != t || t + periodos[nivel] > res->hasta)) {
+            nivel--;
+        }
+        uint32_t inicio = (uint32_t)t;
+        t += periodos[nivel];
+        if (!agregados_alcanzable(nivel, inicio, referencia)) {
+            res->faltantes++;
+            continue;
+        }
+        res->casilleros++;
+        const agregado_t *a = agregados_en_ram(nivel, inicio);
+        agregado_t leido;
+        bool danado = false;
+        if (a == NULL && agregados_leer(f, nivel, inicio, &leido, &danado)) {
+            a = &leido;
+        }
+        if (a != NULL) {
+            agregados_combinar(res, a);
+        } else if (danado) {
+            res->faltantes++;
+        }
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    uint32_t duracion_us = (uint32_t)(esp_timer_get_time() - t_inicio);
+    stats.consultas++;
+    stats.consulta_us = duracion_us;
+    if (duracion_us > stats.consulta_max_us) {
+        stats.consulta_max_us = duracion_us;
+    }
+    return ESP_OK;
+}
+
+void agregados_get_stats(agregados_stats_t *out) {
+    if (out != NULL) {
+        *out = stats;
+    }
+}
@@ -0,0 +1,335 @@
+#include "../include/autocero.h"
+#include "../include/HALO.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static const char *AUTOCERO_TAG = "AUTOCERO";
+
+// Corrección persistida: solo es válida para el offset calibrado con el que se obtuvo
+typedef struct {
+    int32_t offset_base;
+    int32_t correccion;
+} autocero_nvs_t;
+
+static autocero_config_t config = AUTOCERO_CONFIG_DEFECTO;
+static autocero_estado_t estado;
+static portMUX_TYPE autocero_spinlock = portMUX_INITIALIZER_UNLOCKED;
+// Tara o calibración pendiente de adoptar (con hx711_calibracion_tomar())
+static bool reinicio_pendiente = false;
+static int32_t offset_reinicio = 0;
+// Copia para autocero_get_stats() (con autocero_spinlock)
+static autocero_stats_t stats_publicadas;
+static int32_t correccion_guardada = 0;
+static uint32_t t_ultimo_guardado_ms = 0;
+static uint32_t guardados = 0;
+
+bool autocero_paso(autocero_estado_t *st, const autocero_config_t *cfg, float cuentas_por_kg,
+                   int32_t raw, bool estable, uint32_t ahora_ms) {
+    float escala = fabsf(cuentas_por_kg);
+    if (escala < 1.0f) {
+        return false;
+    }
+    int32_t error = raw - (st->offset_base + st->correccion);
+    float peso_mg = (float)error * 1e6f / escala;
+
+    // Solo se sigue el cero con la balanza asentada y vacía
+    if (!estable || fabsf(peso_mg) > (float)cfg->zona_mg) {
+        st->error_acum = 0;
+        st->n_acum = 0;
+        return false;
+    }
+    st->error_acum += error;
+    st->n_acum++;
+    if (st->n_acum < AUTOCERO_MIN_MUESTRAS || ahora_ms - st->t_ultimo_ajuste_ms < cfg->periodo_ms) {
+        return false;
+    }
+
+    int32_t error_medio = (int32_t)(st->error_acum / (int64_t)st->n_acum);
+    st->error_acum = 0;
+    st->n_acum = 0;
+    st->t_ultimo_ajuste_ms = ahora_ms;
+
+    // Ganancia 1/2 por ajuste: converge en pocos periodos sin perseguir el ruido
+    int32_t delta = error_medio / 2;
+    if (delta == 0) {
+        delta = error_medio;
+    }
+    int32_t max_cuentas = (int32_t)((float)cfg->max_mg * escala / 1e6f);
+    int32_t deseada = st->correccion + delta;
+    int32_t nueva = deseada;
+    if (nueva > max_cuentas) nueva = max_cuentas;
+    if (nueva < -max_cuentas) nueva = -max_cuentas;
+    if (nueva != deseada) {
+        st->saturaciones++;
+    }
+    if (nueva == st->correccion) {
+        return false;
+    }
+    st->correccion = nueva;
+    st->ajustes++;
+    return true;
+}
+
+// ------------------------------ NVS ------------------------------
+
+static esp_err_t autocero_guardar_blob(const char *clave, const void *datos, size_t tam) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs_handle, clave, datos, tam);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    return err;
+}
+
+static void autocero_guardar_correccion(uint32_t ahora_ms) {
+    autocero_nvs_t blob = { .offset_base = estado.offset_base, .correccion = estado.correccion };
+    if (autocero_guardar_blob(NVS_KEY_AUTOCERO, &blob, sizeof(blob)) == ESP_OK) {
+        correccion_guardada = estado.correccion;
+        t_ultimo_guardado_ms = ahora_ms;
+        guardados++;
+    } else {
+        ESP_LOGW(AUTOCERO_TAG, "⚠️ No se pudo guardar la corrección de cero");
+    }
+}
+
+// Con hx711_calibracion_tomar(): una tara no puede caer entre la base y esta escritura
+static void autocero_aplicar_offset(void) {
+    offset = estado.offset_base + estado.correccion;
+    hx711_actualizar_calibracion_fija();
+}
+
+static void autocero_publicar_stats(void) {
+    autocero_stats_t copia = {
+        .correccion = estado.correccion,
+        .correccion_mg = (scale != 0.0f) ? (int32_t)((float)estado.correccion * 1e6f / scale) : 0,
+        .ajustes = estado.ajustes,
+        .saturaciones = estado.saturaciones,
+        .guardados = guardados,
+    };
+    portENTER_CRITICAL(&autocero_spinlock);
+    stats_publicadas = copia;
+    portEXIT_CRITICAL(&autocero_spinlock);
+}
+
+void autocero_init(void) {
+    nvs_handle_t nvs_handle;
+    autocero_nvs_t blob = { 0 };
+    bool hay_blob = false;
+
+    memset(&estado, 0, sizeof(estado));
+    estado.offset_base = offset;
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK) {
+        autocero_config_t leida;
+        size_t tam = sizeof(leida);
+        if (nvs_get_blob(nvs_handle, NVS_KEY_AUTOCERO_CFG, &leida, &tam) == ESP_OK && tam == sizeof(leida)) {
+            config = leida;
+        }
+        tam = sizeof(blob);
+        hay_blob = (nvs_get_blob(nvs_handle, NVS_KEY_AUTOCERO, &blob, &tam) == ESP_OK && tam == sizeof(blob));
+        nvs_close(nvs_handle);
+    }
+
+    if (hay_blob && blob.offset_base == offset && config.habilitado) {
+        estado.correccion = blob.correccion;
+        correccion_guardada = blob.correccion;
+        autocero_aplicar_offset();
+        ESP_LOGI(AUTOCERO_TAG, "Corrección de cero restaurada: %d cuentas", (int)estado.correccion);
+    } else if (hay_blob) {
+        ESP_LOGI(AUTOCERO_TAG, "Corrección de cero descartada (calibración distinta o deshabilitado)");
+    }
+    t_ultimo_guardado_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    autocero_publicar_stats();
+}
+
+void autocero_reiniciar(int32_t offset_nuevo) {
+    offset_reinicio = offset_nuevo;
+    reinicio_pendiente = true;
+}
+
+void autocero_actualizar(int32_t raw, bool estable, uint32_t ahora_ms) {
+    // Sin esperar: con una tara o calibración en curso esta muestra no cuenta
+    if (!hx711_calibracion_tomar(0)) {
+        estado.error_acum = 0;
+        estado.n_acum = 0;
+        return;
+    }
+    if (reinicio_pendiente) {
+        // La tara manda: la corrección en curso y lo acumulado se descartan
+        reinicio_pendiente = false;
+        estado.offset_base = offset_reinicio;
+        estado.correccion = 0;
+        estado.error_acum = 0;
+        estado.n_acum = 0;
+        hx711_calibracion_soltar();
+        autocero_guardar_correccion(ahora_ms);
+        autocero_publicar_stats();
+        return;
+    }
+
+    autocero_config_t cfg;
+    portENTER_CRITICAL(&autocero_spinlock);
+    cfg = config;
+    portEXIT_CRITICAL(&autocero_spinlock);
+    if (!cfg.habilitado) {
+        bool volver = (estado.correccion != 0);
+        if (volver) {
+            // Deshabilitado: volver al offset calibrado
+            estado.correccion = 0;
+            autocero_aplicar_offset();
+        }
+        hx711_calibracion_soltar();
+        if (volver) {
+            autocero_guardar_correccion(ahora_ms);
+        }
+        autocero_publicar_stats();
+        return;
+    }
+
+    bool ajustado = autocero_paso(&estado, &cfg, scale, raw, estable, ahora_ms);
+    if (ajustado) {
+        autocero_aplicar_offset();
+    }
+    hx711_calibracion_soltar();
+    if (ajustado) {
+        ESP_LOGD(AUTOCERO_TAG, "Cero ajustado: corrección %d cuentas", (int)estado.correccion);
+    }
+
+    // Guardado agrupado: solo cambios relevantes y como mucho uno por hora
+    float pendiente_mg = (scale != 0.0f) ?
+        fabsf((float)(estado.correccion - correccion_guardada) * 1e6f / scale) : 0.0f;
+    if (pendiente_mg >= (float)AUTOCERO_GUARDADO_MIN_MG &&
+        ahora_ms - t_ultimo_guardado_ms >= AUTOCERO_GUARDADO_MS) {
+        autocero_guardar_correccion(ahora_ms);
+    }
+    autocero_publicar_stats();
+}
+
+esp_err_t autocero_configurar(const char *clave_valor) {
+    const char *igual = (clave_valor != NULL) ? strchr(clave_valor, '=') : NULL;
+    if (igual == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t largo = (size_t)(igual - clave_valor);
+    const char *valor = igual + 1;
+    long v = strtol(valor, NULL, 10);
+
+    autocero_config_t nueva;
+    portENTER_CRITICAL(&autocero_spinlock);
+    nueva = config;
+    portEXIT_CRITICAL(&autocero_spinlock);
+
+    if (largo == strlen("autocero") && strncmp(clave_valor, "autocero", largo) == 0) {
+        if (strcmp(valor, "on") == 0 || strcmp(valor, "1") == 0) {
+            nueva.habilitado = 1;
+        } else if (strcmp(valor, "off") == 0 || strcmp(valor, "0") == 0) {
+            nueva.habilitado = 0;
+        } else {
+            return ESP_ERR_INVALID_ARG;
+        }
+    } else if (largo == strlen("autocero_zona_g") && strncmp(clave_valor, "autocero_zona_g", largo) == 0) {
+        if (v < 1 || v > 100000) return ESP_ERR_INVALID_ARG;
+        nueva.zona_mg = (uint32_t)v * 1000;
+    } else if (largo == strlen("autocero_max_g") && strncmp(clave_valor, "autocero_max_g", largo) == 0) {
+        if (v < 0 || v > 1000000) return ESP_ERR_INVALID_ARG;
+        nueva.max_mg = (uint32_t)v * 1000;
+    } else {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    portENTER_CRITICAL(&autocero_spinlock);
+    config = nueva;
+    portEXIT_CRITICAL(&autocero_spinlock);
+    return autocero_guardar_blob(NVS_KEY_AUTOCERO_CFG, &nueva, sizeof(nueva));
+}
+
+void autocero_get_stats(autocero_stats_t *out) {
+    if (out == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&autocero_spinlock);
+    *out = stats_publicadas;
+    portEXIT_CRITICAL(&autocero_spinlock);
+}
+
+#if CONFIG_HALO_BENCHMARKS
+// ------------------------- Simulación de deriva -------------------------
+
+#define SIM_CUENTAS_POR_KG      20000.0f
+#define SIM_DURACION_S          (48 * 3600)
+#define SIM_RUIDO_CUENTAS       40
+#define SIM_TOLERANCIA_CUENTAS  10
+
+typedef enum {
+    PERFIL_RAMPA = 0,       // Fluencia lineal: 200 cuentas/h
+    PERFIL_TERMICO,         // Ciclo diario de ±600 cuentas
+    PERFIL_ESCALON,         // Salto de 800 cuentas a la hora
+    PERFIL_CON_CARGA,       // Rampa lenta con 5 kg apoyados entre las 6 h y las 30 h
+    NUM_PERFILES
+} sim_perfil_t;
+
+static const char *nombres_perfil[NUM_PERFILES] = { "rampa", "termico", "escalon", "con_carga" };
+
+static float sim_deriva(sim_perfil_t perfil, uint32_t t_s) {
+    switch (perfil) {
+        case PERFIL_RAMPA:     return 200.0f * (float)t_s / 3600.0f;
+        case PERFIL_TERMICO:   return 600.0f * sinf(2.0f * (float)M_PI * (float)t_s / 86400.0f);
+        case PERFIL_ESCALON:   return (t_s >= 3600) ? 800.0f : 0.0f;
+        case PERFIL_CON_CARGA: return 100.0f * (float)t_s / 3600.0f;
+        default:               return 0.0f;
+    }
+}
+
+/**
+ * @brief Simula 48 h a 1 muestra/s por perfil y registra error y convergencia
+ *
+ * Error de seguimiento = offset corregido - cero real. La convergencia es el
+ * último instante en que el error estuvo fuera de la tolerancia estando vacía.
+ */
+void autocero_simulacion(void) {
+    const autocero_config_t cfg = AUTOCERO_CONFIG_DEFECTO;
+    const int32_t offset_real = 8388;
+
+    for (int p = 0; p < NUM_PERFILES; p++) {
+        autocero_estado_t st = { .offset_base = offset_real };
+        uint32_t semilla = 0x2545F491u;
+        double suma_cuad = 0.0;
+        uint32_t n_error = 0;
+        int32_t max_error = 0;
+        uint32_t t_fuera_s = 0;
+
+        for (uint32_t t = 0; t < SIM_DURACION_S; t++) {
+            semilla ^= semilla << 13;
+            semilla ^= semilla >> 17;
+            semilla ^= semilla << 5;
+            int32_t cero = offset_real + (int32_t)lroundf(sim_deriva((sim_perfil_t)p, t));
+            bool cargada = (p == PERFIL_CON_CARGA && t >= 6 * 3600 && t < 30 * 3600);
+            int32_t raw = cero + (cargada ? (int32_t)(5.0f * SIM_CUENTAS_POR_KG) : 0) +
+                          (int32_t)(semilla % (2 * SIM_RUIDO_CUENTAS + 1)) - SIM_RUIDO_CUENTAS;
+
+            autocero_paso(&st, &cfg, SIM_CUENTAS_POR_KG, raw, true, t * 1000);
+
+            int32_t error = st.offset_base + st.correccion - cero;
+            if (!cargada && abs(error) > SIM_TOLERANCIA_CUENTAS) {
+                t_fuera_s = t;
+            }
+            if (t >= 3600 && !cargada) {
+                suma_cuad += (double)error * error;
+                n_error++;
+                if (abs(error) > max_error) max_error = abs(error);
+            }
+        }
+
+        float rms_mg = (n_error > 0) ? (float)sqrt(suma_cuad / n_error) * 1e6f / SIM_CUENTAS_POR_KG : 0.0f;
+        ESP_LOGI(AUTOCERO_TAG, "⏱️ Simulación %-9s: RMS %.0f mg, max %.0f mg, convergencia %u s, ajustes %u, saturaciones %u",
+                 nombres_perfil[p], rms_mg, (float)max_error * 1e6f / SIM_CUENTAS_POR_KG,
+                 (unsigned)t_fuera_s, (unsigned)st.ajustes, (unsigned)st.saturaciones);
+    }
+}
+#endif // CONFIG_HALO_BENCHMARKS
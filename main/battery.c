@@ -36,26 +36,3 @@ esp_err_t battery_get_voltage(uint16_t *voltage)
 {
     return bq27427_get_voltage(&fuel_gauge_dev, voltage);
 }
-
-
-void sdcard_log_voltaje(struct tm *timeinfo)
-{
-
-    uint16_t voltage;
-    esp_err_t ret = battery_get_voltage(&voltage);
-
-    char log_entry[128]; 
-    int written = snprintf(log_entry, sizeof(log_entry), 
-                          "%04d-%02d-%02d,%02d:%02d:%02d,%.2f\n",
-                          timeinfo->tm_year + 1900, timeinfo->tm_mon + 1, timeinfo->tm_mday,
-                          timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec, voltage/1000.0f);
-    
-    if (written > 0 && written < sizeof(log_entry)) {
-        sdcard_append_file("/voltajes.csv", log_entry);
-    } 
-}
-
-
-
-
-
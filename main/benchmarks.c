@@ -0,0 +1,20 @@
+#include "../include/benchmarks.h"
+#include "../include/HALO.h"
+
+static const char *BENCH_TAG = "BENCH";
+
+void benchmarks_ejecutar(void) {
+#if CONFIG_HALO_BENCHMARKS
+    ESP_LOGI(BENCH_TAG, "⏱️ Ejecutando benchmarks de arranque...");
+    hx711_benchmark_irq(BENCHMARK_HX711_TRAMAS);
+    hx711_benchmark_conversion(BENCHMARK_CONVERSION_MUESTRAS);
+    filtros_benchmark(BENCHMARK_FILTROS_MUESTRAS);
+    autocero_simulacion();
+    sdcard_benchmark(BENCHMARK_SD_LINEAS);
+    sdcard_escritor_benchmark(BENCHMARK_SD_ESCRITOR_MUESTRAS);
+    sdcard_preasignacion_benchmark(BENCHMARK_SD_PREASIGNACION_MUESTRAS);
+    muestras_bin_benchmark(BENCHMARK_MUESTRAS_BIN);
+    compresion_benchmark(BENCHMARK_COMPRESION_MUESTRAS);
+    ESP_LOGI(BENCH_TAG, "✅ Benchmarks finalizados");
+#endif
+}
@@ -0,0 +1,74 @@
+#include "../include/cola_spsc.h"
+#include <string.h>
+
+bool cola_spsc_init(cola_spsc_t *q, void *buffer, size_t tam_elemento, uint32_t capacidad) {
+    if (q == NULL || buffer == NULL || tam_elemento == 0 ||
+        capacidad == 0 || (capacidad & (capacidad - 1)) != 0) {
+        return false;
+    }
+    q->buffer = (uint8_t *)buffer;
+    q->tam_elemento = tam_elemento;
+    q->capacidad = capacidad;
+    atomic_init(&q->cabeza, 0);
+    atomic_init(&q->cola, 0);
+    atomic_init(&q->desbordes, 0);
+    atomic_init(&q->max_ocupacion, 0);
+    return true;
+}
+
+bool cola_spsc_push(cola_spsc_t *q, const void *elemento) {
+    uint32_t cabeza = atomic_load_explicit(&q->cabeza, memory_order_relaxed);
+    uint32_t cola = atomic_load_explicit(&q->cola, memory_order_acquire);
+    uint32_t ocupacion = cabeza - cola;
+
+    if (ocupacion >= q->capacidad) {
+        atomic_fetch_add_explicit(&q->desbordes, 1, memory_order_relaxed);
+        return false;
+    }
+
+    memcpy(q->buffer + (size_t)(cabeza & (q->capacidad - 1)) * q->tam_elemento,
+           elemento, q->tam_elemento);
+    atomic_store_explicit(&q->cabeza, cabeza + 1, memory_order_release);
+
+    // Solo el productor actualiza la marca de agua
+    if (ocupacion + 1 > atomic_load_explicit(&q->max_ocupacion, memory_order_relaxed)) {
+        atomic_store_explicit(&q->max_ocupacion, ocupacion + 1, memory_order_relaxed);
+    }
+    return true;
+}
+
+bool cola_spsc_pop(cola_spsc_t *q, void *elemento) {
+    uint32_t cola = atomic_load_explicit(&q->cola, memory_order_relaxed);
+    uint32_t cabeza = atomic_load_explicit(&q->cabeza, memory_order_acquire);
+
+    if (cabeza == cola) {
+        return false;
+    }
+
+    memcpy(elemento, q->buffer + (size_t)(cola & (q->capacidad - 1)) * q->tam_elemento,
+           q->tam_elemento);
+    atomic_store_explicit(&q->cola, cola + 1, memory_order_release);
+    return true;
+}
+
+void cola_spsc_vaciar(cola_spsc_t *q) {
+    uint32_t cabeza = atomic_load_explicit(&q->cabeza, memory_order_acquire);
+    atomic_store_explicit(&q->cola, cabeza, memory_order_release);
+}
+
+uint32_t cola_spsc_ocupacion(const cola_spsc_t *q) {
+    uint32_t cabeza = atomic_load_explicit(&q->cabeza, memory_order_acquire);
+    uint32_t cola = atomic_load_explicit(&q->cola, memory_order_acquire);
+    return cabeza - cola;
+}
+
+void cola_spsc_get_stats(const cola_spsc_t *q, cola_spsc_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    stats->capacidad = q->capacidad;
+    stats->ocupacion = cola_spsc_ocupacion(q);
+    stats->max_ocupacion = atomic_load_explicit(&q->max_ocupacion, memory_order_relaxed);
+    stats->desbordes = atomic_load_explicit(&q->desbordes, memory_order_relaxed);
+    stats->escritos = atomic_load_explicit(&q->cabeza, memory_order_relaxed);
+}
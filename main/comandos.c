@@ -0,0 +1,191 @@
+#include "../include/comandos.h"
+#include "../include/HALO.h"
+#include <esp_timer.h>
+#include <freertos/queue.h>
+
+static const char *COMANDOS_TAG = "COMANDOS";
+
+typedef struct {
+    uint32_t id;
+    uint8_t tipo;                       // comando_tipo_t
+    char texto[COMANDOS_TEXTO_MAX];
+} comando_trabajo_t;
+
+static QueueHandle_t cola_comandos = NULL;
+static TaskHandle_t tarea_comandos = NULL;
+static uint32_t siguiente_id = 1;       // Solo lo incrementa el manejador MQTT
+static comandos_stats_t stats;
+
+// Comando en curso (solo lo toca la tarea ejecutora)
+static comando_trabajo_t trabajo_actual;
+static uint32_t t_ultimo_avance_ms = 0;
+
+static const char *nombres_tipo[] = { "menu", "ota", "rollback" };
+
+static const char *comandos_nombre_tipo(uint8_t tipo) {
+    return (tipo < sizeof(nombres_tipo) / sizeof(nombres_tipo[0])) ? nombres_tipo[tipo] : "?";
+}
+
+// El texto del comando no se copia al JSON: solo id, tipo y mensajes propios
+static int comandos_json(char *buffer, size_t tam, const comando_trabajo_t *trabajo,
+                         const char *estado, int avance, const char *detalle) {
+    return snprintf(buffer, tam, "{\"id\":%u,\"tipo\":\"%s\",\"estado\":\"%s\",\"avance\":%d,\"detalle\":\"%s\"}",
+                    (unsigned)trabajo->id, comandos_nombre_tipo(trabajo->tipo), estado, avance,
+                    detalle != NULL ? detalle : "");
+}
+
+// Desde la tarea ejecutora: publicación normal (puede bloquear en el socket)
+static void comandos_publicar(const comando_trabajo_t *trabajo, const char *estado, int avance, const char *detalle) {
+    if (!mqtt_is_connected()) {
+        return;
+    }
+    char json[160];
+    if (comandos_json(json, sizeof(json), trabajo, estado, avance, detalle) > 0) {
+        esp_mqtt_client_publish(mqtt_client, COMANDOS_TOPIC_ESTADO, json, 0, 1, 0);
+    }
+}
+
+static void comandos_ejecutar(const comando_trabajo_t *trabajo) {
+    switch (trabajo->tipo) {
+        case COMANDO_MENU:
+            menu_mqtt(trabajo->texto);
+            comandos_publicar(trabajo, "completado", 100, "");
+            break;
+
+        case COMANDO_OTA: {
+            // Si la actualización termina bien, ota_process_command reinicia el equipo
+            esp_err_t res = ota_process_command(trabajo->texto);
+            comandos_publicar(trabajo, "error", ota_get_progress(), esp_err_to_name(res));
+            break;
+        }
+
+        case COMANDO_ROLLBACK: {
+            esp_mqtt_client_publish(mqtt_client, "esp32/halo/status",
+                                    "🔄 Iniciando rollback a firmware anterior...", 0, 1, 0);
+            // Si el rollback se configura, ota_rollback_to_previous reinicia el equipo
+            esp_err_t res = ota_rollback_to_previous();
+            ESP_LOGE(COMANDOS_TAG, "❌ Error en rollback: %s", esp_err_to_name(res));
+            char error_msg[128];
+            snprintf(error_msg, sizeof(error_msg), "❌ Error rollback: %s", esp_err_to_name(res));
+            esp_mqtt_client_publish(mqtt_client, "esp32/halo/status", error_msg, 0, 1, 0);
+            comandos_publicar(trabajo, "error", 0, esp_err_to_name(res));
+            break;
+        }
+
+        default:
+            comandos_publicar(trabajo, "error", 0, "tipo desconocido");
+            break;
+    }
+}
+
+static void task_comandos(void *pvParameters) {
+    while (1) {
+        if (xQueueReceive(cola_comandos, &trabajo_actual, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        ESP_LOGI(COMANDOS_TAG, "▶️ Comando #%u (%s): %s", (unsigned)trabajo_actual.id,
+                 comandos_nombre_tipo(trabajo_actual.tipo), trabajo_actual.texto);
+        t_ultimo_avance_ms = 0;
+        comandos_publicar(&trabajo_actual, "en_curso", 0, "");
+
+        int64_t t_inicio = esp_timer_get_time();
+        comandos_ejecutar(&trabajo_actual);
+        uint32_t duracion_us = (uint32_t)(esp_timer_get_time() - t_inicio);
+
+        stats.completados++;
+        stats.ejecucion_us = duracion_us;
+        if (duracion_us > stats.ejecucion_max_us) {
+            stats.ejecucion_max_us = duracion_us;
+        }
+        // Lo que antes habría bloqueado al cliente MQTT frente a lo que tarda ahora el manejador
+        ESP_LOGI(COMANDOS_TAG, "✅ Comando #%u terminado en %u ms (manejador MQTT: ult %u us, max %u us)",
+                 (unsigned)trabajo_actual.id, (unsigned)(duracion_us / 1000),
+                 (unsigned)stats.manejador_us, (unsigned)stats.manejador_max_us);
+    }
+}
+
+void create_task_comandos(void) {
+    if (cola_comandos != NULL) {
+        return;
+    }
+    cola_comandos = xQueueCreate(COMANDOS_COLA_LONGITUD, sizeof(comando_trabajo_t));
+    if (cola_comandos == NULL) {
+        ESP_LOGE(COMANDOS_TAG, "❌ No se pudo crear la cola de comandos");
+        return;
+    }
+    BaseType_t result = xTaskCreatePinnedToCore(
+        task_comandos,                  // Función de la tarea
+        "Comandos_MQTT",                // Nombre descriptivo
+        TAREA_COMANDOS_STACK_SIZE,      // Stack: 6144 bytes (OTA con TLS)
+        NULL,                           // Parámetros
+        TAREA_COMANDOS_PRIORIDAD,       // Prioridad: 3 (por debajo de la red)
+        &tarea_comandos,                // Handle (para reconocer el contexto del avance)
+        NUCLEO_APLICACION               // NÚCLEO 1: aplicación y red
+    );
+    if (result != pdPASS) {
+        ESP_LOGE(COMANDOS_TAG, "❌ No se pudo crear la tarea de comandos");
+    }
+}
+
+esp_err_t comandos_encolar(comando_tipo_t tipo, const char *texto, uint32_t *id) {
+    comando_trabajo_t trabajo = { .id = 0, .tipo = (uint8_t)tipo };
+    esp_err_t err = ESP_OK;
+    char json[160];
+
+    if (texto == NULL || cola_comandos == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (strlen(texto) >= sizeof(trabajo.texto)) {
+        err = ESP_ERR_INVALID_SIZE;
+    } else {
+        trabajo.id = siguiente_id++;
+        strlcpy(trabajo.texto, texto, sizeof(trabajo.texto));
+        // Sin espera: el manejador MQTT nunca se bloquea por la cola
+        if (xQueueSend(cola_comandos, &trabajo, 0) != pdTRUE) {
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (err == ESP_OK) {
+        stats.encolados++;
+        comandos_json(json, sizeof(json), &trabajo, "encolado", 0, "");
+    } else {
+        stats.rechazados++;
+        comandos_json(json, sizeof(json), &trabajo, "rechazado", 0,
+                      err == ESP_ERR_NO_MEM ? "cola llena" : "comando demasiado largo");
+        ESP_LOGW(COMANDOS_TAG, "⚠️ Comando rechazado: %s", esp_err_to_name(err));
+    }
+    // Se deja en la bandeja de salida del cliente: no escribe en el socket desde el manejador
+    if (mqtt_client != NULL) {
+        esp_mqtt_client_enqueue(mqtt_client, COMANDOS_TOPIC_ESTADO, json, 0, 1, 0, true);
+    }
+    if (id != NULL) {
+        *id = trabajo.id;
+    }
+    return err;
+}
+
+void comandos_publicar_avance(int porcentaje, const char *detalle) {
+    if (tarea_comandos == NULL || xTaskGetCurrentTaskHandle() != tarea_comandos) {
+        return;
+    }
+    uint32_t ahora_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    if (porcentaje < 100 && ahora_ms - t_ultimo_avance_ms < COMANDOS_AVANCE_MS) {
+        return;
+    }
+    t_ultimo_avance_ms = ahora_ms;
+    comandos_publicar(&trabajo_actual, "en_curso", porcentaje, detalle);
+}
+
+void comandos_registrar_manejador(uint32_t us) {
+    stats.manejador_us = us;
+    if (us > stats.manejador_max_us) {
+        stats.manejador_max_us = us;
+    }
+}
+
+void comandos_get_stats(comandos_stats_t *out) {
+    if (out != NULL) {
+        *out = stats;
+    }
+}
@@ -0,0 +1,357 @@
+#include "../include/compresion.h"
+#include "../include/HALO.h"
+#include <esp_rom_crc.h>
+#include <esp_cpu.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// El formato en disco no debe depender del relleno del compilador
+_Static_assert(sizeof(compresion_bloque_t) == 24, "cabecera de bloque con relleno inesperado");
+
+static inline uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t dezigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline size_t varint_escribir(uint32_t v, uint8_t *salida) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        salida[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    salida[n++] = (uint8_t)v;
+    return n;
+}
+
+// 0 si el varint no termina dentro de 'len' (o supera 5 bytes)
+static inline size_t varint_leer(const uint8_t *entrada, size_t len, uint32_t *v) {
+    uint32_t valor = 0;
+    for (size_t n = 0; n < len && n < 5; n++) {
+        valor |= (uint32_t)(entrada[n] & 0x7F) << (7 * n);
+        if ((entrada[n] & 0x80) == 0) {
+            *v = valor;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+// Las restas se hacen en módulo 2^32: cualquier salto (incluso un reloj que
+// retrocede) cabe en 5 bytes y se recupera exacto al decodificar
+static inline int32_t diferencia(int32_t actual, int32_t anterior) {
+    return (int32_t)((uint32_t)actual - (uint32_t)anterior);
+}
+
+size_t compresion_codificar(compresion_estado_t *previo, const muestra_bin_t *reg, uint8_t *salida) {
+    size_t n = 0;
+    int32_t delta_epoch = (int32_t)(reg->epoch - previo->epoch);
+    n += varint_escribir(zigzag(diferencia(delta_epoch, previo->delta_epoch)), salida + n);
+    n += varint_escribir(zigzag(diferencia(reg->peso_mg, previo->peso_mg)), salida + n);
+    n += varint_escribir(zigzag(diferencia(reg->raw, previo->raw)), salida + n);
+    n += varint_escribir(zigzag((int32_t)reg->bateria_mv - previo->bateria_mv), salida + n);
+    salida[n++] = reg->flags;
+#if HX711_NUM_CANALES > 1
+    for (int c = 0; c < HX711_NUM_CANALES; c++) {
+        n += varint_escribir(zigzag(diferencia(reg->raw_canal[c], previo->raw_canal[c])), salida + n);
+        previo->raw_canal[c] = reg->raw_canal[c];
+    }
+#endif
+    previo->epoch = reg->epoch;
+    previo->delta_epoch = delta_epoch;
+    previo->peso_mg = reg->peso_mg;
+    previo->raw = reg->raw;
+    previo->bateria_mv = reg->bateria_mv;
+    return n;
+}
+
+size_t compresion_decodificar(compresion_estado_t *previo, const uint8_t *entrada, size_t len, muestra_bin_t *reg) {
+    uint32_t v[4];
+    size_t n = 0;
+    for (int i = 0; i < 4; i++) {
+        size_t usado = varint_leer(entrada + n, len - n, &v[i]);
+        if (usado == 0) {
+            return 0;
+        }
+        n += usado;
+    }
+    if (n >= len) {
+        return 0;
+    }
+    uint8_t flags = entrada[n++];
+
+    memset(reg, 0, sizeof(*reg));
+#if HX711_NUM_CANALES > 1
+    for (int c = 0; c < HX711_NUM_CANALES; c++) {
+        uint32_t d;
+        size_t usado = varint_leer(entrada + n, len - n, &d);
+        if (usado == 0) {
+            return 0;
+        }
+        n += usado;
+        previo->raw_canal[c] = (int32_t)((uint32_t)previo->raw_canal[c] + (uint32_t)dezigzag(d));
+        reg->raw_canal[c] = previo->raw_canal[c];
+    }
+#endif
+    previo->delta_epoch = (int32_t)((uint32_t)previo->delta_epoch + (uint32_t)dezigzag(v[0]));
+    previo->epoch += (uint32_t)previo->delta_epoch;
+    previo->peso_mg = (int32_t)((uint32_t)previo->peso_mg + (uint32_t)dezigzag(v[1]));
+    previo->raw = (int32_t)((uint32_t)previo->raw + (uint32_t)dezigzag(v[2]));
+    previo->bateria_mv += dezigzag(v[3]);
+
+    reg->epoch = previo->epoch;
+    reg->peso_mg = previo->peso_mg;
+    reg->raw = previo->raw;
+    reg->bateria_mv = (uint16_t)previo->bateria_mv;
+    reg->flags = flags;
+    muestras_bin_sellar(reg);
+    return n;
+}
+
+static uint32_t compresion_crc_bloque(const compresion_bloque_t *cab, const uint8_t *datos) {
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)cab, offsetof(compresion_bloque_t, crc));
+    return esp_rom_crc32_le(crc, datos, cab->bytes);
+}
+
+void compresion_escritor_iniciar(compresion_escritor_t *e, FILE *f) {
+    memset(e, 0, offsetof(compresion_escritor_t, bloque));
+    e->f = f;
+}
+
+static esp_err_t compresion_escritor_vaciar(compresion_escritor_t *e) {
+    uint8_t *datos = e->bloque + sizeof(compresion_bloque_t);
+    memcpy(e->cab.magia, COMPRESION_MAGIA, sizeof(e->cab.magia));
+    e->cab.version = COMPRESION_VERSION;
+    e->cab.num_canales = HX711_NUM_CANALES;
+    e->cab.bytes = (uint16_t)e->usado;
+    e->cab.crc = compresion_crc_bloque(&e->cab, datos);
+    memcpy(e->bloque, &e->cab, sizeof(e->cab));
+    // Relleno a sector completo: el bloque siguiente queda alineado a 4 KB
+    memset(datos + e->usado, 0, COMPRESION_DATOS_BYTES - e->usado);
+    if (fwrite(e->bloque, COMPRESION_BLOQUE_BYTES, 1, e->f) != 1) {
+        return ESP_FAIL;
+    }
+    e->bloques++;
+    e->usado = 0;
+    memset(&e->cab, 0, sizeof(e->cab));
+    memset(&e->previo, 0, sizeof(e->previo));
+    return ESP_OK;
+}
+
+esp_err_t compresion_escritor_agregar(compresion_escritor_t *e, const muestra_bin_t *reg) {
+    uint8_t codigo[COMPRESION_MUESTRA_MAX];
+    compresion_estado_t previo = e->previo;
+    size_t n = compresion_codificar(&previo, reg, codigo);
+    if (e->usado + n > COMPRESION_DATOS_BYTES) {
+        if (compresion_escritor_vaciar(e) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        // Bloque nuevo: la primera muestra se codifica contra cero
+        previo = e->previo;
+        n = compresion_codificar(&previo, reg, codigo);
+    }
+    memcpy(e->bloque + sizeof(compresion_bloque_t) + e->usado, codigo, n);
+    e->usado += n;
+    e->previo = previo;
+    if (e->cab.muestras == 0) {
+        e->cab.primera = reg->epoch;
+    }
+    e->cab.ultima = reg->epoch;
+    e->cab.muestras++;
+    e->muestras++;
+    return ESP_OK;
+}
+
+esp_err_t compresion_escritor_terminar(compresion_escritor_t *e) {
+    if (e->cab.muestras == 0) {
+        return ESP_OK;
+    }
+    return compresion_escritor_vaciar(e);
+}
+
+void compresion_lector_iniciar(compresion_lector_t *l, FILE *f) {
+    memset(l, 0, offsetof(compresion_lector_t, bloque));
+    l->f = f;
+}
+
+// Carga el siguiente bloque que llega a 'desde'; ESP_ERR_NOT_FOUND al final
+static esp_err_t compresion_lector_cargar(compresion_lector_t *l, uint32_t desde) {
+    compresion_bloque_t cab;
+    while (fread(&cab, sizeof(cab), 1, l->f) == 1) {
+        bool valida = memcmp(cab.magia, COMPRESION_MAGIA, sizeof(cab.magia)) == 0 &&
+                      cab.version == COMPRESION_VERSION &&
+                      cab.num_canales == HX711_NUM_CANALES &&
+                      cab.bytes <= COMPRESION_DATOS_BYTES;
+        if (valida && cab.ultima < desde) {
+            // Fuera de rango: se salta sin leer los datos
+            l->bloques_saltados++;
+            if (fseek(l->f, (long)COMPRESION_DATOS_BYTES, SEEK_CUR) != 0) {
+                break;
+            }
+            continue;
+        }
+        uint8_t *datos = l->bloque + sizeof(compresion_bloque_t);
+        if (fread(datos, COMPRESION_DATOS_BYTES, 1, l->f) != 1) {
+            break;
+        }
+        if (!valida || cab.crc != compresion_crc_bloque(&cab, datos)) {
+            l->bloques_invalidos++;
+            continue;
+        }
+        memcpy(l->bloque, &cab, sizeof(cab));
+        memset(&l->previo, 0, sizeof(l->previo));
+        l->pos = 0;
+        l->bytes = cab.bytes;
+        l->restantes = cab.muestras;
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t compresion_lector_siguiente(compresion_lector_t *l, uint32_t desde, muestra_bin_t *reg) {
+    for (;;) {
+        if (l->restantes == 0 && compresion_lector_cargar(l, desde) != ESP_OK) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        const uint8_t *datos = l->bloque + sizeof(compresion_bloque_t);
+        size_t n = compresion_decodificar(&l->previo, datos + l->pos, l->bytes - l->pos, reg);
+        if (n == 0) {
+            // Bloque truncado pese al CRC: se descarta el resto
+            l->bloques_invalidos++;
+            l->restantes = 0;
+            continue;
+        }
+        l->pos += n;
+        l->restantes--;
+        if (reg->epoch >= desde) {
+            return ESP_OK;
+        }
+    }
+}
+
+#if CONFIG_HALO_BENCHMARKS
+static const char *COMPRESION_TAG = "COMPRESION";
+
+// Tamaño codificado de una serie en bloques, como lo haría el escritor
+static void compresion_medir(const muestra_bin_t *regs, int n, size_t *datos, uint32_t *bloques, uint32_t *ciclos) {
+    static uint8_t buffer[COMPRESION_DATOS_BYTES];
+    compresion_estado_t previo = {0};
+    size_t usado = 0;
+    *datos = 0;
+    *bloques = (n > 0) ? 1 : 0;
+    uint32_t t0 = esp_cpu_get_cycle_count();
+    for (int i = 0; i < n; i++) {
+        compresion_estado_t prueba = previo;
+        uint8_t codigo[COMPRESION_MUESTRA_MAX];
+        size_t len = compresion_codificar(&prueba, &regs[i], codigo);
+        if (usado + len > sizeof(buffer)) {
+            memset(&prueba, 0, sizeof(prueba));
+            len = compresion_codificar(&prueba, &regs[i], codigo);
+            usado = 0;
+            (*bloques)++;
+        }
+        memcpy(buffer + usado, codigo, len);
+        usado += len;
+        *datos += len;
+        previo = prueba;
+    }
+    *ciclos = esp_cpu_get_cycle_count() - t0;
+}
+
+/**
+ * @brief Bytes por muestra y ciclos de codificar/decodificar
+ *
+ * Usa una serie sintética (deriva lenta, ruido, huecos de tiempo) y, si hay SD,
+ * las últimas muestras reales de pesos.bin.
+ */
+void compresion_benchmark(int muestras) {
+    if (muestras <= 0) {
+        return;
+    }
+    muestra_bin_t *regs = calloc(muestras, sizeof(muestra_bin_t));
+    uint8_t *codigo = malloc((size_t)muestras * COMPRESION_MUESTRA_MAX);
+    if (regs == NULL || codigo == NULL) {
+        free(regs);
+        free(codigo);
+        ESP_LOGW(COMPRESION_TAG, "⏱️ Benchmark de compresión omitido (sin memoria)");
+        return;
+    }
+
+    uint32_t semilla = 0xACE1u;
+    uint32_t epoch = 1767225600u;       // 2026-01-01 00:00:00
+    int32_t peso_mg = 12345678;
+    for (int i = 0; i < muestras; i++) {
+        semilla ^= semilla << 13;
+        semilla ^= semilla >> 17;
+        semilla ^= semilla << 5;
+        epoch += ((i % 211) == 0) ? 3600 : 60;      // Algún hueco (equipo apagado)
+        peso_mg += (int32_t)(semilla % 2001) - 1000;  // ±1 g por muestra
+        regs[i] = (muestra_bin_t){
+            .epoch = epoch,
+            .raw = 8000000 + peso_mg / 50,
+            .peso_mg = peso_mg,
+            .bateria_mv = (uint16_t)(4100 - i / 100),
+            .flags = (semilla & 4) ? MUESTRA_BIN_ESTABLE : 0,
+        };
+#if HX711_NUM_CANALES > 1
+        for (int c = 0; c < HX711_NUM_CANALES; c++) {
+            regs[i].raw_canal[c] = regs[i].raw / HX711_NUM_CANALES + (int32_t)(semilla % 64);
+        }
+#endif
+        muestras_bin_sellar(&regs[i]);
+    }
+
+    size_t datos;
+    uint32_t bloques;
+    uint32_t ciclos_cod;
+    compresion_medir(regs, muestras, &datos, &bloques, &ciclos_cod);
+
+    // Decodificación de un flujo continuo (sin cortes de bloque)
+    compresion_estado_t previo = {0};
+    size_t total = 0;
+    for (int i = 0; i < muestras; i++) {
+        total += compresion_codificar(&previo, &regs[i], codigo + total);
+    }
+    memset(&previo, 0, sizeof(previo));
+    int errores = 0;
+    size_t pos = 0;
+    uint32_t t0 = esp_cpu_get_cycle_count();
+    for (int i = 0; i < muestras; i++) {
+        muestra_bin_t reg;
+        size_t n = compresion_decodificar(&previo, codigo + pos, total - pos, &reg);
+        if (n == 0 || memcmp(&reg, &regs[i], sizeof(reg)) != 0) {
+            errores++;
+            break;
+        }
+        pos += n;
+    }
+    uint32_t ciclos_dec = esp_cpu_get_cycle_count() - t0;
+
+    ESP_LOGI(COMPRESION_TAG, "⏱️ Serie sintética: %d muestras, %u.%02u bytes/muestra (binario %u), %u bloques de 4 KB",
+             muestras, (unsigned)(datos / muestras), (unsigned)(datos * 100 / muestras % 100),
+             (unsigned)sizeof(muestra_bin_t), (unsigned)bloques);
+    ESP_LOGI(COMPRESION_TAG, "⏱️ Codificar %u ciclos/muestra, decodificar %u ciclos/muestra%s",
+             (unsigned)(ciclos_cod / muestras), (unsigned)(ciclos_dec / muestras),
+             errores ? " (ERROR: ida y vuelta distinta)" : "");
+
+    // Datos de campo: las últimas muestras del registro activo
+    if (sdcard_info.is_mounted && xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(1000)) == pdTRUE) {
+        uint32_t en_sd = muestras_bin_contar();
+        uint32_t desde = (en_sd > (uint32_t)muestras) ? en_sd - muestras : 0;
+        size_t leidos = 0;
+        if (en_sd > 0 && muestras_bin_leer(desde, regs, muestras, &leidos) == ESP_OK && leidos > 0) {
+            compresion_medir(regs, (int)leidos, &datos, &bloques, &ciclos_cod);
+            ESP_LOGI(COMPRESION_TAG, "⏱️ pesos.bin: %u muestras, %u.%02u bytes/muestra (binario %u)",
+                     (unsigned)leidos, (unsigned)(datos / leidos), (unsigned)(datos * 100 / leidos % 100),
+                     (unsigned)sizeof(muestra_bin_t));
+        }
+        xSemaphoreGive(sistema.mutex_sd);
+    }
+
+    free(regs);
+    free(codigo);
+}
+#endif // CONFIG_HALO_BENCHMARKS
@@ -0,0 +1,231 @@
+#include "../include/espacio.h"
+#include "../include/HALO.h"
+#include "esp_timer.h"
+#include "ff.h"
+#include "diskio_impl.h"
+#include "diskio_sdmmc.h"
+
+static const char *ESPACIO_TAG = "ESPACIO";
+
+// Lo que se guarda en la NVS (NVS_KEY_ESPACIO): identidad de la tarjeta y cifras en clústeres
+typedef struct {
+    uint32_t serie;                     // CID: número de serie
+    uint32_t fabricante;                // CID: fabricante
+    uint32_t sectores;                  // CSD: capacidad en sectores
+    uint32_t cluster_bytes;
+    uint32_t clusters;                  // Clústeres de datos del volumen
+    uint32_t libres;
+    uint32_t recuento_epoch;
+} espacio_guardado_t;
+
+static espacio_guardado_t actual;
+static bool valido = false;
+static bool sucio = false;              // Cambió desde el último guardado
+static uint32_t t_montaje_ms = 0;
+static uint32_t t_guardado_ms = 0;
+static espacio_stats_t stats;
+static portMUX_TYPE espacio_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t espacio_ahora_ms(void) {
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static uint32_t espacio_clusters(uint64_t bytes, uint32_t cluster_bytes) {
+    return (uint32_t)((bytes + cluster_bytes - 1) / cluster_bytes);
+}
+
+void espacio_montar(void) {
+    const sdmmc_card_t *card = sdcard_info.card;
+    if (card == NULL) {
+        return;
+    }
+    espacio_guardado_t identidad = {
+        .serie = (uint32_t)card->cid.serial,
+        .fabricante = (uint32_t)card->cid.mfg_id,
+        .sectores = (uint32_t)card->csd.capacity,
+    };
+    t_montaje_ms = espacio_ahora_ms();
+
+    // Remontaje de la misma tarjeta: las cifras en RAM son más nuevas que las guardadas
+    if (valido && actual.serie == identidad.serie && actual.fabricante == identidad.fabricante &&
+        actual.sectores == identidad.sectores) {
+        return;
+    }
+
+    espacio_guardado_t guardado;
+    size_t tam = sizeof(guardado);
+    bool restaurado = false;
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK) {
+        restaurado = nvs_get_blob(nvs_handle, NVS_KEY_ESPACIO, &guardado, &tam) == ESP_OK &&
+                     tam == sizeof(guardado) && guardado.serie == identidad.serie &&
+                     guardado.fabricante == identidad.fabricante && guardado.sectores == identidad.sectores &&
+                     guardado.cluster_bytes > 0 && guardado.libres <= guardado.clusters;
+        nvs_close(nvs_handle);
+    }
+
+    portENTER_CRITICAL(&espacio_lock);
+    actual = restaurado ? guardado : identidad;
+    valido = restaurado;
+    sucio = false;
+    if (restaurado) {
+        stats.restauradas++;
+    }
+    portEXIT_CRITICAL(&espacio_lock);
+    if (!restaurado) {
+        ESP_LOGI(ESPACIO_TAG, "Sin cifras guardadas para esta tarjeta: el espacio libre se cuenta en segundo plano");
+    }
+}
+
+uint64_t espacio_tam(const char *ruta) {
+    struct stat st;
+    return (stat(ruta, &st) == 0 && st.st_size > 0) ? (uint64_t)st.st_size : 0;
+}
+
+void espacio_cambio(uint64_t antes, uint64_t despues) {
+    portENTER_CRITICAL(&espacio_lock);
+    if (valido) {
+        int64_t libres = (int64_t)actual.libres + espacio_clusters(antes, actual.cluster_bytes) -
+                         espacio_clusters(despues, actual.cluster_bytes);
+        libres = (libres < 0) ? 0 : (libres > actual.clusters) ? actual.clusters : libres;
+        if ((uint32_t)libres != actual.libres) {
+            actual.libres = (uint32_t)libres;
+            sucio = true;
+        }
+        stats.cambios++;
+    }
+    portEXIT_CRITICAL(&espacio_lock);
+}
+
+void espacio_archivo(const char *ruta, uint64_t antes) {
+    espacio_cambio(antes, espacio_tam(ruta));
+}
+
+int espacio_remove(const char *ruta) {
+    uint64_t tam = espacio_tam(ruta);
+    int res = remove(ruta);
+    if (res == 0) {
+        espacio_cambio(tam, 0);
+    }
+    return res;
+}
+
+esp_err_t espacio_guardar(void) {
+    portENTER_CRITICAL(&espacio_lock);
+    espacio_guardado_t copia = actual;
+    bool guardar = valido && sucio;
+    portEXIT_CRITICAL(&espacio_lock);
+    if (!guardar) {
+        return ESP_OK;
+    }
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs_handle, NVS_KEY_ESPACIO, &copia, sizeof(copia));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    if (err == ESP_OK) {
+        portENTER_CRITICAL(&espacio_lock);
+        // Lo que cambió mientras se escribía queda para el próximo guardado
+        sucio = memcmp(&copia, &actual, sizeof(copia)) != 0;
+        stats.guardados++;
+        portEXIT_CRITICAL(&espacio_lock);
+        t_guardado_ms = espacio_ahora_ms();
+    }
+    return err;
+}
+
+/**
+ * @brief Cuenta los clústeres libres recorriendo la FAT (segundos en una tarjeta grande)
+ *
+ * Con sistema.mutex_sd tomado: ningún espacio_cambio() de la capa de registro
+ * queda a medias entre la caché y el recuento.
+ */
+static void espacio_recontar(void) {
+    BYTE pdrv = ff_diskio_get_pdrv_card(sdcard_info.card);
+    if (pdrv == 0xFF) {
+        return;
+    }
+    char unidad[3] = { (char)('0' + pdrv), ':', 0 };
+    FATFS *fs = NULL;
+    DWORD libres = 0;
+    int64_t t_inicio = esp_timer_get_time();
+    FRESULT fr = f_getfree(unidad, &libres, &fs);
+    uint32_t duracion_ms = (uint32_t)((esp_timer_get_time() - t_inicio) / 1000);
+    if (fr != FR_OK) {
+        ESP_LOGW(ESPACIO_TAG, "No se pudo contar el espacio libre (FRESULT %d)", (int)fr);
+        // Sin reintentar en cada vuelta de la tarea escritora
+        t_montaje_ms = espacio_ahora_ms();
+        return;
+    }
+#if FF_MAX_SS != FF_MIN_SS
+    uint32_t sector_bytes = fs->ssize;
+#else
+    uint32_t sector_bytes = FF_MAX_SS;
+#endif
+    time_t ahora = time(NULL);
+
+    portENTER_CRITICAL(&espacio_lock);
+    stats.desvio_clusters = valido ? (int32_t)(actual.libres - (uint32_t)libres) : 0;
+    actual.cluster_bytes = (uint32_t)fs->csize * sector_bytes;
+    actual.clusters = (uint32_t)fs->n_fatent - 2;
+    actual.libres = (uint32_t)libres;
+    actual.recuento_epoch = (ahora >= (time_t)MUESTRAS_BIN_EPOCH_MIN) ? (uint32_t)ahora : 0;
+    valido = true;
+    sucio = true;
+    stats.recuentos++;
+    stats.recuento_ms = duracion_ms;
+    if (duracion_ms > stats.recuento_max_ms) {
+        stats.recuento_max_ms = duracion_ms;
+    }
+    portEXIT_CRITICAL(&espacio_lock);
+
+    ESP_LOGI(ESPACIO_TAG, "Espacio libre recontado en %u ms: %.2f de %.2f MB (desvío de la caché: %d clústeres)",
+             (unsigned)duracion_ms, (double)libres * actual.cluster_bytes / (1024.0 * 1024.0),
+             (double)actual.clusters * actual.cluster_bytes / (1024.0 * 1024.0), (int)stats.desvio_clusters);
+    espacio_guardar();
+}
+
+void espacio_mantener(void) {
+    if (!sdcard_info.is_mounted || sdcard_info.card == NULL) {
+        return;
+    }
+    uint32_t ahora_ms = espacio_ahora_ms();
+    time_t ahora = time(NULL);
+    bool vencido = CONFIG_HALO_SD_RECUENTO_HORAS > 0 && ahora >= (time_t)MUESTRAS_BIN_EPOCH_MIN &&
+                   (actual.recuento_epoch == 0 ||
+                    (uint32_t)ahora - actual.recuento_epoch >= (uint32_t)CONFIG_HALO_SD_RECUENTO_HORAS * 3600);
+    if ((!valido || vencido) && ahora_ms - t_montaje_ms >= ESPACIO_RECUENTO_DEMORA_MS) {
+        espacio_recontar();
+        return;
+    }
+    if (sucio && ahora_ms - t_guardado_ms >= ESPACIO_GUARDAR_MS) {
+        espacio_guardar();
+    }
+}
+
+void espacio_get(espacio_t *out) {
+    if (out == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&espacio_lock);
+    out->valido = valido;
+    out->cluster_bytes = actual.cluster_bytes;
+    out->total_bytes = (uint64_t)actual.clusters * actual.cluster_bytes;
+    out->libres_bytes = (uint64_t)actual.libres * actual.cluster_bytes;
+    out->recuento_epoch = actual.recuento_epoch;
+    portEXIT_CRITICAL(&espacio_lock);
+}
+
+void espacio_get_stats(espacio_stats_t *out) {
+    if (out == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&espacio_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&espacio_lock);
+}
@@ -0,0 +1,395 @@
+#include "../include/filtros.h"
+#include "../include/HALO.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <esp_cpu.h>
+
+static const char *FILTROS_TAG = "FILTROS";
+
+// Estado de cada etapa; solo lo toca el consumidor de registro
+typedef struct {
+    bool iniciado;
+    union {
+        struct {
+            int32_t ventana[FILTROS_MEDIANA_MAX];
+            uint8_t pos;
+            uint8_t llenos;
+        } mediana;
+        struct {
+            int32_t ventana[FILTROS_MEDIA_MAX];
+            int64_t suma;
+            uint8_t pos;
+            uint8_t llenos;
+            uint8_t cuenta_decimacion;
+        } media;
+        struct {
+            int64_t y_q16;
+        } iir;
+        struct {
+            float x;
+            float p;
+        } kalman;
+    };
+} filtro_estado_t;
+
+static filtros_config_t config_activa;
+static filtro_estado_t estados[FILTROS_MAX_ETAPAS];
+static filtros_stats_t stats;
+
+// Configuración nueva pendiente de aplicar por el consumidor
+static filtros_config_t config_pendiente;
+static atomic_bool hay_config_pendiente = false;
+static portMUX_TYPE filtros_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+// ------------------------------ Etapas ------------------------------
+
+static int32_t filtro_mediana(const filtro_etapa_cfg_t *cfg, filtro_estado_t *st, int32_t x) {
+    uint8_t n = cfg->mediana.ventana;
+    st->mediana.ventana[st->mediana.pos] = x;
+    st->mediana.pos = (st->mediana.pos + 1) % n;
+    if (st->mediana.llenos < n) {
+        st->mediana.llenos++;
+    }
+
+    // Inserción sobre una copia: con n <= 15 es más barato que mantener un orden
+    int32_t orden[FILTROS_MEDIANA_MAX];
+    uint8_t m = st->mediana.llenos;
+    for (uint8_t i = 0; i < m; i++) {
+        int32_t v = st->mediana.ventana[i];
+        int8_t j = (int8_t)i - 1;
+        while (j >= 0 && orden[j] > v) {
+            orden[j + 1] = orden[j];
+            j--;
+        }
+        orden[j + 1] = v;
+    }
+    return orden[m / 2];
+}
+
+static bool filtro_media(const filtro_etapa_cfg_t *cfg, filtro_estado_t *st, int32_t x, int32_t *y) {
+    uint8_t n = cfg->media.ventana;
+    if (st->media.llenos == n) {
+        st->media.suma -= st->media.ventana[st->media.pos];
+    } else {
+        st->media.llenos++;
+    }
+    st->media.ventana[st->media.pos] = x;
+    st->media.suma += x;
+    st->media.pos = (st->media.pos + 1) % n;
+
+    if (++st->media.cuenta_decimacion < cfg->media.decimacion) {
+        return false;
+    }
+    st->media.cuenta_decimacion = 0;
+    int64_t suma = st->media.suma;
+    int64_t mitad = st->media.llenos / 2;
+    *y = (int32_t)((suma >= 0 ? suma + mitad : suma - mitad) / st->media.llenos);
+    return true;
+}
+
+static int32_t filtro_iir(const filtro_etapa_cfg_t *cfg, filtro_estado_t *st, int32_t x) {
+    int64_t x_q16 = (int64_t)x << 16;
+    if (!st->iniciado) {
+        st->iir.y_q16 = x_q16;
+    } else {
+        st->iir.y_q16 += ((x_q16 - st->iir.y_q16) * (int64_t)cfg->iir.alfa_q16) >> 16;
+    }
+    return (int32_t)((st->iir.y_q16 + 0x8000) >> 16);
+}
+
+static int32_t filtro_kalman(const filtro_etapa_cfg_t *cfg, filtro_estado_t *st, int32_t x) {
+    float z = (float)x;
+    if (!st->iniciado) {
+        st->kalman.x = z;
+        st->kalman.p = cfg->kalman.r;
+    } else {
+        float p = st->kalman.p + cfg->kalman.q;
+        float k = p / (p + cfg->kalman.r);
+        st->kalman.x += k * (z - st->kalman.x);
+        st->kalman.p = (1.0f - k) * p;
+    }
+    return (int32_t)lroundf(st->kalman.x);
+}
+
+// ------------------------------ Cadena ------------------------------
+
+static void filtros_aplicar_pendiente(void) {
+    portENTER_CRITICAL(&filtros_spinlock);
+    config_activa = config_pendiente;
+    atomic_store(&hay_config_pendiente, false);
+    portEXIT_CRITICAL(&filtros_spinlock);
+    memset(estados, 0, sizeof(estados));
+}
+
+bool filtros_procesar(int32_t entrada, int32_t *salida) {
+    if (atomic_load_explicit(&hay_config_pendiente, memory_order_acquire)) {
+        filtros_aplicar_pendiente();
+    }
+    stats.entradas++;
+
+    int32_t v = entrada;
+    for (uint8_t i = 0; i < config_activa.num_etapas; i++) {
+        const filtro_etapa_cfg_t *cfg = &config_activa.etapas[i];
+        filtro_estado_t *st = &estados[i];
+        switch (cfg->tipo) {
+            case FILTRO_MEDIANA:
+                v = filtro_mediana(cfg, st, v);
+                break;
+            case FILTRO_MEDIA:
+                if (!filtro_media(cfg, st, v, &v)) {
+                    return false;
+                }
+                break;
+            case FILTRO_IIR:
+                v = filtro_iir(cfg, st, v);
+                break;
+            case FILTRO_KALMAN:
+                v = filtro_kalman(cfg, st, v);
+                break;
+        }
+        st->iniciado = true;
+    }
+
+    stats.salidas++;
+    *salida = v;
+    return true;
+}
+
+void filtros_reiniciar(void) {
+    memset(estados, 0, sizeof(estados));
+}
+
+// ------------------------- Texto de configuración -------------------------
+
+static esp_err_t filtros_parsear_etapa(char *token, filtro_etapa_cfg_t *etapa) {
+    char *campos[3] = { NULL, NULL, NULL };
+    int n = 0;
+    char *guardado;
+    for (char *c = strtok_r(token, ":", &guardado); c != NULL && n < 3; c = strtok_r(NULL, ":", &guardado)) {
+        campos[n++] = c;
+    }
+    if (n == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (strcmp(campos[0], "mediana") == 0) {
+        int ventana = (n > 1) ? atoi(campos[1]) : 5;
+        if (ventana < 3 || ventana > FILTROS_MEDIANA_MAX || (ventana % 2) == 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        etapa->tipo = FILTRO_MEDIANA;
+        etapa->mediana.ventana = (uint8_t)ventana;
+    } else if (strcmp(campos[0], "media") == 0) {
+        int ventana = (n > 1) ? atoi(campos[1]) : 4;
+        int decimacion = (n > 2) ? atoi(campos[2]) : 1;
+        if (ventana < 1 || ventana > FILTROS_MEDIA_MAX || decimacion < 1 || decimacion > ventana) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        etapa->tipo = FILTRO_MEDIA;
+        etapa->media.ventana = (uint8_t)ventana;
+        etapa->media.decimacion = (uint8_t)decimacion;
+    } else if (strcmp(campos[0], "iir") == 0) {
+        float alfa = (n > 1) ? strtof(campos[1], NULL) : 0.2f;
+        if (!(alfa > 0.0f && alfa <= 1.0f)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        etapa->tipo = FILTRO_IIR;
+        etapa->iir.alfa_q16 = (uint32_t)lroundf(alfa * 65536.0f);
+        if (etapa->iir.alfa_q16 == 0) {
+            etapa->iir.alfa_q16 = 1;
+        }
+    } else if (strcmp(campos[0], "kalman") == 0) {
+        float q = (n > 1) ? strtof(campos[1], NULL) : 4.0f;
+        float r = (n > 2) ? strtof(campos[2], NULL) : 400.0f;
+        if (!(q >= 0.0f) || !(r > 0.0f)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        etapa->tipo = FILTRO_KALMAN;
+        etapa->kalman.q = q;
+        etapa->kalman.r = r;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t filtros_config_desde_texto(const char *texto, filtros_config_t *cfg) {
+    if (texto == NULL || cfg == NULL || strlen(texto) >= FILTROS_TEXTO_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    filtros_config_t nueva = { 0 };
+    if (strcmp(texto, "ninguno") == 0 || texto[0] == '\0') {
+        *cfg = nueva;
+        return ESP_OK;
+    }
+
+    char copia[FILTROS_TEXTO_MAX];
+    strlcpy(copia, texto, sizeof(copia));
+    char *guardado;
+    for (char *token = strtok_r(copia, ",", &guardado); token != NULL; token = strtok_r(NULL, ",", &guardado)) {
+        if (nueva.num_etapas >= FILTROS_MAX_ETAPAS) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        esp_err_t err = filtros_parsear_etapa(token, &nueva.etapas[nueva.num_etapas]);
+        if (err != ESP_OK) {
+            return err;
+        }
+        nueva.num_etapas++;
+    }
+    *cfg = nueva;
+    return ESP_OK;
+}
+
+int filtros_config_a_texto(const filtros_config_t *cfg, char *buffer, size_t tam) {
+    if (cfg->num_etapas == 0) {
+        return snprintf(buffer, tam, "ninguno");
+    }
+    size_t usado = 0;
+    for (uint8_t i = 0; i < cfg->num_etapas && usado < tam; i++) {
+        const filtro_etapa_cfg_t *e = &cfg->etapas[i];
+        const char *sep = (i == 0) ? "" : ",";
+        int n = 0;
+        switch (e->tipo) {
+            case FILTRO_MEDIANA:
+                n = snprintf(buffer + usado, tam - usado, "%smediana:%u", sep, (unsigned)e->mediana.ventana);
+                break;
+            case FILTRO_MEDIA:
+                n = snprintf(buffer + usado, tam - usado, "%smedia:%u:%u", sep,
+                             (unsigned)e->media.ventana, (unsigned)e->media.decimacion);
+                break;
+            case FILTRO_IIR:
+                n = snprintf(buffer + usado, tam - usado, "%siir:%.4f", sep, e->iir.alfa_q16 / 65536.0f);
+                break;
+            case FILTRO_KALMAN:
+                n = snprintf(buffer + usado, tam - usado, "%skalman:%g:%g", sep, e->kalman.q, e->kalman.r);
+                break;
+        }
+        if (n < 0) {
+            return n;
+        }
+        usado += (size_t)n;
+    }
+    return (int)usado;
+}
+
+// ------------------------------ NVS ------------------------------
+
+static esp_err_t filtros_guardar_nvs(const char *texto) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_str(nvs_handle, NVS_KEY_FILTROS, texto);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    return err;
+}
+
+void filtros_init(void) {
+    char texto[FILTROS_TEXTO_MAX] = FILTROS_CONFIG_DEFECTO;
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK) {
+        size_t tam = sizeof(texto);
+        if (nvs_get_str(nvs_handle, NVS_KEY_FILTROS, texto, &tam) != ESP_OK) {
+            strlcpy(texto, FILTROS_CONFIG_DEFECTO, sizeof(texto));
+        }
+        nvs_close(nvs_handle);
+    }
+
+    if (filtros_config_desde_texto(texto, &config_activa) != ESP_OK) {
+        ESP_LOGW(FILTROS_TAG, "⚠️ Cadena guardada inválida '%s', usando la de defecto", texto);
+        strlcpy(texto, FILTROS_CONFIG_DEFECTO, sizeof(texto));
+        filtros_config_desde_texto(texto, &config_activa);
+    }
+    filtros_reiniciar();
+    ESP_LOGI(FILTROS_TAG, "Cadena de filtros: %s", texto);
+}
+
+esp_err_t filtros_configurar(const char *texto) {
+    filtros_config_t nueva;
+    esp_err_t err = filtros_config_desde_texto(texto, &nueva);
+    if (err != ESP_OK) {
+        ESP_LOGE(FILTROS_TAG, "❌ Cadena de filtros inválida: %s", texto);
+        return err;
+    }
+
+    portENTER_CRITICAL(&filtros_spinlock);
+    config_pendiente = nueva;
+    atomic_store_explicit(&hay_config_pendiente, true, memory_order_release);
+    portEXIT_CRITICAL(&filtros_spinlock);
+
+    // Se guarda en forma canónica para que la lectura posterior sea idéntica
+    char canonica[FILTROS_TEXTO_MAX];
+    filtros_config_a_texto(&nueva, canonica, sizeof(canonica));
+    err = filtros_guardar_nvs(canonica);
+    if (err != ESP_OK) {
+        ESP_LOGE(FILTROS_TAG, "❌ Error al guardar filtros en NVS: %s", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(FILTROS_TAG, "✅ Cadena de filtros actualizada: %s", canonica);
+    return ESP_OK;
+}
+
+void filtros_get_config(filtros_config_t *cfg) {
+    if (cfg == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&filtros_spinlock);
+    *cfg = atomic_load(&hay_config_pendiente) ? config_pendiente : config_activa;
+    portEXIT_CRITICAL(&filtros_spinlock);
+}
+
+void filtros_get_stats(filtros_stats_t *out) {
+    if (out != NULL) {
+        *out = stats;
+    }
+}
+
+#if CONFIG_HALO_BENCHMARKS
+/**
+ * @brief Ciclos por muestra de cada tipo de etapa sobre una señal sintética
+ *
+ * Escalón con ruido y picos aislados, generado en el propio equipo (no hay
+ * flujos grabados a bordo). Debe llamarse antes de arrancar el registro.
+ */
+void filtros_benchmark(int muestras) {
+    static const char *cadenas[] = { "mediana:5", "mediana:15", "media:8", "media:32:8", "iir:0.1", "kalman:4:400" };
+    uint32_t semilla = 0xACE1u;
+
+    if (muestras <= 0) {
+        return;
+    }
+    filtros_config_t guardada = config_activa;
+    for (size_t c = 0; c < sizeof(cadenas) / sizeof(cadenas[0]); c++) {
+        filtros_config_desde_texto(cadenas[c], &config_activa);
+        filtros_reiniciar();
+        volatile int32_t sumidero = 0;
+        uint32_t ciclos = 0;
+        for (int i = 0; i < muestras; i++) {
+            semilla ^= semilla << 13;
+            semilla ^= semilla >> 17;
+            semilla ^= semilla << 5;
+            int32_t x = (i < muestras / 2 ? 100000 : 150000) + (int32_t)(semilla % 201) - 100;
+            if ((i % 97) == 0) {
+                x += 20000;     // Pico aislado
+            }
+            int32_t y;
+            uint32_t t = esp_cpu_get_cycle_count();
+            if (filtros_procesar(x, &y)) {
+                sumidero = y;
+            }
+            ciclos += esp_cpu_get_cycle_count() - t;
+        }
+        (void)sumidero;
+        ESP_LOGI(FILTROS_TAG, "⏱️ Benchmark %-12s: %u ciclos/muestra", cadenas[c], (unsigned)(ciclos / muestras));
+    }
+    config_activa = guardada;
+    filtros_reiniciar();
+    memset(&stats, 0, sizeof(stats));
+}
+#endif // CONFIG_HALO_BENCHMARKS
@@ -0,0 +1,28 @@
+#include "../include/histograma.h"
+#include <stdio.h>
+
+static const uint32_t limites_us[HISTOGRAMA_CUBETAS - 1] = HISTOGRAMA_LIMITES_US;
+
+void histograma_agregar(histograma_t *h, uint32_t us) {
+    int i = 0;
+    while (i < HISTOGRAMA_CUBETAS - 1 && us >= limites_us[i]) {
+        i++;
+    }
+    h->cubetas[i]++;
+    h->n++;
+    h->suma_us += us;
+    if (us > h->max_us) {
+        h->max_us = us;
+    }
+}
+
+uint32_t histograma_media_us(const histograma_t *h) {
+    return (h->n > 0) ? (uint32_t)(h->suma_us / h->n) : 0;
+}
+
+int histograma_a_texto(const histograma_t *h, char *buffer, size_t tam) {
+    const uint32_t *c = h->cubetas;
+    return snprintf(buffer, tam, "[%u,%u,%u,%u,%u,%u,%u,%u]",
+                    (unsigned)c[0], (unsigned)c[1], (unsigned)c[2], (unsigned)c[3],
+                    (unsigned)c[4], (unsigned)c[5], (unsigned)c[6], (unsigned)c[7]);
+}
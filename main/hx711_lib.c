@@ -11,7 +11,16 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "../include/mqtt_lib.h"
+#include "../include/hx711_sim.h"
+#include <esp_timer.h>
+#include <esp_cpu.h>
+#include <esp_private/esp_clk.h>
+#include <esp_rom_sys.h>
+#include <soc/gpio_reg.h>
 #include <math.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <esp_rom_crc.h>
 #include <string.h>
 
 static const char *HX711_TAG = "HX711_LIB";
@@ -21,15 +30,62 @@ hx711_handle_t hx711;
 int32_t offset = 0;
 float scale = 1000.0f;
 
+// Estadísticas de adquisición
+static hx711_stats_t hx711_stats = {0};
+
+// Serializa el acceso al bus entre el muestreador y la calibración
+static SemaphoreHandle_t hx711_mutex = NULL;
+
+// Serializa offset/scale entre la calibración (tara) y el autocero
+static SemaphoreHandle_t hx711_cal_mutex = NULL;
+
+// Calibración en punto fijo con doble buffer (escribe la calibración, lee el registro)
+static hx711_cal_fija_t cal_fija[2] = {
+    { .offset = 0, .mult = 1000 << 20, .shift = 20 },   // scale = 1000 cuentas/kg
+    { .offset = 0, .mult = 1000 << 20, .shift = 20 },
+};
+static atomic_uint cal_fija_activa = 0;
+
+// Calibración completa en RAM (copia del blob de NVS)
+static hx711_cal_blob_t calibracion = {
+    .version = HX711_CAL_VERSION,
+    .modelo = HX711_CAL_LINEAL,
+    .scale = 1000.0f,
+};
+
+// Sesión de calibración en curso (comando 1 y puntos "8"): pasa a 'calibracion',
+// offset y scale solo cuando un punto ajusta y se guarda. Con el mutex de calibración.
+static hx711_cal_blob_t sesion;
+static uint32_t sesion_generacion = 0;     // Sube con cada comando 1
+
+// Calibración por canal (ganancia de esquina y cero de cada celda)
+static hx711_canales_cal_t canales_cal = {
+    .ganancia_q16 = { HX711_GANANCIA_UNIDAD_Q16, HX711_GANANCIA_UNIDAD_Q16,
+                      HX711_GANANCIA_UNIDAD_Q16, HX711_GANANCIA_UNIDAD_Q16 },
+};
+static portMUX_TYPE hx711_canales_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+// DOUT de cada canal; el canal 0 es el que despierta la lectura
+static DRAM_ATTR const uint8_t hx711_dout_canal[HX711_MAX_CANALES] = {
+    HX711_DOUT, HX711_DOUT_1, HX711_DOUT_2, HX711_DOUT_3
+};
+
 // Claves NVS para calibración
 #define NVS_NAMESPACE "hx711_cal"
 #define NVS_KEY_OFFSET "offset"
 #define NVS_KEY_SCALE "scale"
 #define NVS_KEY_CALIBRATED "calibrated"
+#define NVS_KEY_CAL_BLOB "cal_blob"
+#define NVS_KEY_CANALES "canales"
 
 // ------------ HX711 funciones de bajo nivel -------------
 static uint8_t hx711_bus_init(void) { 
     gpio_set_direction(HX711_DOUT, GPIO_MODE_INPUT); 
+    for (int c = 1; c < HX711_NUM_CANALES; c++) {
+        // GPIO13/14 arrancan con función JTAG: volver a GPIO antes de usarlos
+        gpio_reset_pin(hx711_dout_canal[c]);
+        gpio_set_direction(hx711_dout_canal[c], GPIO_MODE_INPUT);
+    }
     return 0; 
 }
 
@@ -76,103 +132,245 @@ static void hx711_debug_print(const char *const fmt, ...) {
     va_end(args);
 }
 
+#if CONFIG_HX711_DATA_READY_IRQ
+// ------------ Dato listo por interrupción (flanco de bajada en DOUT) -------------
+static volatile TaskHandle_t hx711_tarea_en_espera = NULL;     // La escribe la tarea, la lee la ISR
+static volatile int64_t hx711_t_flanco_us = 0;
+
+static void IRAM_ATTR hx711_dout_isr_handler(void *arg) {
+    BaseType_t despertar = pdFALSE;
+    // DOUT conmuta durante la trama: solo interesa el primer flanco
+    gpio_intr_disable(HX711_DOUT);
+    hx711_t_flanco_us = esp_timer_get_time();
+    TaskHandle_t tarea = hx711_tarea_en_espera;     // Una sola lectura: la tarea puede anularla
+    if (tarea != NULL) {
+        vTaskNotifyGiveFromISR(tarea, &despertar);
+    }
+    portYIELD_FROM_ISR(despertar);
+}
+
+static uint8_t hx711_bus_init_irq(void) {
+    hx711_bus_init();
+    gpio_set_intr_type(HX711_DOUT, GPIO_INTR_NEGEDGE);
+    gpio_intr_disable(HX711_DOUT);
+
+    // El servicio puede estar ya instalado por el botón de usuario
+    esp_err_t ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(HX711_TAG, "Error al instalar servicio ISR: %s", esp_err_to_name(ret));
+        return 1;
+    }
+    if (gpio_isr_handler_add(HX711_DOUT, hx711_dout_isr_handler, NULL) != ESP_OK) {
+        ESP_LOGE(HX711_TAG, "Error al agregar manejador ISR de DOUT");
+        return 1;
+    }
+    return 0;
+}
+
+static uint8_t hx711_bus_deinit_irq(void) {
+    gpio_intr_disable(HX711_DOUT);
+    gpio_isr_handler_remove(HX711_DOUT);
+    return hx711_bus_deinit();
+}
+
+/**
+ * @brief Bloquea la tarea llamante hasta que el HX711 baje DOUT (conversión lista)
+ *
+ * @param timeout_ms Tiempo máximo de espera
+ * @return 0 si hay dato listo, 1 si venció el timeout
+ */
+static uint8_t hx711_wait_ready_irq(uint32_t timeout_ms) {
+    if (gpio_get_level(HX711_DOUT) == 0) {
+        hx711_stats_registrar_despertar(0);
+        return 0;
+    }
+
+    hx711_tarea_en_espera = xTaskGetCurrentTaskHandle();
+    ulTaskNotifyTake(pdTRUE, 0);    // Descartar notificaciones antiguas
+    gpio_intr_enable(HX711_DOUT);
+
+    // El flanco pudo ocurrir antes de habilitar la interrupción
+    if (gpio_get_level(HX711_DOUT) == 0) {
+        gpio_intr_disable(HX711_DOUT);
+        hx711_tarea_en_espera = NULL;
+        hx711_stats_registrar_despertar(0);
+        return 0;
+    }
+
+    uint32_t notificado = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms));
+    gpio_intr_disable(HX711_DOUT);
+    hx711_tarea_en_espera = NULL;
+    if (notificado == 0) {
+        return 1;
+    }
+
+    hx711_stats_registrar_despertar((uint32_t)(esp_timer_get_time() - hx711_t_flanco_us));
+    return 0;
+}
+#endif // CONFIG_HX711_DATA_READY_IRQ
+
+// ------------ Estadísticas de adquisición -------------
+void hx711_stats_registrar_despertar(uint32_t latencia_us) {
+    hx711_stats.latencia_despertar_us = latencia_us;
+    hx711_stats.latencia_despertar_suma_us += latencia_us;
+    if (latencia_us > hx711_stats.latencia_despertar_max_us) {
+        hx711_stats.latencia_despertar_max_us = latencia_us;
+    }
+}
+
+static void hx711_stats_registrar_irq(uint32_t ciclos_trama, uint32_t ciclos_ventana_max) {
+    hx711_stats.irq_off_ciclos = ciclos_trama;
+    if (ciclos_ventana_max > hx711_stats.irq_off_ventana_max_ciclos) {
+        hx711_stats.irq_off_ventana_max_ciclos = ciclos_ventana_max;
+    }
+}
+
+static void hx711_stats_registrar_cpu(uint32_t cpu_us) {
+    hx711_stats.muestras++;
+    hx711_stats.cpu_us = cpu_us;
+    hx711_stats.cpu_suma_us += cpu_us;
+    if (cpu_us > hx711_stats.cpu_max_us) {
+        hx711_stats.cpu_max_us = cpu_us;
+    }
+}
+
+void hx711_get_stats(hx711_stats_t *stats) {
+    if (stats != NULL) {
+        *stats = hx711_stats;
+    }
+}
+
+void hx711_reset_stats(void) {
+    memset(&hx711_stats, 0, sizeof(hx711_stats));
+}
+
+void hx711_log_stats(void) {
+    if (hx711_stats.muestras == 0) {
+        ESP_LOGI(HX711_TAG, "Sin muestras para estadísticas (timeouts: %u)", (unsigned)hx711_stats.timeouts);
+        return;
+    }
+    ESP_LOGI(HX711_TAG, "Muestras: %u | timeouts: %u | despertar: ult %u us, media %u us, max %u us | CPU: ult %u us, media %u us, max %u us",
+             (unsigned)hx711_stats.muestras, (unsigned)hx711_stats.timeouts,
+             (unsigned)hx711_stats.latencia_despertar_us,
+             (unsigned)(hx711_stats.latencia_despertar_suma_us / hx711_stats.muestras),
+             (unsigned)hx711_stats.latencia_despertar_max_us,
+             (unsigned)hx711_stats.cpu_us,
+             (unsigned)(hx711_stats.cpu_suma_us / hx711_stats.muestras),
+             (unsigned)hx711_stats.cpu_max_us);
+    ESP_LOGI(HX711_TAG, "IRQ deshabilitadas: ult trama %u ciclos, ventana max %u ciclos",
+             (unsigned)hx711_stats.irq_off_ciclos, (unsigned)hx711_stats.irq_off_ventana_max_ciclos);
+#if HX711_NUM_CANALES > 1
+    ESP_LOGI(HX711_TAG, "Canales: %d | desfase max de DOUT listo %u us",
+             HX711_NUM_CANALES, (unsigned)hx711_stats.espera_canales_max_us);
+#endif
+}
+
+static uint32_t hx711_cal_crc(const hx711_cal_blob_t *cal) {
+    return esp_rom_crc32_le(0, (const uint8_t *)cal, offsetof(hx711_cal_blob_t, crc));
+}
+
 /**
- * @brief Guarda los valores de calibración en NVS
+ * @brief Guarda una calibración completa en NVS como un único blob con CRC
  * 
  * @return ESP_OK si se guardó correctamente, ESP_FAIL en caso contrario
  */
-esp_err_t hx711_guardar_calibracion(void) {
+static esp_err_t hx711_guardar_calibracion_blob(hx711_cal_blob_t *cal) {
     nvs_handle_t nvs_handle;
     esp_err_t err;
     
-    // Abrir namespace NVS
+    cal->version = HX711_CAL_VERSION;
+    cal->timestamp = (uint32_t)time(NULL);
+    cal->crc = hx711_cal_crc(cal);
+
     err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
     if (err != ESP_OK) {
         ESP_LOGE(HX711_TAG, "Error al abrir NVS: %s", esp_err_to_name(err));
         return ESP_FAIL;
     }
     
-    // Guardar offset
-    err = nvs_set_i32(nvs_handle, NVS_KEY_OFFSET, offset);
-    if (err != ESP_OK) {
-        ESP_LOGE(HX711_TAG, "Error al guardar offset: %s", esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return ESP_FAIL;
-    }
-    
-    // Guardar scale
-    err = nvs_set_blob(nvs_handle, NVS_KEY_SCALE, &scale, sizeof(float));
-    if (err != ESP_OK) {
-        ESP_LOGE(HX711_TAG, "Error al guardar scale: %s", esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return ESP_FAIL;
+    // Una sola escritura: no puede quedar un offset nuevo con una escala vieja
+    err = nvs_set_blob(nvs_handle, NVS_KEY_CAL_BLOB, cal, sizeof(*cal));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
     }
-    
-    // Marcar como calibrado
-    err = nvs_set_u8(nvs_handle, NVS_KEY_CALIBRATED, 1);
+    nvs_close(nvs_handle);
     if (err != ESP_OK) {
-        ESP_LOGE(HX711_TAG, "Error al marcar como calibrado: %s", esp_err_to_name(err));
-        nvs_close(nvs_handle);
+        ESP_LOGE(HX711_TAG, "Error al guardar calibración: %s", esp_err_to_name(err));
         return ESP_FAIL;
     }
-    
-    // Commit los cambios
-    err = nvs_commit(nvs_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(HX711_TAG, "Error al hacer commit: %s", esp_err_to_name(err));
-        nvs_close(nvs_handle);
+    ESP_LOGI(HX711_TAG, "Calibración guardada en NVS - Offset: %d, Scale: %.2f, C2: %g, puntos: %u",
+             (int)cal->offset, cal->scale, cal->c2, (unsigned)cal->num_puntos);
+    return ESP_OK;
+}
+
+esp_err_t hx711_guardar_calibracion(void) {
+    return hx711_guardar_calibracion_blob(&calibracion);
+}
+
+// Lee el formato anterior (offset, scale y bandera en claves separadas)
+static esp_err_t hx711_cargar_calibracion_legado(nvs_handle_t nvs_handle) {
+    uint8_t calibrated = 0;
+    int32_t offset_leido;
+    float scale_leido;
+    size_t scale_size = sizeof(float);
+
+    if (nvs_get_u8(nvs_handle, NVS_KEY_CALIBRATED, &calibrated) != ESP_OK || calibrated == 0 ||
+        nvs_get_i32(nvs_handle, NVS_KEY_OFFSET, &offset_leido) != ESP_OK ||
+        nvs_get_blob(nvs_handle, NVS_KEY_SCALE, &scale_leido, &scale_size) != ESP_OK) {
         return ESP_FAIL;
     }
-    
-    nvs_close(nvs_handle);
-    ESP_LOGI(HX711_TAG, "Calibración guardada en NVS - Offset: %d, Scale: %.2f", (int)offset, scale);
+    memset(&calibracion, 0, sizeof(calibracion));
+    calibracion.modelo = HX711_CAL_LINEAL;
+    calibracion.offset = offset_leido;
+    calibracion.scale = scale_leido;
     return ESP_OK;
 }
 
 /**
- * @brief Carga los valores de calibración desde NVS
+ * @brief Carga la calibración desde NVS con una sola lectura
+ *
+ * Si no hay blob válido intenta el formato anterior y lo migra al blob.
  * 
  * @return ESP_OK si se cargó correctamente, ESP_FAIL si no hay calibración guardada
  */
 esp_err_t hx711_cargar_calibracion(void) {
     nvs_handle_t nvs_handle;
     esp_err_t err;
+    hx711_cal_blob_t leida;
+    size_t tam = sizeof(leida);
+    bool migrar = false;
     
-    // Abrir namespace NVS
     err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
     if (err != ESP_OK) {
         ESP_LOGE(HX711_TAG, "Error al abrir NVS: %s", esp_err_to_name(err));
         return ESP_FAIL;
     }
     
-    // Verificar si está calibrado
-    uint8_t calibrated = 0;
-    err = nvs_get_u8(nvs_handle, NVS_KEY_CALIBRATED, &calibrated);
-    if (err != ESP_OK || calibrated == 0) {
-        ESP_LOGW(HX711_TAG, "No hay calibración guardada en NVS");
-        nvs_close(nvs_handle);
-        return ESP_FAIL;
-    }
-    
-    // Cargar offset
-    err = nvs_get_i32(nvs_handle, NVS_KEY_OFFSET, &offset);
-    if (err != ESP_OK) {
-        ESP_LOGE(HX711_TAG, "Error al cargar offset: %s", esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return ESP_FAIL;
-    }
-    
-    // Cargar scale
-    size_t scale_size = sizeof(float);
-    err = nvs_get_blob(nvs_handle, NVS_KEY_SCALE, &scale, &scale_size);
-    if (err != ESP_OK) {
-        ESP_LOGE(HX711_TAG, "Error al cargar scale: %s", esp_err_to_name(err));
+    err = nvs_get_blob(nvs_handle, NVS_KEY_CAL_BLOB, &leida, &tam);
+    if (err == ESP_OK && tam == sizeof(leida) && leida.version == HX711_CAL_VERSION &&
+        leida.crc == hx711_cal_crc(&leida) && leida.num_puntos <= HX711_CAL_MAX_PUNTOS) {
+        calibracion = leida;
+    } else if (hx711_cargar_calibracion_legado(nvs_handle) == ESP_OK) {
+        migrar = true;
+    } else {
+        if (err == ESP_OK) {
+            ESP_LOGE(HX711_TAG, "Calibración en NVS corrupta o de otra versión");
+        } else {
+            ESP_LOGW(HX711_TAG, "No hay calibración guardada en NVS");
+        }
         nvs_close(nvs_handle);
         return ESP_FAIL;
     }
-    
     nvs_close(nvs_handle);
-    ESP_LOGI(HX711_TAG, "Calibración cargada desde NVS - Offset: %d, Scale: %.2f", (int)offset, scale);
+
+    offset = calibracion.offset;
+    scale = calibracion.scale;
+    if (migrar) {
+        ESP_LOGI(HX711_TAG, "Migrando calibración al formato de blob único");
+        hx711_guardar_calibracion();
+    }
+    ESP_LOGI(HX711_TAG, "Calibración cargada desde NVS - Offset: %d, Scale: %.2f, modelo %s",
+             (int)offset, scale, calibracion.modelo == HX711_CAL_CUADRATICO ? "cuadrático" : "lineal");
     return ESP_OK;
 }
 
@@ -181,18 +379,95 @@ esp_err_t hx711_cargar_calibracion(void) {
  */
 int hx711_tiene_calibracion_guardada(void) {
     nvs_handle_t nvs_handle;
-    esp_err_t err;
+    size_t tam = 0;
+    uint8_t calibrated = 0;
     
-    err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
-    if (err != ESP_OK) {
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
         return false;
     }
-    
-    uint8_t calibrated = 0;
-    err = nvs_get_u8(nvs_handle, NVS_KEY_CALIBRATED, &calibrated);
+    bool hay = (nvs_get_blob(nvs_handle, NVS_KEY_CAL_BLOB, NULL, &tam) == ESP_OK && tam == sizeof(hx711_cal_blob_t)) ||
+               (nvs_get_u8(nvs_handle, NVS_KEY_CALIBRATED, &calibrated) == ESP_OK && calibrated == 1);
     nvs_close(nvs_handle);
-    
-    return (err == ESP_OK && calibrated == 1);
+    return hay;
+}
+
+void hx711_get_calibracion(hx711_cal_blob_t *cal) {
+    if (cal != NULL) {
+        hx711_calibracion_tomar(portMAX_DELAY);
+        *cal = calibracion;
+        hx711_calibracion_soltar();
+    }
+}
+
+// ------------ Calibración por canal -------------
+static esp_err_t hx711_guardar_canales(const hx711_canales_cal_t *cal) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs_handle, NVS_KEY_CANALES, cal, sizeof(*cal));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    return err;
+}
+
+static void hx711_cargar_canales(void) {
+    nvs_handle_t nvs_handle;
+    hx711_canales_cal_t leida;
+    size_t tam = sizeof(leida);
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_blob(nvs_handle, NVS_KEY_CANALES, &leida, &tam) == ESP_OK && tam == sizeof(leida)) {
+        portENTER_CRITICAL(&hx711_canales_spinlock);
+        canales_cal = leida;
+        portEXIT_CRITICAL(&hx711_canales_spinlock);
+    }
+    nvs_close(nvs_handle);
+}
+
+esp_err_t hx711_configurar_canal(const char *clave_valor) {
+    const char *prefijo = "ganancia_c";
+    int canal;
+    float factor;
+    if (clave_valor == NULL || strncmp(clave_valor, prefijo, strlen(prefijo)) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (HX711_NUM_CANALES == 1) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (sscanf(clave_valor + strlen(prefijo), "%d=%f", &canal, &factor) != 2 ||
+        canal < 0 || canal >= HX711_NUM_CANALES || !(factor >= 0.5f && factor <= 2.0f)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    hx711_canales_cal_t nueva;
+    portENTER_CRITICAL(&hx711_canales_spinlock);
+    canales_cal.ganancia_q16[canal] = (int32_t)lroundf(factor * HX711_GANANCIA_UNIDAD_Q16);
+    nueva = canales_cal;
+    portEXIT_CRITICAL(&hx711_canales_spinlock);
+
+    esp_err_t err = hx711_guardar_canales(&nueva);
+    if (err != ESP_OK) {
+        ESP_LOGE(HX711_TAG, "Error al guardar calibración de canales: %s", esp_err_to_name(err));
+        return err;
+    }
+    // La suma combinada cambió: offset y escala quedan desplazados hasta recalibrar
+    ESP_LOGW(HX711_TAG, "Ganancia del canal %d = %.4f; recalibre con los comandos 1 y 8", canal, factor);
+    return ESP_OK;
+}
+
+void hx711_get_canales(hx711_canales_cal_t *cal) {
+    if (cal == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&hx711_canales_spinlock);
+    *cal = canales_cal;
+    portEXIT_CRITICAL(&hx711_canales_spinlock);
 }
 
 // --- INICIO: Funciones fusionadas de driver_hx711.c ---
@@ -205,15 +480,20 @@ int hx711_tiene_calibracion_guardada(void) {
 #define TEMPERATURE_MAX           85.0f
 #define DRIVER_VERSION            2000
 
-static uint8_t a_hx711_read_ad(hx711_handle_t *handle, uint8_t len, int32_t *value)
+static uint8_t a_hx711_wait_ready(hx711_handle_t *handle, int64_t *t_bloqueado)
 {
-    uint32_t val = 0;
     uint32_t cnt = 0;
-    uint8_t i;
     uint8_t v;
-    if (handle->clock_write(0) != 0) {
-        handle->debug_print("hx711: clock write 0 failed.\n");
-        return 1;
+    *t_bloqueado = 0;
+    if (handle->wait_ready != NULL) {
+        int64_t t_espera = esp_timer_get_time();
+        if (handle->wait_ready(HX711_TIMEOUT_LISTO_MS) != 0) {
+            hx711_stats.timeouts++;
+            handle->debug_print("hx711: bus no response.\n");
+            return 1;
+        }
+        *t_bloqueado = esp_timer_get_time() - t_espera;
+        return 0;
     }
     while (1) {
         handle->delay_us(100);
@@ -228,10 +508,42 @@ static uint8_t a_hx711_read_ad(hx711_handle_t *handle, uint8_t len, int32_t *val
                 return 1;
             }
         } else {
-            break;
+            return 0;
         }
     }
+}
+
+static int32_t a_hx711_sign_extend(uint32_t val)
+{
+    if ((val & 0x800000) != 0) {
+        union {
+            int32_t i_f;
+            uint32_t u_f;
+        } u;
+        val = 0xFF000000U | val;
+        u.u_f = val;
+        return (int32_t)u.i_f;
+    }
+    return (int32_t)val;
+}
+
+static uint8_t a_hx711_read_ad(hx711_handle_t *handle, uint8_t len, int32_t *value)
+{
+    uint32_t val = 0;
+    uint8_t i;
+    uint8_t v;
+    uint32_t c_irq;
+    int64_t t_inicio = esp_timer_get_time();
+    int64_t t_bloqueado = 0;
+    if (handle->clock_write(0) != 0) {
+        handle->debug_print("hx711: clock write 0 failed.\n");
+        return 1;
+    }
+    if (a_hx711_wait_ready(handle, &t_bloqueado) != 0) {
+        return 1;
+    }
     handle->disable_irq();
+    c_irq = esp_cpu_get_cycle_count();
     handle->delay_us(1);
     for (i = 0; i < 24; i++) {
         if (handle->clock_write(1) != 0) {
@@ -271,20 +583,182 @@ static uint8_t a_hx711_read_ad(hx711_handle_t *handle, uint8_t len, int32_t *val
         handle->delay_us(1);
         len--;
     }
+    c_irq = esp_cpu_get_cycle_count() - c_irq;
     handle->enable_irq();
-    if ((val & 0x800000) != 0) {
-        union {
-            int32_t i_f;
-            uint32_t u_f;
-        } u;
-        val = 0xFF000000U | val;
-        u.u_f = val;
-        *value = (int32_t)u.i_f;
-    } else {
-        *value = (int32_t)val;
+    // Toda la trama es una única ventana con interrupciones deshabilitadas
+    hx711_stats_registrar_irq(c_irq, c_irq);
+    hx711_stats_registrar_cpu((uint32_t)(esp_timer_get_time() - t_inicio - t_bloqueado));
+    *value = a_hx711_sign_extend(val);
+    return 0;
+}
+
+#if CONFIG_HX711_FAST_GPIO
+// ------------ Camino rápido: acceso directo a registros GPIO -------------
+// Solo el semiperiodo alto de SCK es crítico (más de 60 us en alto apaga el
+// HX711), así que la sección crítica cubre un pulso y no la trama completa.
+_Static_assert(HX711_SCK < 32 && HX711_DOUT < 32 && HX711_DOUT_1 < 32 && HX711_DOUT_2 < 32 &&
+               HX711_DOUT_3 < 32, "El camino rápido usa los registros GPIO 0-31");
+_Static_assert(HX711_NUM_CANALES >= 1 && HX711_NUM_CANALES <= HX711_MAX_CANALES, "HX711_NUM_CANALES fuera de rango");
+
+#define HX711_SCK_ALTO()    REG_WRITE(GPIO_OUT_W1TS_REG, BIT(HX711_SCK))
+#define HX711_SCK_BAJO()    REG_WRITE(GPIO_OUT_W1TC_REG, BIT(HX711_SCK))
+
+static portMUX_TYPE hx711_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+// Pulso de SCK con la mínima ventana de interrupciones deshabilitadas;
+// devuelve los ciclos que duró la ventana
+static inline __attribute__((always_inline)) uint32_t hx711_fast_pulso(void)
+{
+    portENTER_CRITICAL(&hx711_spinlock);
+    uint32_t c = esp_cpu_get_cycle_count();
+    HX711_SCK_ALTO();
+    esp_rom_delay_us(1);
+    HX711_SCK_BAJO();
+    c = esp_cpu_get_cycle_count() - c;
+    portEXIT_CRITICAL(&hx711_spinlock);
+    return c;
+}
+
+#if HX711_NUM_CANALES > 1
+/**
+ * @brief Espera a que el resto de canales baje DOUT tras el canal 0
+ *
+ * Cada HX711 convierte con su propio oscilador, así que los canales quedan
+ * listos con un desfase de hasta un periodo de conversión. El dato de un
+ * canal listo se mantiene hasta leerlo, por lo que basta esperar al último.
+ */
+static uint8_t hx711_esperar_canales(void)
+{
+    uint32_t mascara = 0;
+    for (int c = 1; c < HX711_NUM_CANALES; c++) {
+        mascara |= BIT(hx711_dout_canal[c]);
+    }
+    int64_t t_inicio = esp_timer_get_time();
+    while ((REG_READ(GPIO_IN_REG) & mascara) != 0) {
+        if (esp_timer_get_time() - t_inicio > HX711_ESPERA_CANALES_MS * 1000LL) {
+            hx711_stats.timeouts++;
+            return 1;
+        }
+        vTaskDelay(1);
+    }
+    uint32_t desfase_us = (uint32_t)(esp_timer_get_time() - t_inicio);
+    if (desfase_us > hx711_stats.espera_canales_max_us) {
+        hx711_stats.espera_canales_max_us = desfase_us;
     }
     return 0;
 }
+#endif
+
+/**
+ * @brief Desplaza la trama (24 bits + 'len' pulsos de ganancia) con DOUT ya bajo
+ *
+ * En IRAM junto con lo que llama (hx711_fast_pulso en línea, esp_rom_delay_us
+ * en ROM, hx711_dout_canal en DRAM): las ventanas sin interrupciones no
+ * dependen de la caché de flash.
+ */
+static void IRAM_ATTR hx711_fast_trama(uint8_t len, uint32_t val[HX711_NUM_CANALES],
+                                       uint32_t *c_total, uint32_t *c_max)
+{
+    uint32_t c;
+    for (int i = 0; i < 24; i++) {
+        c = hx711_fast_pulso();
+        *c_total += c;
+        if (c > *c_max) *c_max = c;
+        // DOUT es válido 0.1 us después del flanco de subida: se lee con SCK bajo
+        uint32_t entrada = REG_READ(GPIO_IN_REG);
+        for (int ch = 0; ch < HX711_NUM_CANALES; ch++) {
+            val[ch] = (val[ch] << 1) | ((entrada >> hx711_dout_canal[ch]) & 0x1);
+        }
+        esp_rom_delay_us(1);
+    }
+    while (len != 0) {
+        c = hx711_fast_pulso();
+        *c_total += c;
+        if (c > *c_max) *c_max = c;
+        esp_rom_delay_us(1);
+        len--;
+    }
+}
+
+// Lee una trama de todos los canales: una sola lectura de GPIO_IN_REG por bit.
+// La espera de dato listo duerme, así que esta parte queda en flash.
+static uint8_t a_hx711_read_ad_fast(hx711_handle_t *handle, uint8_t len, int32_t valores[HX711_NUM_CANALES])
+{
+    uint32_t val[HX711_NUM_CANALES] = { 0 };
+    uint32_t c_total = 0;
+    uint32_t c_max = 0;
+    int64_t t_inicio = esp_timer_get_time();
+    int64_t t_bloqueado = 0;
+
+    HX711_SCK_BAJO();
+    if (a_hx711_wait_ready(handle, &t_bloqueado) != 0) {
+        return 1;
+    }
+#if HX711_NUM_CANALES > 1
+    int64_t t_espera = esp_timer_get_time();
+    if (hx711_esperar_canales() != 0) {
+        handle->debug_print("hx711: channel not ready.\n");
+        return 1;
+    }
+    t_bloqueado += esp_timer_get_time() - t_espera;
+#endif
+    hx711_fast_trama(len, val, &c_total, &c_max);
+    hx711_stats_registrar_irq(c_total, c_max);
+    hx711_stats_registrar_cpu((uint32_t)(esp_timer_get_time() - t_inicio - t_bloqueado));
+    for (int ch = 0; ch < HX711_NUM_CANALES; ch++) {
+        valores[ch] = a_hx711_sign_extend(val[ch]);
+    }
+    return 0;
+}
+#endif // CONFIG_HX711_FAST_GPIO
+
+// Suma de canales con su ganancia de esquina; con un solo canal es la lectura tal cual
+static int32_t hx711_combinar_canales(const int32_t canales[HX711_NUM_CANALES])
+{
+#if HX711_NUM_CANALES > 1
+    int32_t ganancia[HX711_NUM_CANALES];
+    portENTER_CRITICAL(&hx711_canales_spinlock);
+    memcpy(ganancia, canales_cal.ganancia_q16, sizeof(ganancia));
+    portEXIT_CRITICAL(&hx711_canales_spinlock);
+    int64_t suma = 0;
+    for (int c = 0; c < HX711_NUM_CANALES; c++) {
+        suma += (int64_t)canales[c] * ganancia[c];
+    }
+    return (int32_t)((suma + 0x8000) >> 16);
+#else
+    return canales[0];
+#endif
+}
+
+// Elige el camino rápido cuando el handle usa el backend GPIO nativo; 'value'
+// recibe la suma combinada y 'canales' las cuentas de cada celda
+static uint8_t a_hx711_read_canales(hx711_handle_t *handle, uint8_t len, int32_t *value,
+                                    int32_t canales[HX711_NUM_CANALES])
+{
+#if CONFIG_HX711_FAST_GPIO
+    if (handle->clock_write == hx711_clock_write && handle->bus_read == hx711_bus_read) {
+        if (a_hx711_read_ad_fast(handle, len, canales) != 0) {
+            return 1;
+        }
+        *value = hx711_combinar_canales(canales);
+        return 0;
+    }
+#endif
+    // Los hooks genéricos solo manejan un DOUT
+    if (a_hx711_read_ad(handle, len, value) != 0) {
+        return 1;
+    }
+    for (int c = 0; c < HX711_NUM_CANALES; c++) {
+        canales[c] = (c == 0) ? *value : 0;
+    }
+    return 0;
+}
+
+static uint8_t a_hx711_read(hx711_handle_t *handle, uint8_t len, int32_t *value)
+{
+    int32_t canales[HX711_NUM_CANALES];
+    return a_hx711_read_canales(handle, len, value, canales);
+}
 
 uint8_t hx711_init(hx711_handle_t *handle)
 {
@@ -322,7 +796,7 @@ uint8_t hx711_set_mode(hx711_handle_t *handle, hx711_mode_t mode)
     if (handle == NULL) return 2;
     if (handle->inited != 1) return 3;
     handle->mode = (uint8_t)mode;
-    if (a_hx711_read_ad(handle, handle->mode, (int32_t *)&value) != 0) {
+    if (a_hx711_read(handle, handle->mode, (int32_t *)&value) != 0) {
         handle->debug_print("hx711: read ad failed.\n");
         return 1;
     }
@@ -337,27 +811,32 @@ uint8_t hx711_get_mode(hx711_handle_t *handle, hx711_mode_t *mode)
     return 0;
 }
 
+/**
+ * @brief Lee una conversión; la tensión solo se calcula si voltage_v != NULL
+ */
 uint8_t hx711_read(hx711_handle_t *handle, int32_t *raw, double *voltage_v)
 {
     if (handle == NULL) return 2;
     if (handle->inited != 1) return 3;
-    if (a_hx711_read_ad(handle, handle->mode, (int32_t *)raw) != 0) {
+    if (hx711_mutex != NULL) xSemaphoreTake(hx711_mutex, portMAX_DELAY);
+    uint8_t res = a_hx711_read(handle, handle->mode, (int32_t *)raw);
+    if (hx711_mutex != NULL) xSemaphoreGive(hx711_mutex);
+    if (res != 0) {
         handle->debug_print("hx711: read voltage failed.\n");
         return 1;
     }
-    if (handle->mode == (uint8_t)HX711_MODE_CHANNEL_A_GAIN_128) {
-        *voltage_v = (double)(*raw) * (20.0 / (pow(2.0, 24.0))) / 1000.0;
-        return 0;
-    } else if (handle->mode == (uint8_t)HX711_MODE_CHANNEL_B_GAIN_32) {
-        *voltage_v = (double)(*raw) * (80.0 / (pow(2.0, 24.0))) / 1000.0;
-        return 0;
-    } else if (handle->mode == (uint8_t)HX711_MODE_CHANNEL_A_GAIN_64) {
-        *voltage_v = (double)(*raw) * (40.0 / (pow(2.0, 24.0))) / 1000.0;
+    if (voltage_v == NULL) {
+        // La tensión solo se calcula si el llamador la pide
         return 0;
-    } else {
+    }
+    if (handle->mode != (uint8_t)HX711_MODE_CHANNEL_A_GAIN_128 &&
+        handle->mode != (uint8_t)HX711_MODE_CHANNEL_B_GAIN_32 &&
+        handle->mode != (uint8_t)HX711_MODE_CHANNEL_A_GAIN_64) {
         handle->debug_print("hx711: mode error.\n");
         return 4;
     }
+    *voltage_v = (double)hx711_raw_a_nanovoltios(*raw, handle->mode) * 1e-9;
+    return 0;
 }
 
 uint8_t hx711_info(hx711_info_t *info)
@@ -380,10 +859,27 @@ uint8_t hx711_info(hx711_info_t *info)
 void init_HX711(void) {
     // Inicializar la estructura del handle
     DRIVER_HX711_LINK_INIT(&hx711, hx711_handle_t);
+    if (hx711_mutex == NULL) {
+        hx711_mutex = xSemaphoreCreateMutex();
+    }
+    if (hx711_cal_mutex == NULL) {
+        hx711_cal_mutex = xSemaphoreCreateMutex();
+    }
     
+#if CONFIG_HX711_SIM_BACKEND
+    // Backend simulado: DOUT/SCK modelados en software, sin celda de carga
+    hx711_sim_link(&hx711);
+    ESP_LOGW(HX711_TAG, "Usando backend HX711 SIMULADO");
+#else
     // Configurar las funciones de bajo nivel
+#if CONFIG_HX711_DATA_READY_IRQ
+    DRIVER_HX711_LINK_BUS_INIT(&hx711, hx711_bus_init_irq);
+    DRIVER_HX711_LINK_BUS_DEINIT(&hx711, hx711_bus_deinit_irq);
+    DRIVER_HX711_LINK_WAIT_READY(&hx711, hx711_wait_ready_irq);
+#else
     DRIVER_HX711_LINK_BUS_INIT(&hx711, hx711_bus_init);
     DRIVER_HX711_LINK_BUS_DEINIT(&hx711, hx711_bus_deinit);
+#endif
     DRIVER_HX711_LINK_BUS_READ(&hx711, hx711_bus_read);
     DRIVER_HX711_LINK_CLOCK_INIT(&hx711, hx711_clock_init);
     DRIVER_HX711_LINK_CLOCK_DEINIT(&hx711, hx711_clock_deinit);
@@ -392,6 +888,7 @@ void init_HX711(void) {
     DRIVER_HX711_LINK_ENABLE_IRQ(&hx711, hx711_enable_irq);
     DRIVER_HX711_LINK_DISABLE_IRQ(&hx711, hx711_disable_irq);
     DRIVER_HX711_LINK_DEBUG_PRINT(&hx711, hx711_debug_print);
+#endif
     
     // Inicializar el chip
     if (hx711_init(&hx711) == 0) {
@@ -400,61 +897,533 @@ void init_HX711(void) {
         ESP_LOGI(HX711_TAG, "HX711 inicializado correctamente");
         
         // Intentar cargar calibración guardada
+        hx711_cargar_canales();
         if (hx711_cargar_calibracion() == ESP_OK) {
             ESP_LOGI(HX711_TAG, "Calibración cargada exitosamente desde NVS");
         } else {
             ESP_LOGW(HX711_TAG, "No se encontró calibración guardada, usando valores por defecto");
             ESP_LOGI(HX711_TAG, "Valores por defecto - Offset: %d, Scale: %.2f", (int)offset, scale);
         }
+        hx711_actualizar_calibracion_fija();
     } else {
         ESP_LOGE(HX711_TAG, "Error al inicializar HX711");
     }
 }
 
+#if CONFIG_HALO_BENCHMARKS
+/**
+ * @brief Mide la ventana con interrupciones deshabilitadas de cada camino de lectura
+ *
+ * Lee 'tramas' conversiones con el camino genérico (hooks del handle) y, si
+ * está compilado, con el camino rápido por registros. Debe llamarse antes de
+ * arrancar la tarea de muestreo.
+ *
+ * @param tramas Número de tramas a leer por camino
+ */
+void hx711_benchmark_irq(int tramas) {
+    struct {
+        const char *nombre;
+        bool rapido;
+    } caminos[] = {
+        { "generico", false },
+#if CONFIG_HX711_FAST_GPIO
+        { "rapido", true },
+#endif
+    };
+    uint32_t mhz = (uint32_t)esp_clk_cpu_freq() / 1000000;
+
+    if (tramas <= 0) {
+        return;
+    }
+    for (size_t c = 0; c < sizeof(caminos) / sizeof(caminos[0]); c++) {
+        uint64_t suma = 0;
+        uint32_t max_ventana = 0;
+        int ok = 0;
+        for (int i = 0; i < tramas; i++) {
+            int32_t raw;
+            uint8_t res;
+            hx711_stats.irq_off_ventana_max_ciclos = 0;
+            xSemaphoreTake(hx711_mutex, portMAX_DELAY);
+#if CONFIG_HX711_FAST_GPIO
+            res = caminos[c].rapido ? a_hx711_read(&hx711, hx711.mode, &raw)
+                                    : a_hx711_read_ad(&hx711, hx711.mode, &raw);
+#else
+            res = a_hx711_read_ad(&hx711, hx711.mode, &raw);
+#endif
+            xSemaphoreGive(hx711_mutex);
+            if (res != 0) {
+                continue;
+            }
+            ok++;
+            suma += hx711_stats.irq_off_ciclos;
+            if (hx711_stats.irq_off_ventana_max_ciclos > max_ventana) {
+                max_ventana = hx711_stats.irq_off_ventana_max_ciclos;
+            }
+        }
+        if (ok == 0) {
+            ESP_LOGW(HX711_TAG, "⏱️ Benchmark %s: sin lecturas válidas", caminos[c].nombre);
+            continue;
+        }
+        uint32_t media = (uint32_t)(suma / ok);
+        ESP_LOGI(HX711_TAG, "⏱️ Benchmark %s (%d tramas): IRQ off por trama %u ciclos (%u us), ventana max %u ciclos (%u us)",
+                 caminos[c].nombre, ok,
+                 (unsigned)media, (unsigned)(media / mhz),
+                 (unsigned)max_ventana, (unsigned)(max_ventana / mhz));
+    }
+    hx711_reset_stats();
+}
+
+/**
+ * @brief Compara ciclos por muestra: conversión double/float vs punto fijo
+ *
+ * Reproduce la conversión original (tensión con pow() en double y división
+ * float por 'scale') frente a la nueva (entera, tensión solo bajo demanda)
+ * sobre un vector de cuentas crudas, sin tocar el bus.
+ *
+ * @param muestras Número de conversiones por camino
+ */
+void hx711_benchmark_conversion(int muestras) {
+    volatile double sumidero_v = 0.0;
+    volatile float sumidero_kg = 0.0f;
+    volatile int32_t sumidero_mg = 0;
+    int32_t raw = -0x7FFF00;
+    const int32_t paso = 0xFFFE00 / (muestras > 0 ? muestras : 1);
+
+    if (muestras <= 0) {
+        return;
+    }
+
+    uint32_t c = esp_cpu_get_cycle_count();
+    for (int i = 0; i < muestras; i++, raw += paso) {
+        sumidero_v = (double)raw * (20.0 / (pow(2.0, 24.0))) / 1000.0;
+        sumidero_kg = (raw - offset) / scale;
+    }
+    uint32_t ciclos_original = esp_cpu_get_cycle_count() - c;
+
+    raw = -0x7FFF00;
+    c = esp_cpu_get_cycle_count();
+    for (int i = 0; i < muestras; i++, raw += paso) {
+        sumidero_mg = hx711_calcular_peso_mg(raw);
+    }
+    uint32_t ciclos_fijo = esp_cpu_get_cycle_count() - c;
+
+    (void)sumidero_v;
+    (void)sumidero_kg;
+    (void)sumidero_mg;
+    ESP_LOGI(HX711_TAG, "⏱️ Benchmark conversión (%d muestras): double/float %u ciclos/muestra, punto fijo %u ciclos/muestra",
+             muestras, (unsigned)(ciclos_original / muestras), (unsigned)(ciclos_fijo / muestras));
+}
+#endif // CONFIG_HALO_BENCHMARKS
+
+/**
+ * @brief Lee una conversión cruda del HX711 (bloquea hasta dato listo)
+ *
+ * @param raw Cuentas crudas leídas
+ * @return ESP_OK si la lectura fue correcta, ESP_FAIL en caso contrario
+ */
+esp_err_t hx711_leer_raw(int32_t *raw) {
+    if (raw == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return (hx711_read(&hx711, raw, NULL) == 0) ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Lee una trama de todos los canales con SCK compartido
+ *
+ * @param raw Suma combinada con la ganancia de cada canal (la que usa la calibración)
+ * @param raw_canal Cuentas de cada celda (puede ser NULL)
+ * @return ESP_OK si la lectura fue correcta, ESP_FAIL en caso contrario
+ */
+esp_err_t hx711_leer_raw_canales(int32_t *raw, int32_t raw_canal[HX711_NUM_CANALES]) {
+    int32_t canales[HX711_NUM_CANALES];
+    if (raw == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (hx711.inited != 1) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (hx711_mutex != NULL) xSemaphoreTake(hx711_mutex, portMAX_DELAY);
+    uint8_t res = a_hx711_read_canales(&hx711, hx711.mode, raw, canales);
+    if (hx711_mutex != NULL) xSemaphoreGive(hx711_mutex);
+    if (res != 0) {
+        return ESP_FAIL;
+    }
+    if (raw_canal != NULL) {
+        memcpy(raw_canal, canales, sizeof(canales));
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Convierte cuentas crudas a tensión diferencial en nV (solo enteros)
+ */
+int32_t hx711_raw_a_nanovoltios(int32_t raw, uint8_t mode) {
+    int64_t fs;
+    switch (mode) {
+        case HX711_MODE_CHANNEL_B_GAIN_32: fs = HX711_FS_NV_GAIN_32; break;
+        case HX711_MODE_CHANNEL_A_GAIN_64: fs = HX711_FS_NV_GAIN_64; break;
+        default:                           fs = HX711_FS_NV_GAIN_128; break;
+    }
+    return (int32_t)(((int64_t)raw * fs) >> 24);
+}
+
+/**
+ * @brief Toma el mutex de calibración: quien cambia offset/scale (tara,
+ * calibración, autocero) lo hace entero con él tomado
+ *
+ * @return false si no se obtuvo dentro de 'espera'
+ */
+bool hx711_calibracion_tomar(TickType_t espera) {
+    return hx711_cal_mutex == NULL || xSemaphoreTake(hx711_cal_mutex, espera) == pdTRUE;
+}
+
+void hx711_calibracion_soltar(void) {
+    if (hx711_cal_mutex != NULL) xSemaphoreGive(hx711_cal_mutex);
+}
+
+/**
+ * @brief Recalcula la calibración en punto fijo a partir de offset/scale
+ *
+ * Se elige el mayor 'shift' que deja 'mult' por debajo de 2^30, de modo que
+ * (raw - offset) * mult (25 bits x 30 bits) cabe en un int64. Debe llamarse
+ * cada vez que cambian offset o scale, con hx711_calibracion_tomar().
+ */
+void hx711_actualizar_calibracion_fija(void) {
+    hx711_cal_fija_t nueva = { .offset = offset, .mult = 0, .shift = 0, .c2_mg = calibracion.c2 * 1e6f };
+    if (scale != 0.0f && isfinite(scale)) {
+        double mg_por_cuenta = 1000000.0 / (double)scale;
+        double magnitud = fabs(mg_por_cuenta);
+        while (nueva.shift < 40 && magnitud * 2.0 < (double)(1 << 30)) {
+            magnitud *= 2.0;
+            nueva.shift++;
+        }
+        double mult = ldexp(mg_por_cuenta, nueva.shift);
+        if (mult > INT32_MAX) mult = INT32_MAX;
+        if (mult < -INT32_MAX) mult = -INT32_MAX;
+        nueva.mult = (int32_t)lround(mult);
+    } else {
+        ESP_LOGW(HX711_TAG, "Escala inválida (%.3f): peso forzado a 0", scale);
+    }
+
+    // Doble buffer: el lector siempre ve una calibración completa
+    uint32_t siguiente = 1 - atomic_load(&cal_fija_activa);
+    cal_fija[siguiente] = nueva;
+    atomic_store(&cal_fija_activa, siguiente);
+    ESP_LOGI(HX711_TAG, "Calibración punto fijo: offset %d, mult %d, shift %u",
+             (int)nueva.offset, (int)nueva.mult, (unsigned)nueva.shift);
+}
+
+/**
+ * @brief Convierte cuentas crudas a peso en mg con la calibración en punto fijo
+ */
+// Recorta al rango de int32: una escala o un c2 absurdos no deben dar la vuelta al signo
+static inline int32_t hx711_saturar_i32(int64_t v) {
+    return (v > INT32_MAX) ? INT32_MAX : (v < INT32_MIN) ? INT32_MIN : (int32_t)v;
+}
+
+int32_t hx711_calcular_peso_mg(int32_t raw) {
+    const hx711_cal_fija_t *cal = &cal_fija[atomic_load_explicit(&cal_fija_activa, memory_order_acquire)];
+    int64_t x = (int64_t)raw - cal->offset;           // 33 bits como mucho
+    int64_t producto = x * cal->mult;
+    if (cal->shift > 0) {
+        producto += (int64_t)1 << (cal->shift - 1);     // Redondeo al mg más cercano
+    }
+    int64_t peso_mg = producto >> cal->shift;
+    if (cal->c2_mg != 0.0f) {
+        // Término cuadrático (solo con calibración de 2+ puntos con carga), acotado
+        // antes de lroundf() y sumado en int64
+        float xf = (float)x;
+        float cuadratico = cal->c2_mg * xf * xf;
+        if (!(cuadratico < 2147483648.0f)) cuadratico = 2147483648.0f;     // También NaN
+        if (cuadratico < -2147483648.0f) cuadratico = -2147483648.0f;
+        peso_mg += (int64_t)llroundf(cuadratico);
+    }
+    return hx711_saturar_i32(peso_mg);
+}
+
+/**
+ * @brief Convierte cuentas crudas a peso (kg) con la calibración actual
+ */
+float hx711_calcular_peso(int32_t raw) {
+    return (float)hx711_calcular_peso_mg(raw) * 1e-6f;
+}
+
+/**
+ * @brief Peso en mg que aporta una celda (desglose por canal)
+ *
+ * Usa el cero de la celda y solo el término lineal de la calibración global,
+ * ya que la escala se ajusta sobre la suma de canales.
+ */
+int32_t hx711_calcular_peso_canal_mg(int canal, int32_t raw_canal) {
+    if (canal < 0 || canal >= HX711_NUM_CANALES) {
+        return 0;
+    }
+    portENTER_CRITICAL(&hx711_canales_spinlock);
+    int32_t ganancia = canales_cal.ganancia_q16[canal];
+    int32_t cero = canales_cal.cero[canal];
+    portEXIT_CRITICAL(&hx711_canales_spinlock);
+
+    const hx711_cal_fija_t *cal = &cal_fija[atomic_load_explicit(&cal_fija_activa, memory_order_acquire)];
+    int64_t x = (((int64_t)raw_canal - cero) * ganancia) >> 16;
+    // |x| <= 2^32 y |mult| < 2^30: el producto cabe en un int64 (el resultado se satura igual)
+    const int64_t x_max = (int64_t)1 << 32;
+    if (x > x_max) x = x_max;
+    if (x < -x_max) x = -x_max;
+    int64_t producto = x * cal->mult;
+    if (cal->shift > 0) {
+        producto += (int64_t)1 << (cal->shift - 1);
+    }
+    return hx711_saturar_i32(producto >> cal->shift);
+}
+
 float hx711_leer_peso(void) {
     int32_t raw_value;
-    double voltage_v;
-    float peso_kg;
     
-    if (hx711_read(&hx711, &raw_value, &voltage_v) == 0) {
-        peso_kg = (raw_value - offset) / scale;
-        return peso_kg;
+    if (hx711_leer_raw(&raw_value) == ESP_OK) {
+        return hx711_calcular_peso(raw_value);
     } else {
         ESP_LOGE(HX711_TAG, "Error al leer datos del HX711");
         return -999.0f; // Valor de error
     }
 }
 
+static int hx711_comparar_int32(const void *a, const void *b) {
+    int32_t x = *(const int32_t *)a;
+    int32_t y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Sumas de desvíos respecto del centro: con int64 la media y la varianza son
+// exactas y no desbordan aunque el promedio dure todo el presupuesto
+typedef struct {
+    int32_t centro;                     // Mediana de la semilla
+    int64_t umbral;                     // Desvío máximo aceptado (cuentas)
+    int64_t suma;
+    int64_t suma_cuad;
+    int64_t suma_canal[HX711_NUM_CANALES];
+    uint32_t n;
+    uint32_t descartadas;
+} hx711_acumulador_t;
+
+static void hx711_acumular(hx711_acumulador_t *acc, int32_t raw, const int32_t raw_canal[HX711_NUM_CANALES]) {
+    int64_t d = (int64_t)raw - acc->centro;
+    if (d > acc->umbral || d < -acc->umbral) {
+        acc->descartadas++;
+        return;
+    }
+    acc->suma += d;
+    acc->suma_cuad += d * d;
+    for (int c = 0; c < HX711_NUM_CANALES; c++) {
+        acc->suma_canal[c] += raw_canal[c];
+    }
+    acc->n++;
+}
+
+/**
+ * @brief Promedio con terminación estadística (tara y puntos de calibración)
+ *
+ * Lee sin esperas extra, así que avanza a la tasa de conversión del HX711
+ * (compartida con la tarea de muestreo). La mediana y la MAD de las primeras
+ * HX711_PROMEDIO_SEMILLA lecturas fijan el centro y la escala del filtro de
+ * atípicos; a partir de ahí termina en cuanto el error estándar de la media
+ * baja de HX711_PROMEDIO_ERROR_CUENTAS o vence HX711_PROMEDIO_MAX_MS.
+ *
+ * @param res Media, precisión alcanzada y contadores
+ * @return ESP_OK con al menos HX711_PROMEDIO_SEMILLA muestras aceptadas, ESP_FAIL si no
+ */
+static esp_err_t hx711_promediar_lecturas(hx711_promedio_t *res) {
+    int32_t semilla[HX711_PROMEDIO_SEMILLA];
+    int32_t semilla_canal[HX711_PROMEDIO_SEMILLA][HX711_NUM_CANALES];
+    hx711_acumulador_t acc = { .umbral = INT32_MAX };
+    uint32_t leidas = 0;
+    uint32_t fallos = 0;
+    double varianza = 0.0;
+    double ee = INFINITY;
+
+    memset(res, 0, sizeof(*res));
+    int64_t t_inicio = esp_timer_get_time();
+    uint32_t transcurrido_ms = 0;
+
+    while (transcurrido_ms < HX711_PROMEDIO_MAX_MS) {
+        int32_t raw_value;
+        int32_t raw_canal[HX711_NUM_CANALES];
+        esp_err_t err = hx711_leer_raw_canales(&raw_value, raw_canal);
+        transcurrido_ms = (uint32_t)((esp_timer_get_time() - t_inicio) / 1000);
+        if (err != ESP_OK) {
+            if (++fallos > HX711_PROMEDIO_SEMILLA) {
+                break;
+            }
+            continue;
+        }
+
+        if (leidas < HX711_PROMEDIO_SEMILLA) {
+            semilla[leidas] = raw_value;
+            memcpy(semilla_canal[leidas], raw_canal, sizeof(raw_canal));
+            if (++leidas < HX711_PROMEDIO_SEMILLA) {
+                continue;
+            }
+            // Centro y escala robustos; después la semilla se acumula como el resto
+            int32_t ordenadas[HX711_PROMEDIO_SEMILLA];
+            memcpy(ordenadas, semilla, sizeof(semilla));
+            qsort(ordenadas, HX711_PROMEDIO_SEMILLA, sizeof(int32_t), hx711_comparar_int32);
+            acc.centro = ordenadas[HX711_PROMEDIO_SEMILLA / 2];
+            for (int i = 0; i < HX711_PROMEDIO_SEMILLA; i++) {
+                ordenadas[i] = abs(semilla[i] - acc.centro);
+            }
+            qsort(ordenadas, HX711_PROMEDIO_SEMILLA, sizeof(int32_t), hx711_comparar_int32);
+            // 1.4826 * MAD estima sigma; piso de 2 cuentas para señales casi sin ruido
+            int64_t sigma = ((int64_t)ordenadas[HX711_PROMEDIO_SEMILLA / 2] * 1483 + 999) / 1000;
+            acc.umbral = HX711_PROMEDIO_K_ATIPICO * (sigma > 2 ? sigma : 2);
+            for (int i = 0; i < HX711_PROMEDIO_SEMILLA; i++) {
+                hx711_acumular(&acc, semilla[i], semilla_canal[i]);
+            }
+        } else {
+            hx711_acumular(&acc, raw_value, raw_canal);
+        }
+
+        if (acc.n >= 2) {
+            varianza = ((double)acc.suma_cuad - (double)acc.suma * acc.suma / acc.n) / (acc.n - 1);
+            if (varianza < 0.0) varianza = 0.0;
+            ee = sqrt(varianza / acc.n);
+        }
+        comandos_publicar_avance((int)(transcurrido_ms * 100 / HX711_PROMEDIO_MAX_MS), "leyendo HX711");
+        if (acc.n >= HX711_PROMEDIO_MIN_MUESTRAS && ee <= HX711_PROMEDIO_ERROR_CUENTAS) {
+            res->objetivo_alcanzado = true;
+            break;
+        }
+    }
+
+    res->duracion_ms = (uint32_t)((esp_timer_get_time() - t_inicio) / 1000);
+    res->aceptadas = (uint16_t)(acc.n > UINT16_MAX ? UINT16_MAX : acc.n);
+    res->descartadas = (uint16_t)(acc.descartadas > UINT16_MAX ? UINT16_MAX : acc.descartadas);
+    if (acc.n < HX711_PROMEDIO_SEMILLA) {
+        ESP_LOGE(HX711_TAG, "Promedio fallido: %u aceptadas, %u descartadas, %u errores de lectura",
+                 (unsigned)acc.n, (unsigned)acc.descartadas, (unsigned)fallos);
+        return ESP_FAIL;
+    }
+    // Media = centro + suma/n redondeada al entero más cercano
+    int64_t mitad = acc.n / 2;
+    int64_t desvio = (acc.suma >= 0) ? (acc.suma + mitad) / acc.n : -((-acc.suma + mitad) / acc.n);
+    res->media = (int32_t)(acc.centro + desvio);
+    for (int c = 0; c < HX711_NUM_CANALES; c++) {
+        res->media_canal[c] = (int32_t)(acc.suma_canal[c] / (int64_t)acc.n);
+    }
+    res->desviacion = (float)sqrt(varianza);
+    res->error_estandar = (float)ee;
+    ESP_LOGI(HX711_TAG, "Promedio %d ± %.1f cuentas (σ %.1f, %u muestras, %u descartadas, %u ms%s)",
+             (int)res->media, res->error_estandar, res->desviacion, (unsigned)res->aceptadas,
+             (unsigned)res->descartadas, (unsigned)res->duracion_ms,
+             res->objetivo_alcanzado ? "" : ", presupuesto agotado");
+    return ESP_OK;
+}
+
+/**
+ * @brief Ajuste por mínimos cuadrados que pasa por el cero calibrado
+ *
+ * Modelo: kg = b1*x + b2*x², con x = raw - offset. Con menos de dos puntos
+ * con carga el modelo cuadrático no está determinado y se usa el lineal.
+ * Rellena scale (= 1/b1), c2 (= b2) y los residuos de cada punto.
+ */
+static esp_err_t hx711_ajustar_modelo(hx711_cal_blob_t *cal, bool cuadratico) {
+    double sxx = 0, sx3 = 0, sx4 = 0, sxy = 0, sx2y = 0;
+    int con_carga = 0;
+    for (uint8_t i = 0; i < cal->num_puntos; i++) {
+        double x = (double)(cal->puntos[i].raw - cal->offset);
+        double y = cal->puntos[i].masa_kg;
+        sxx += x * x;
+        sx3 += x * x * x;
+        sx4 += x * x * x * x;
+        sxy += x * y;
+        sx2y += x * x * y;
+        if (cal->puntos[i].masa_kg != 0.0f) {
+            con_carga++;
+        }
+    }
+    if (con_carga == 0 || sxx == 0.0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    double b1 = sxy / sxx;
+    double b2 = 0.0;
+    cal->modelo = HX711_CAL_LINEAL;
+    if (cuadratico && con_carga >= 2) {
+        double det = sxx * sx4 - sx3 * sx3;
+        if (fabs(det) > 1e-12 * sxx * sx4) {
+            b1 = (sxy * sx4 - sx2y * sx3) / det;
+            b2 = (sxx * sx2y - sx3 * sxy) / det;
+            cal->modelo = HX711_CAL_CUADRATICO;
+        }
+    }
+    if (b1 == 0.0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    cal->scale = (float)(1.0 / b1);
+    cal->c2 = (float)b2;
+
+    double suma_cuad = 0.0;
+    float max_residuo = 0.0f;
+    for (uint8_t i = 0; i < cal->num_puntos; i++) {
+        double x = (double)(cal->puntos[i].raw - cal->offset);
+        float r = (float)(cal->puntos[i].masa_kg - (b1 * x + b2 * x * x));
+        cal->puntos[i].residuo_kg = r;
+        suma_cuad += (double)r * r;
+        if (fabsf(r) > max_residuo) max_residuo = fabsf(r);
+    }
+    cal->residuo_rms_kg = (float)sqrt(suma_cuad / cal->num_puntos);
+    cal->residuo_max_kg = max_residuo;
+    return ESP_OK;
+}
+
 void hx711_calibrar_inicial(void) {
     ESP_LOGI(HX711_TAG, "Iniciando calibración HX711...");
     
-
-    // Tomar múltiples lecturas para el offset
-    int32_t sum = 0;
-    const int num_readings = 10;
-    
-    ESP_LOGI(HX711_TAG, "Tomando %d lecturas para calcular offset...", num_readings);
+    // Promediar hasta alcanzar el error objetivo (o agotar el presupuesto)
+    hx711_promedio_t prom;
+    ESP_LOGI(HX711_TAG, "Promediando lecturas para calcular offset (objetivo ±%d cuentas, máx %d ms)...",
+             HX711_PROMEDIO_ERROR_CUENTAS, HX711_PROMEDIO_MAX_MS);
+    if (hx711_promediar_lecturas(&prom) != ESP_OK) {
+        ESP_LOGE(HX711_TAG, "Error al leer el HX711 durante la calibración");
+        return;
+    }
+    int32_t cero = prom.media;
+    int32_t *cero_canal = prom.media_canal;
     
+    // Nueva sesión: el punto de cero reemplaza los puntos anteriores. La
+    // calibración en uso (y la de NVS) sigue igual hasta que un "8" ajuste y guarde.
+    hx711_calibracion_tomar(portMAX_DELAY);
+    sesion = calibracion;
+    sesion.offset = cero;
+    sesion.c2 = 0.0f;
+    sesion.modelo = HX711_CAL_LINEAL;
+    sesion.num_puntos = 1;
+    sesion.puntos[0] = (hx711_cal_punto_t){ .raw = cero, .masa_kg = 0.0f, .residuo_kg = 0.0f };
+    sesion_generacion++;
+    hx711_calibracion_soltar();
+    ESP_LOGI(HX711_TAG, "Offset calculado: %d", (int)cero);
 
-    
-    for (int i = 0; i < num_readings; i++) {
-        int32_t raw_value;
-        double voltage_v;
-        if (hx711_read(&hx711, &raw_value, &voltage_v) == 0) {
-            sum += raw_value;
-            ESP_LOGI(HX711_TAG, "Lectura %d: %d", i + 1, (int)raw_value);
+    // Cero de cada celda para el desglose por canal
+    hx711_canales_cal_t canales;
+    portENTER_CRITICAL(&hx711_canales_spinlock);
+    memcpy(canales_cal.cero, cero_canal, sizeof(prom.media_canal));
+    canales = canales_cal;
+    portEXIT_CRITICAL(&hx711_canales_spinlock);
+    if (HX711_NUM_CANALES > 1) {
+        if (hx711_guardar_canales(&canales) != ESP_OK) {
+            ESP_LOGE(HX711_TAG, "Error al guardar el cero de los canales");
+        }
+        for (int c = 0; c < HX711_NUM_CANALES; c++) {
+            ESP_LOGI(HX711_TAG, "Cero canal %d: %d", c, (int)cero_canal[c]);
         }
-        vTaskDelay(500 / portTICK_PERIOD_MS);
     }
-    
-    offset = sum / num_readings;
-    ESP_LOGI(HX711_TAG, "Offset calculado: %d", (int)offset);
     esp_mqtt_client_publish(mqtt_client, "esp32/halo/conection", "ON", 0, 1, 0);
     
     // Enviar confirmación de offset calculado
     if (mqtt_is_connected()) {
         char mensaje[256];
-        snprintf(mensaje, sizeof(mensaje), "Offset calculado exitosamente: %d", (int)offset);
+        snprintf(mensaje, sizeof(mensaje), "Offset calculado exitosamente: %d ± %.1f cuentas (%u muestras, %u descartadas, %u ms%s)",
+                 (int)cero, prom.error_estandar, (unsigned)prom.aceptadas, (unsigned)prom.descartadas,
+                 (unsigned)prom.duracion_ms, prom.objetivo_alcanzado ? "" : ", sin alcanzar el objetivo");
         esp_mqtt_client_publish(mqtt_client, "esp32/halo/status", mensaje, 0, 1, 0);
     }
     
@@ -464,53 +1433,114 @@ void hx711_calibrar_inicial(void) {
         esp_mqtt_client_publish(mqtt_client, "esp32/halo/conection", "ON1", 0, 1, 0);
     }
     
-    // La función termina aquí y espera el comando "8"
+    // La función termina aquí y espera el comando "8 <kg>" (uno por punto)
     // El resto de la calibración se ejecutará cuando se reciba el comando
 }
 
-void hx711_continuar_calibracion_peso(void) {
-    ESP_LOGI(HX711_TAG, "PASO 2: Continuando calibración con peso ");
-    
+/**
+ * @brief Agrega un punto con masa conocida y reajusta el modelo
+ *
+ * @param masa_kg Masa apoyada sobre la celda
+ * @param cuadratico true para ajustar kg = x/scale + c2*x² (requiere 2+ puntos con carga)
+ */
+void hx711_continuar_calibracion_peso(float masa_kg, bool cuadratico) {
+    char mensaje[256];
+    ESP_LOGI(HX711_TAG, "PASO 2: Agregando punto de calibración con %.3f kg", masa_kg);
 
-    // Calcular escala con peso conocido
-    int32_t sum = 0;
-    const int num_readings = 10;
-    ESP_LOGI(HX711_TAG, "Tomando lecturas ...");
-    
-    
-    for (int i = 0; i < num_readings; i++) {
-        int32_t raw_value;
-        double voltage_v;
-        if (hx711_read(&hx711, &raw_value, &voltage_v) == 0) {
-            sum += raw_value;
-            ESP_LOGI(HX711_TAG, "Lectura con peso %d: %d", i + 1, (int)raw_value);
+    // Copia de la sesión: el comando 1 la escribe desde task_HX711
+    hx711_cal_blob_t nueva;
+    hx711_calibracion_tomar(portMAX_DELAY);
+    if (sesion.num_puntos == 0) {
+        // Sin sesión iniciada (p. ej. tras reiniciar) se sigue con la calibración
+        // en uso, o se parte del cero actual si no tiene puntos
+        sesion = calibracion;
+        if (sesion.num_puntos == 0) {
+            sesion.offset = offset;
+            sesion.puntos[0] = (hx711_cal_punto_t){ .raw = offset, .masa_kg = 0.0f, .residuo_kg = 0.0f };
+            sesion.num_puntos = 1;
         }
-        vTaskDelay(500 / portTICK_PERIOD_MS);
     }
-    
-    int32_t raw_with_weight = sum / num_readings;
-    scale = (float)(raw_with_weight - offset) / 1.0f; // 1 kg conocido
-    
-    
+    nueva = sesion;
+    uint32_t generacion = sesion_generacion;
+    hx711_calibracion_soltar();
 
-    
-    // Guardar calibración en NVS
-    if (hx711_guardar_calibracion() == ESP_OK) {
-        // Enviar confirmación de guardado exitoso
+    if (nueva.num_puntos >= HX711_CAL_MAX_PUNTOS) {
+        ESP_LOGE(HX711_TAG, "Máximo de %d puntos alcanzado; reinicie con el comando 1", HX711_CAL_MAX_PUNTOS);
         if (mqtt_is_connected()) {
-            char mensaje[256];
-            snprintf(mensaje, sizeof(mensaje), "Calibración guardada exitosamente en memoria");
+            snprintf(mensaje, sizeof(mensaje), "Error: máximo de %d puntos de calibración (envíe 1 para reiniciar)", HX711_CAL_MAX_PUNTOS);
             esp_mqtt_client_publish(mqtt_client, "esp32/halo/status", mensaje, 0, 1, 0);
         }
-    } else {
+        return;
+    }
+
+    hx711_promedio_t prom;
+    ESP_LOGI(HX711_TAG, "Promediando lecturas ...");
+    if (hx711_promediar_lecturas(&prom) != ESP_OK) {
+        ESP_LOGE(HX711_TAG, "Error al leer el HX711 durante la calibración");
+        return;
+    }
+    int32_t raw_with_weight = prom.media;
+
+    nueva.puntos[nueva.num_puntos++] = (hx711_cal_punto_t){ .raw = raw_with_weight, .masa_kg = masa_kg };
+    if (hx711_ajustar_modelo(&nueva, cuadratico) != ESP_OK) {
+        ESP_LOGE(HX711_TAG, "No se pudo ajustar el modelo (punto sin carga o lectura igual al cero)");
+        if (mqtt_is_connected()) {
+            esp_mqtt_client_publish(mqtt_client, "esp32/halo/status",
+                                    "Error: punto de calibración inválido", 0, 1, 0);
+        }
+        return;
+    }
+
+    ESP_LOGI(HX711_TAG, "Modelo %s con %u puntos - Scale: %.2f, C2: %g, RMS: %.1f g, max: %.1f g",
+             nueva.modelo == HX711_CAL_CUADRATICO ? "cuadrático" : "lineal",
+             (unsigned)nueva.num_puntos, nueva.scale, nueva.c2,
+             nueva.residuo_rms_kg * 1000.0f, nueva.residuo_max_kg * 1000.0f);
+
+    // Un comando 1 durante el promedio abrió otra sesión: este punto ya no vale
+    hx711_calibracion_tomar(portMAX_DELAY);
+    if (generacion != sesion_generacion) {
+        hx711_calibracion_soltar();
+        ESP_LOGW(HX711_TAG, "La sesión cambió durante el promedio; punto descartado");
+        if (mqtt_is_connected()) {
+            esp_mqtt_client_publish(mqtt_client, "esp32/halo/status",
+                                    "Error: la sesión de calibración cambió (comando 1); repita el punto", 0, 1, 0);
+        }
+        return;
+    }
+
+    // Primero NVS: lo que se usa nunca difiere de lo guardado
+    if (hx711_guardar_calibracion_blob(&nueva) != ESP_OK) {
+        hx711_calibracion_soltar();
         ESP_LOGE(HX711_TAG, "Error al guardar calibración en NVS");
+        if (mqtt_is_connected()) {
+            esp_mqtt_client_publish(mqtt_client, "esp32/halo/status",
+                                    "Error: no se pudo guardar la calibración; se mantiene la anterior", 0, 1, 0);
+        }
+        return;
+    }
+    sesion = nueva;
+    calibracion = nueva;
+    offset = calibracion.offset;
+    scale = calibracion.scale;
+    hx711_actualizar_calibracion_fija();
+    autocero_reiniciar(calibracion.offset);
+    hx711_calibracion_soltar();
+
+    // Enviar confirmación de guardado exitoso
+    if (mqtt_is_connected()) {
+        snprintf(mensaje, sizeof(mensaje),
+                 "Calibración guardada: punto %u (%.3f kg ± %.2f g, %u muestras%s), modelo %s, residuo RMS %.1f g, max %.1f g",
+                 (unsigned)(nueva.num_puntos - 1), masa_kg,
+                 prom.error_estandar * 1000.0f / fabsf(nueva.scale), (unsigned)prom.aceptadas,
+                 prom.objetivo_alcanzado ? "" : ", sin alcanzar el objetivo",
+                 nueva.modelo == HX711_CAL_CUADRATICO ? "cuadrático" : "lineal",
+                 nueva.residuo_rms_kg * 1000.0f, nueva.residuo_max_kg * 1000.0f);
+        esp_mqtt_client_publish(mqtt_client, "esp32/halo/status", mensaje, 0, 1, 0);
     }
     
     
     if (mqtt_is_connected()) {
         esp_mqtt_client_publish(mqtt_client, "esp32/halo/conection", "ON2", 0, 1, 0);
     }
-    
-
 }
 
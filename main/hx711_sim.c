@@ -0,0 +1,169 @@
+#include "../include/hx711_sim.h"
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+// Modelo del HX711:
+//  - Cada 1/SPS segundos termina una conversión y DOUT baja.
+//  - Cada flanco de subida de SCK desplaza un bit (MSB primero).
+//  - El pulso 25 finaliza la trama: DOUT sube y arranca la siguiente
+//    conversión; los pulsos 26/27 solo seleccionan ganancia.
+#define SIM_PERIODO_US      (1000000LL / CONFIG_HX711_SIM_SPS)
+#define SIM_PULSOS_TRAMA    25
+
+static struct {
+    int64_t t_listo_us;         // Instante en que la conversión en curso queda lista
+    uint8_t sck;                // Nivel actual de SCK
+    uint8_t pulsos;             // Flancos de subida desde que DOUT bajó
+    uint32_t dato;              // Conversión latcheada (24 bits, complemento a 2)
+    int32_t valor;              // Valor base de las conversiones
+    int32_t ruido;              // Ruido pico en cuentas
+    uint32_t semilla;           // Estado del generador pseudoaleatorio
+    uint32_t conversiones;      // Tramas completas entregadas
+} sim = {
+    .t_listo_us = 0,
+    .valor = 8388,
+    .ruido = 50,
+    .semilla = 0x1234567u,
+};
+
+static uint32_t sim_aleatorio(void) {
+    // xorshift32: suficiente para ruido de prueba
+    sim.semilla ^= sim.semilla << 13;
+    sim.semilla ^= sim.semilla >> 17;
+    sim.semilla ^= sim.semilla << 5;
+    return sim.semilla;
+}
+
+static uint32_t sim_generar_conversion(void) {
+    int32_t v = sim.valor;
+    if (sim.ruido > 0) {
+        v += (int32_t)(sim_aleatorio() % (uint32_t)(2 * sim.ruido + 1)) - sim.ruido;
+    }
+    if (v > 0x7FFFFF) v = 0x7FFFFF;
+    if (v < -0x800000) v = -0x800000;
+    return (uint32_t)v & 0xFFFFFFu;
+}
+
+// Reinicia la trama cuando la siguiente conversión ya está lista
+static void sim_actualizar(int64_t ahora) {
+    if (sim.pulsos >= SIM_PULSOS_TRAMA && ahora >= sim.t_listo_us) {
+        sim.pulsos = 0;
+    }
+}
+
+static uint8_t sim_bus_init(void) {
+    sim.pulsos = 0;
+    sim.sck = 0;
+    sim.t_listo_us = esp_timer_get_time() + SIM_PERIODO_US;
+    return 0;
+}
+
+static uint8_t sim_bus_deinit(void) {
+    return 0;
+}
+
+static uint8_t sim_bus_read(uint8_t *value) {
+    int64_t ahora = esp_timer_get_time();
+    sim_actualizar(ahora);
+    if (sim.pulsos == 0) {
+        *value = (ahora >= sim.t_listo_us) ? 0 : 1;
+    } else if (sim.pulsos <= 24) {
+        *value = (uint8_t)((sim.dato >> (24 - sim.pulsos)) & 0x01);
+    } else {
+        *value = 1;
+    }
+    return 0;
+}
+
+static uint8_t sim_clock_init(void) {
+    sim.sck = 0;
+    return 0;
+}
+
+static uint8_t sim_clock_deinit(void) {
+    return 0;
+}
+
+static uint8_t sim_clock_write(uint8_t value) {
+    int64_t ahora = esp_timer_get_time();
+    sim_actualizar(ahora);
+    if (value && !sim.sck && (sim.pulsos > 0 || ahora >= sim.t_listo_us)) {
+        sim.pulsos++;
+        if (sim.pulsos == 1) {
+            sim.dato = sim_generar_conversion();
+        } else if (sim.pulsos == SIM_PULSOS_TRAMA) {
+            sim.t_listo_us = ahora + SIM_PERIODO_US;
+            sim.conversiones++;
+        }
+    }
+    sim.sck = value ? 1 : 0;
+    return 0;
+}
+
+static void sim_delay_us(uint32_t us) {
+    // Sin restricciones eléctricas: no hace falta esperar
+    (void)us;
+}
+
+static void sim_enable_irq(void) {
+}
+
+static void sim_disable_irq(void) {
+}
+
+static void sim_debug_print(const char *const fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+/**
+ * @brief Duerme hasta que la conversión simulada esté lista
+ *
+ * @param timeout_ms Tiempo máximo de espera
+ * @return 0 si hay dato listo, 1 si venció el timeout
+ */
+static uint8_t sim_wait_ready(uint32_t timeout_ms) {
+    int64_t limite = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    while (1) {
+        int64_t ahora = esp_timer_get_time();
+        sim_actualizar(ahora);
+        if (sim.pulsos == 0 && ahora >= sim.t_listo_us) {
+            hx711_stats_registrar_despertar((uint32_t)(ahora - sim.t_listo_us));
+            return 0;
+        }
+        if (ahora >= limite) {
+            return 1;
+        }
+        int64_t restante_us = sim.t_listo_us - ahora;
+        TickType_t ticks = pdMS_TO_TICKS((uint32_t)((restante_us + 999) / 1000));
+        vTaskDelay(ticks > 0 ? ticks : 1);
+    }
+}
+
+void hx711_sim_link(hx711_handle_t *handle) {
+    DRIVER_HX711_LINK_BUS_INIT(handle, sim_bus_init);
+    DRIVER_HX711_LINK_BUS_DEINIT(handle, sim_bus_deinit);
+    DRIVER_HX711_LINK_BUS_READ(handle, sim_bus_read);
+    DRIVER_HX711_LINK_CLOCK_INIT(handle, sim_clock_init);
+    DRIVER_HX711_LINK_CLOCK_DEINIT(handle, sim_clock_deinit);
+    DRIVER_HX711_LINK_CLOCK_WRITE(handle, sim_clock_write);
+    DRIVER_HX711_LINK_DELAY_US(handle, sim_delay_us);
+    DRIVER_HX711_LINK_ENABLE_IRQ(handle, sim_enable_irq);
+    DRIVER_HX711_LINK_DISABLE_IRQ(handle, sim_disable_irq);
+    DRIVER_HX711_LINK_DEBUG_PRINT(handle, sim_debug_print);
+    DRIVER_HX711_LINK_WAIT_READY(handle, sim_wait_ready);
+}
+
+void hx711_sim_set_valor(int32_t raw, int32_t ruido) {
+    sim.valor = raw;
+    sim.ruido = ruido < 0 ? 0 : ruido;
+}
+
+uint32_t hx711_sim_get_conversiones(void) {
+    return sim.conversiones;
+}
@@ -25,9 +25,12 @@ void inicializar_sistema() {
     }
     ESP_ERROR_CHECK(ret);
 
-    restaurar_ultima_muestra_enviada();
+    muestras_bin_cursor_restaurar();
+    recientes_init();
     restaurar_horario_envio();
     restaurar_muestreo_ms();
+    filtros_init();
+    registro_init();
     
     // Inicializar hardware y red
     ESP_ERROR_CHECK(esp_netif_init());
@@ -36,6 +39,7 @@ void inicializar_sistema() {
     init_RTC();
     init_battery();
     init_HX711();
+    autocero_init();
     sdcard_init();
     wifi_init_sta();
 
@@ -141,76 +145,73 @@ bool hay_datos_pendientes_envio(void) {
     
     if (!es_hora || !no_enviado_hoy) return false;
     
-    // Verificar datos en SD
-    FILE *f = fopen("/sdcard/pesos.csv", "r");
-    if (!f) return false;
-    
-    char line[128];
-    int count = 0;
-    while (fgets(line, sizeof(line), f)) {
-        if (!strstr(line, "Fecha")) count++;
-        if (count > sistema.envio.ultima_muestra_enviada) {
-            fclose(f);
-            return true;
-        }
-    }
-    fclose(f);
-    return false;
+    // Contador de muestras escritas frente al cursor de envío: sin leer la SD
+    return muestras_bin_pendientes() > 0;
 }
 
 
 
-void guardar_ultima_muestra_enviada() {
-    nvs_handle_t nvs_handle;
-    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) == ESP_OK) {
-        nvs_set_u32(nvs_handle, NVS_KEY_ULTIMA, sistema.envio.ultima_muestra_enviada);
-        nvs_commit(nvs_handle);
-        nvs_close(nvs_handle);
-        ESP_LOGI(TAG, "Guardado ultima muestra: %u", (unsigned int)sistema.envio.ultima_muestra_enviada);
+/**
+ * @brief Últimas n muestras, la más vieja primero
+ *
+ * Las más nuevas salen de la caché en RAM (recientes.h); la SD solo se lee si
+ * se piden más de las que guarda, y solo lo anterior a la caché: búsqueda
+ * binaria por epoch y lectura directa, sin recorrer el archivo.
+ */
+int leer_ultimas_muestras_sd(int n, float *pesos, struct tm *tiempos) {
+    if (n <= 0) {
+        return 0;
     }
-}
+    uint32_t primera = 0;
+    uint32_t fin = recientes_ventana(&primera);
+    uint32_t desde_cache = (fin - primera > (uint32_t)n) ? fin - (uint32_t)n : primera;
+    int faltan = n - (int)(fin - desde_cache);
 
-int leer_ultimas_muestras_sd(int n, float *pesos, struct tm *tiempos) {
-    FILE *f = fopen("/sdcard/pesos.csv", "r");
-    if (!f) return 0;
-    
-    // Contar total de líneas
-    char line[128];
-    int total = 0;
-    while (fgets(line, sizeof(line), f)) {
-        if (!strstr(line, "Fecha")) total++;
+    // Caché al final de la salida; se corre hacia adelante si la SD aporta menos
+    muestra_bin_t reg;
+    int en_cache = 0;
+    uint32_t epoch_limite = UINT32_MAX;
+    for (uint32_t s = desde_cache; s != fin; s++) {
+        if (!recientes_leer(s, &reg)) {
+            continue;               // Ya reemplazada por una muestra nueva
+        }
+        if (en_cache == 0) {
+            epoch_limite = reg.epoch;
+        }
+        time_t t = (time_t)reg.epoch;
+        pesos[faltan + en_cache] = (float)reg.peso_mg * 1e-6f;
+        localtime_r(&t, &tiempos[faltan + en_cache]);
+        en_cache++;
     }
-    
-    // Leer últimas n muestras
-    rewind(f);
-    int skip = total > n ? total - n : 0;
+
     int idx = 0;
-    while (fgets(line, sizeof(line), f) && idx < n) {
-        if (strstr(line, "Fecha")) continue;
-        if (skip-- > 0) continue;
-        
-        int y, m, d, h, min, s;
-        float p;
-        if (sscanf(line, "%d-%d-%d,%d:%d:%d,%f", &y, &m, &d, &h, &min, &s, &p) == 7) {
-            pesos[idx] = p;
-            tiempos[idx] = (struct tm){.tm_year=y-1900, .tm_mon=m-1, .tm_mday=d, .tm_hour=h, .tm_min=min, .tm_sec=s};
+    if (faltan > 0 && sistema.mutex_sd != NULL &&
+        xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(SISTEMA_TIMEOUT_MUTEX)) == pdTRUE) {
+        uint32_t total = muestras_bin_contar();
+        uint32_t hasta = (epoch_limite == UINT32_MAX) ? total
+                                                      : muestras_bin_buscar_epoch(0, total, epoch_limite - 1, NULL);
+        uint32_t desde = (hasta > (uint32_t)faltan) ? hasta - (uint32_t)faltan : 0;
+        for (uint32_t i = desde; i < hasta && idx < faltan; i++) {
+            size_t leidos = 0;
+            if (muestras_bin_leer(i, &reg, 1, &leidos) != ESP_OK || leidos == 0) {
+                break;
+            }
+            if (!muestras_bin_valido(&reg)) {
+                continue;
+            }
+            time_t t = (time_t)reg.epoch;
+            pesos[idx] = (float)reg.peso_mg * 1e-6f;
+            localtime_r(&t, &tiempos[idx]);
             idx++;
         }
+        xSemaphoreGive(sistema.mutex_sd);
+        recientes_contar_sd((uint32_t)idx);
     }
-    fclose(f);
-    return idx;
-}
-
-void restaurar_ultima_muestra_enviada() {
-    nvs_handle_t nvs_handle;
-    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK) {
-        uint32_t valor;
-        if (nvs_get_u32(nvs_handle, NVS_KEY_ULTIMA, &valor) == ESP_OK) {
-            sistema.envio.ultima_muestra_enviada = valor;
-            ESP_LOGI(TAG, "Recuperado ultima muestra: %u", (unsigned int)valor);
-        }
-        nvs_close(nvs_handle);
+    if (idx < faltan && en_cache > 0) {
+        memmove(&pesos[idx], &pesos[faltan], en_cache * sizeof(pesos[0]));
+        memmove(&tiempos[idx], &tiempos[faltan], en_cache * sizeof(tiempos[0]));
     }
+    return idx + en_cache;
 }
 
 void guardar_horario_envio() {
@@ -0,0 +1,122 @@
+#include "../include/metricas.h"
+#include "../include/HALO.h"
+
+static const char *METRICAS_TAG = "METRICAS";
+
+/**
+ * @brief Construye el JSON de métricas (adquisición y colas de muestras)
+ * @return Bytes escritos (sin contar el terminador) o negativo si no entra en el buffer
+ */
+int metricas_generar_json(char *buffer, size_t tam) {
+    hx711_stats_t hx;
+    muestreo_stats_t mu;
+    filtros_stats_t fi;
+    filtros_config_t fcfg;
+    char cadena[FILTROS_TEXTO_MAX];
+    registro_stats_t re;
+    autocero_stats_t ac;
+    comandos_stats_t co;
+    sdcard_stats_t sd;
+    muestras_bin_stats_t mb;
+    agregados_stats_t ag;
+    recientes_stats_t rc;
+    espacio_t es;
+    espacio_stats_t est;
+    histograma_t jitter;
+    char jitter_texto[96];
+    hx711_get_stats(&hx);
+    muestreo_get_stats(&mu);
+    filtros_get_stats(&fi);
+    filtros_get_config(&fcfg);
+    filtros_config_a_texto(&fcfg, cadena, sizeof(cadena));
+    registro_get_stats(&re);
+    autocero_get_stats(&ac);
+    comandos_get_stats(&co);
+    sdcard_get_stats(&sd);
+    muestras_bin_get_stats(&mb);
+    agregados_get_stats(&ag);
+    recientes_get_stats(&rc);
+    espacio_get(&es);
+    espacio_get_stats(&est);
+    uint32_t recientes_primera = 0;
+    uint32_t recientes_fin = recientes_ventana(&recientes_primera);
+    task_HX711_get_jitter(&jitter);
+    histograma_a_texto(&jitter, jitter_texto, sizeof(jitter_texto));
+    // Compresión frente al registro periódico, en centésimas (100 = sin ahorro)
+    uint32_t compresion = (re.guardadas > 0) ? (uint32_t)((uint64_t)re.equivalentes * 100 / re.guardadas) : 0;
+
+    int n = snprintf(buffer, tam,
+        "{\"hx711\":{\"muestras\":%u,\"timeouts\":%u,\"despertar_us\":%u,\"despertar_max_us\":%u,\"cpu_us\":%u,\"cpu_max_us\":%u},"
+        "\"muestreo\":{\"muestras\":%u,\"errores\":%u,"
+        "\"cola_registro\":{\"cap\":%u,\"ocup\":%u,\"max\":%u,\"desbordes\":%u},"
+        "\"cola_vivo\":{\"cap\":%u,\"ocup\":%u,\"max\":%u,\"desbordes\":%u}},"
+        "\"filtros\":{\"cadena\":\"%s\",\"entradas\":%u,\"salidas\":%u},"
+        "\"registro\":{\"evaluadas\":%u,\"guardadas\":%u,\"por_banda\":%u,\"por_latido\":%u,\"estables\":%u,\"equivalentes\":%u,\"compresion_x100\":%u,"
+        "\"jitter_us\":%u,\"jitter_max_us\":%u,\"jitter_hist\":%s},"
+        "\"autocero\":{\"correccion\":%d,\"correccion_mg\":%d,\"ajustes\":%u,\"saturaciones\":%u,\"guardados\":%u},"
+        "\"comandos\":{\"encolados\":%u,\"rechazados\":%u,\"completados\":%u,\"manejador_us\":%u,\"manejador_max_us\":%u,\"ejecucion_us\":%u,\"ejecucion_max_us\":%u},"
+        "\"sd\":{\"lineas\":%u,\"perdidas\":%u,\"bytes\":%u,\"escrituras\":%u,\"syncs\":%u,\"aperturas\":%u,\"vaciado_us\":%u,\"vaciado_max_us\":%u,"
+        "\"reservadas\":%u,\"reserva_ocup\":%u,\"reserva_max\":%u,\"cortes\":%u,\"remontajes\":%u,\"corte_ms\":%u,\"corte_max_ms\":%u,"
+        "\"recuperacion_us\":%u,\"recuperacion_revisados\":%u,\"recuperacion_recortados\":%u,"
+        "\"preasignadas\":%u,\"preasignacion_us\":%u,\"preasignaciones_contiguas\":%u},"
+        "\"envio\":{\"pendientes\":%u,\"segmento\":%u,\"secuencia\":%u,\"cursor_nvs\":%u},"
+        "\"agregados\":{\"muestras\":%u,\"escrituras\":%u,\"descartados\":%u,\"consultas\":%u,\"consulta_us\":%u,\"consulta_max_us\":%u},"
+        "\"recientes\":{\"cap\":%u,\"ocup\":%u,\"restauradas\":%u,\"de_cache\":%u,\"de_sd\":%u},"
+        "\"espacio\":{\"valido\":%d,\"total_kb\":%u,\"libres_kb\":%u,\"cluster\":%u,\"recuento_epoch\":%u,\"restauradas\":%u,"
+        "\"cambios\":%u,\"recuentos\":%u,\"recuento_ms\":%u,\"recuento_max_ms\":%u,\"desvio_clusters\":%d,\"guardados\":%u}}",
+        (unsigned)hx.muestras, (unsigned)hx.timeouts,
+        (unsigned)hx.latencia_despertar_us, (unsigned)hx.latencia_despertar_max_us,
+        (unsigned)hx.cpu_us, (unsigned)hx.cpu_max_us,
+        (unsigned)mu.muestras, (unsigned)mu.errores,
+        (unsigned)mu.colas[MUESTREO_CONSUMIDOR_REGISTRO].capacidad,
+        (unsigned)mu.colas[MUESTREO_CONSUMIDOR_REGISTRO].ocupacion,
+        (unsigned)mu.colas[MUESTREO_CONSUMIDOR_REGISTRO].max_ocupacion,
+        (unsigned)mu.colas[MUESTREO_CONSUMIDOR_REGISTRO].desbordes,
+        (unsigned)mu.colas[MUESTREO_CONSUMIDOR_VIVO].capacidad,
+        (unsigned)mu.colas[MUESTREO_CONSUMIDOR_VIVO].ocupacion,
+        (unsigned)mu.colas[MUESTREO_CONSUMIDOR_VIVO].max_ocupacion,
+        (unsigned)mu.colas[MUESTREO_CONSUMIDOR_VIVO].desbordes,
+        cadena, (unsigned)fi.entradas, (unsigned)fi.salidas,
+        (unsigned)re.evaluadas, (unsigned)re.guardadas, (unsigned)re.por_banda, (unsigned)re.por_latido,
+        (unsigned)re.estables, (unsigned)re.equivalentes, (unsigned)compresion,
+        (unsigned)histograma_media_us(&jitter), (unsigned)jitter.max_us, jitter_texto,
+        (int)ac.correccion, (int)ac.correccion_mg, (unsigned)ac.ajustes,
+        (unsigned)ac.saturaciones, (unsigned)ac.guardados,
+        (unsigned)co.encolados, (unsigned)co.rechazados, (unsigned)co.completados,
+        (unsigned)co.manejador_us, (unsigned)co.manejador_max_us,
+        (unsigned)co.ejecucion_us, (unsigned)co.ejecucion_max_us,
+        (unsigned)sd.lineas, (unsigned)sd.perdidas, (unsigned)sd.bytes, (unsigned)sd.escrituras,
+        (unsigned)sd.syncs, (unsigned)sd.aperturas, (unsigned)sd.vaciado_us, (unsigned)sd.vaciado_max_us,
+        (unsigned)sd.reservadas, (unsigned)sd.reserva_ocupacion, (unsigned)sd.reserva_max,
+        (unsigned)sd.cortes, (unsigned)sd.remontajes, (unsigned)sd.corte_ms, (unsigned)sd.corte_max_ms,
+        (unsigned)mb.recuperacion_us, (unsigned)mb.recuperacion_revisados, (unsigned)mb.recuperacion_recortados,
+        (unsigned)(muestras_bin_asignados() - muestras_bin_registros()), (unsigned)mb.preasignacion_us,
+        (unsigned)mb.preasignaciones_contiguas,
+        (unsigned)muestras_bin_pendientes(), (unsigned)sistema.envio.cursor.segmento,
+        (unsigned)sistema.envio.cursor.secuencia, (unsigned)mb.cursor_guardados,
+        (unsigned)ag.muestras, (unsigned)ag.escrituras, (unsigned)ag.descartados,
+        (unsigned)ag.consultas, (unsigned)ag.consulta_us, (unsigned)ag.consulta_max_us,
+        (unsigned)CONFIG_HALO_RECIENTES_MUESTRAS, (unsigned)(recientes_fin - recientes_primera),
+        (unsigned)rc.restauradas, (unsigned)rc.de_cache, (unsigned)rc.de_sd,
+        (int)es.valido, (unsigned)(es.total_bytes / 1024), (unsigned)(es.libres_bytes / 1024),
+        (unsigned)es.cluster_bytes, (unsigned)es.recuento_epoch, (unsigned)est.restauradas,
+        (unsigned)est.cambios, (unsigned)est.recuentos, (unsigned)est.recuento_ms, (unsigned)est.recuento_max_ms,
+        (int)est.desvio_clusters, (unsigned)est.guardados);
+
+    return (n >= 0 && (size_t)n < tam) ? n : -1;
+}
+
+esp_err_t metricas_publicar(void) {
+    if (!mqtt_is_connected()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    static char json[METRICAS_BUFFER_SIZE];
+    if (metricas_generar_json(json, sizeof(json)) < 0) {
+        ESP_LOGE(METRICAS_TAG, "❌ Buffer de métricas insuficiente");
+        return ESP_ERR_NO_MEM;
+    }
+
+    int msg_id = esp_mqtt_client_publish(mqtt_client, METRICAS_TOPIC, json, 0, 1, 0);
+    return (msg_id >= 0) ? ESP_OK : ESP_FAIL;
+}
@@ -6,6 +6,8 @@
 #include <stdio.h>
 #include <string.h>
 #include "../include/hx711_lib.h"
+#include <esp_timer.h>
+#include <math.h>
 
 
 // =====================================================
@@ -28,9 +30,15 @@ static const char *MQTT_TAG = "MQTT_LIB";
 #define MQTT_TOPIC_COMMAND_OTA          "esp32/command_ota"
 #define MQTT_TOPIC_SET_SCHEDULE         "esp32/set_schedule"
 #define MQTT_TOPIC_SET_TIME             "esp32/set_time"
+#define MQTT_TOPIC_SET_FILTER           "esp32/set_filter"
+#define MQTT_TOPIC_SET_CONFIG           "esp32/set_config"
 #define MQTT_TOPIC_STATUS               "esp32/halo/status"
 #define MQTT_TOPIC_CONECTION            "esp32/halo/conection"
 #define MQTT_TOPIC_WEIGHT_DATA          "esp32/halo/weight_data"
+#define MQTT_TOPIC_LIVE                 "esp32/halo/live"
+#define MQTT_TOPIC_AGREGADOS            "esp32/halo/agregados"
+#define MQTT_TOPIC_RECIENTES            "esp32/halo/recientes"
+#define MQTT_RECIENTES_MAX              8       // Muestras por respuesta del comando 11
 #define MQTT_TOPIC_TEST                 "esp32/test"
 
 
@@ -215,6 +223,20 @@ static esp_err_t mqtt_subscribe_to_topics(void) {
 
     ESP_LOGI(MQTT_TAG, "✅ Suscrito a topic OTA: %s", MQTT_TOPIC_COMMAND_OTA);
 
+    // Suscribirse al topic de configuración de filtros
+    result = esp_mqtt_client_subscribe(mqtt_client, MQTT_TOPIC_SET_FILTER, 0);
+    if (result == -1) {
+        ESP_LOGE(MQTT_TAG, "❌ Error al suscribirse a %s", MQTT_TOPIC_SET_FILTER);
+        return ESP_FAIL;
+    }
+
+    // Suscribirse al topic de configuración clave=valor
+    result = esp_mqtt_client_subscribe(mqtt_client, MQTT_TOPIC_SET_CONFIG, 0);
+    if (result == -1) {
+        ESP_LOGE(MQTT_TAG, "❌ Error al suscribirse a %s", MQTT_TOPIC_SET_CONFIG);
+        return ESP_FAIL;
+    }
+
     // Evitar múltiples publicaciones inmediatas - optimizar
     esp_mqtt_client_publish(mqtt_client, "esp32/halo/conection", "ON", 0, 1, 0);
     
@@ -282,38 +304,20 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event) {
             ESP_LOGI(MQTT_TAG, "✅ Topic procesado: '%s'", topic);
             ESP_LOGI(MQTT_TAG, "✅ Payload procesado: '%s'", data);
             
-            // Procesar comandos MQTT usando constantes definidas
+            // Procesar comandos MQTT usando constantes definidas.
+            // Los comandos y la OTA solo se encolan: el trabajo largo (calibración,
+            // descarga, rollback) corre en la tarea de comandos, no en este manejador.
             if (strcmp(topic, MQTT_TOPIC_COMMAND) == 0) {
-                ESP_LOGI(MQTT_TAG, "🎯 Procesando comando: %s", data);
-                menu_mqtt(data);
+                uint32_t id_comando = 0;
+                if (comandos_encolar(COMANDO_MENU, data, &id_comando) == ESP_OK) {
+                    ESP_LOGI(MQTT_TAG, "🎯 Comando #%u encolado: %s", (unsigned)id_comando, data);
+                }
 
             } else if (strcmp(topic, MQTT_TOPIC_COMMAND_OTA) == 0) {
-                ESP_LOGI(MQTT_TAG, "🚀 Procesando comando OTA: %s", data);
-
-                // Verificar si es comando de rollback
-                if (strcmp(data, "ROLLBACK") == 0 || strcmp(data, "rollback") == 0) {
-                    ESP_LOGI(MQTT_TAG, "🔄 Procesando comando ROLLBACK");
-
-                    // Publicar estado antes de rollback
-                    esp_mqtt_client_publish(mqtt_client, MQTT_TOPIC_STATUS,
-                                          "🔄 Iniciando rollback a firmware anterior...", 0, 1, 0);
-
-                    // Ejecutar rollback
-                    esp_err_t rollback_result = ota_rollback_to_previous();
-
-                    if (rollback_result == ESP_OK) {
-                        ESP_LOGI(MQTT_TAG, "✅ Rollback iniciado exitosamente");
-                        esp_mqtt_client_publish(mqtt_client, MQTT_TOPIC_STATUS,
-                                              "✅ Rollback completado - reiniciando...", 0, 1, 0);
-                    } else {
-                        ESP_LOGE(MQTT_TAG, "❌ Error en rollback: %s", esp_err_to_name(rollback_result));
-                        char error_msg[128];
-                        snprintf(error_msg, sizeof(error_msg), "❌ Error rollback: %s", esp_err_to_name(rollback_result));
-                        esp_mqtt_client_publish(mqtt_client, MQTT_TOPIC_STATUS, error_msg, 0, 1, 0);
-                    }
-                } else {
-                    // Procesar comando OTA normal con URL
-                    ota_process_command(data);
+                uint32_t id_comando = 0;
+                bool rollback = strcmp(data, "ROLLBACK") == 0 || strcmp(data, "rollback") == 0;
+                if (comandos_encolar(rollback ? COMANDO_ROLLBACK : COMANDO_OTA, data, &id_comando) == ESP_OK) {
+                    ESP_LOGI(MQTT_TAG, "🚀 Comando OTA #%u encolado: %s", (unsigned)id_comando, data);
                 }
 
             } else if (strcmp(topic, MQTT_TOPIC_SET_SCHEDULE) == 0) {
@@ -364,6 +368,37 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event) {
                 }
                 break;
             
+            } else if (strcmp(topic, MQTT_TOPIC_SET_FILTER) == 0) {
+                ESP_LOGI(MQTT_TAG, "🎛️ Configurando cadena de filtros: %s", data);
+                char mensaje[MQTT_STATUS_BUFFER_SIZE];
+                if (filtros_configurar(data) == ESP_OK) {
+                    filtros_config_t cfg;
+                    char texto[FILTROS_TEXTO_MAX];
+                    filtros_get_config(&cfg);
+                    filtros_config_a_texto(&cfg, texto, sizeof(texto));
+                    snprintf(mensaje, sizeof(mensaje), "Filtros actualizados: %s", texto);
+                } else {
+                    snprintf(mensaje, sizeof(mensaje), "Error: Cadena de filtros inválida. Ej: mediana:5,media:8:4,iir:0.2,kalman:4:400 o ninguno");
+                }
+                mqtt_safe_publish(MQTT_TOPIC_STATUS, mensaje, false);
+
+            } else if (strcmp(topic, MQTT_TOPIC_SET_CONFIG) == 0) {
+                ESP_LOGI(MQTT_TAG, "⚙️ Procesando configuración: %s", data);
+                char mensaje[MQTT_STATUS_BUFFER_SIZE];
+                esp_err_t res_config = registro_configurar(data);
+                if (res_config == ESP_ERR_NOT_FOUND) {
+                    res_config = autocero_configurar(data);
+                }
+                if (res_config == ESP_ERR_NOT_FOUND) {
+                    res_config = hx711_configurar_canal(data);
+                }
+                if (res_config == ESP_OK) {
+                    snprintf(mensaje, sizeof(mensaje), "Configuración actualizada: %s", data);
+                } else {
+                    snprintf(mensaje, sizeof(mensaje), "Error: Use clave=valor (modo, banda_g, latido_s, estable_g, estable_n, autocero..., ganancia_cN)");
+                }
+                mqtt_safe_publish(MQTT_TOPIC_STATUS, mensaje, false);
+
             } else if (strcmp(topic, MQTT_TOPIC_SET_TIME) == 0) {
                 ESP_LOGI(MQTT_TAG, "Configurando fecha/hora: %s", data);
                 
@@ -473,8 +508,11 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event) {
 void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
     (void)handler_args;
     (void)base;
-    (void)event_id;
+    int64_t t_inicio = esp_timer_get_time();
     mqtt_event_handler_cb(event_data);
+    if (event_id == MQTT_EVENT_DATA) {
+        comandos_registrar_manejador((uint32_t)(esp_timer_get_time() - t_inicio));
+    }
 }
 
 /**
@@ -483,6 +521,9 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
  */
 void mqtt_init(void) {
     ESP_LOGI(MQTT_TAG, "Inicializando cliente MQTT para %s:%d", CONFIG_BROKER_URL, CONFIG_BROKER_PORT);
+
+    // El ejecutor debe existir antes del primer MQTT_EVENT_DATA
+    create_task_comandos();
     
     /*// Verificar que las constantes están definidas
     if (CONFIG_BROKER_URL == NULL || strlen(CONFIG_BROKER_URL) == 0) {
@@ -667,6 +708,35 @@ esp_err_t mqtt_enviar_datos(float peso, struct tm *timeinfo, const char* mensaje
     return result;
 }
 
+/**
+ * @brief Consumidor en vivo: drena la cola de muestras y publica la más reciente
+ * Se llama periódicamente desde task_MQTT; el consumidor solo se alimenta
+ * mientras el envío en vivo está activo y hay conexión.
+ */
+void mqtt_enviar_en_vivo(void) {
+    bool activo = sistema.estado.envio_en_vivo && mqtt_is_connected();
+    muestreo_habilitar(MUESTREO_CONSUMIDOR_VIVO, activo);
+    if (!activo) {
+        return;
+    }
+
+    muestra_t muestra;
+    muestra_t ultima;
+    int drenadas = 0;
+    while (muestreo_leer(MUESTREO_CONSUMIDOR_VIVO, &muestra)) {
+        ultima = muestra;
+        drenadas++;
+    }
+    if (drenadas == 0) {
+        return;
+    }
+
+    char mensaje[MQTT_STATUS_BUFFER_SIZE];
+    snprintf(mensaje, sizeof(mensaje), "{\"epoch\":%u,\"raw\":%d,\"weight\":%.3f,\"n\":%d}",
+             (unsigned)ultima.epoch, (int)ultima.raw, hx711_calcular_peso(ultima.raw), drenadas);
+    mqtt_safe_publish(MQTT_TOPIC_LIVE, mensaje, false);
+}
+
 /**
  * @brief Verifica si el cliente MQTT está conectado y operativo
  * @return true si está conectado, false en caso contrario
@@ -764,16 +834,141 @@ void menu_mqtt(const char* comando) {
             gpio_set_level(LED_USER, 0);
             break;
             
-        case 8:
-            hx711_continuar_calibracion_peso();
+        case 3:
+            ESP_LOGI(MQTT_TAG, "📊 Publicando métricas del sistema...");
+            if (metricas_publicar() != ESP_OK) {
+                mqtt_safe_publish(MQTT_TOPIC_STATUS, "Error: No se pudieron publicar las métricas", false);
+            }
+            break;
+
+        case 4:
+            sistema.estado.envio_en_vivo = !sistema.estado.envio_en_vivo;
+            mqtt_safe_publish(MQTT_TOPIC_STATUS, sistema.estado.envio_en_vivo ?
+                              "Envío en vivo ACTIVADO (esp32/halo/live)" : "Envío en vivo DESACTIVADO", false);
+            ESP_LOGI(MQTT_TAG, "📡 Envío en vivo %s", sistema.estado.envio_en_vivo ? "activado" : "desactivado");
+            break;
+
+        case 5: {
+            // "5 [días]": exportación para técnicos a export.csv en la misma SD;
+            // con días se agregan los segmentos del histórico de ese período
+            int dias = 0;
+            sscanf(comando, "%*d %d", &dias);
+            if (dias < 0 || dias > MUESTRAS_BIN_EXPORTAR_DIAS_MAX) {
+                char error[64];
+                snprintf(error, sizeof(error), "Error: use 5 [días], con días de 1 a %d", MUESTRAS_BIN_EXPORTAR_DIAS_MAX);
+                mqtt_safe_publish(MQTT_TOPIC_STATUS, error, false);
+                break;
+            }
+            uint32_t desde = 0;
+            if (dias > 0) {
+                time_t ahora = time(NULL);
+                desde = (ahora > (time_t)dias * 86400) ? (uint32_t)(ahora - (time_t)dias * 86400) : 1;
+            }
+            uint32_t exportadas = 0;
+            // Toma sistema.mutex_sd por tandas: el registro y el envío no se detienen
+            esp_err_t res_export = muestras_bin_exportar_csv(desde, &exportadas);
+            char mensaje[MQTT_STATUS_BUFFER_SIZE];
+            if (res_export == ESP_OK) {
+                snprintf(mensaje, sizeof(mensaje), "Exportadas %u muestras a %s", (unsigned)exportadas, MUESTRAS_BIN_RUTA_CSV);
+            } else {
+                snprintf(mensaje, sizeof(mensaje), "Error al exportar CSV: %s", esp_err_to_name(res_export));
+            }
+            mqtt_safe_publish(MQTT_TOPIC_STATUS, mensaje, false);
+            break;
+        }
+
+        case 8: {
+            // "8 <kg> [q]": masa conocida (1 kg por defecto) y modelo cuadrático opcional
+            float masa_kg = 1.0f;
+            char modelo = '\0';
+            int campos = sscanf(comando, "%*d %f %c", &masa_kg, &modelo);
+            if (campos >= 1 && !(masa_kg > 0.0f && masa_kg < 10000.0f)) {
+                mqtt_safe_publish(MQTT_TOPIC_STATUS, "Error: masa de calibración inválida. Use 8 <kg> [q]", false);
+                break;
+            }
+            hx711_continuar_calibracion_peso(masa_kg, campos == 2 && (modelo == 'q' || modelo == 'Q'));
             sistema.estado.esperando_comando_peso = false;
             break;
+        }
             
         case 9:
             sistema.estado.esperando_config_horario = true;
             mqtt_safe_publish(MQTT_TOPIC_STATUS, MQTT_MSG_ESPERANDO_HORARIO, false);
             ESP_LOGI(MQTT_TAG, "✅ Sistema esperando configuración de horario");
             break;
+
+        case 10: {
+            // "10 [horas]" (24 por defecto) o "10 <desde> <hasta>" en epochs:
+            // cantidad, mínimo, máximo, media y desvío sin leer las muestras crudas
+            unsigned long a = 0, b = 0;
+            int campos = sscanf(comando, "%*d %lu %lu", &a, &b);
+            uint32_t desde, hasta;
+            if (campos == 2) {
+                desde = (uint32_t)a;
+                hasta = (uint32_t)b;
+            } else {
+                uint32_t horas = (campos == 1 && a > 0 && a <= 24 * 731) ? (uint32_t)a : 24;
+                hasta = (uint32_t)time(NULL);
+                desde = (hasta > horas * 3600) ? hasta - horas * 3600 : 0;
+            }
+            agregados_resultado_t res;
+            esp_err_t res_consulta = ESP_ERR_TIMEOUT;
+            if (xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(5000)) == pdTRUE) {
+                res_consulta = agregados_consultar(desde, hasta, &res);
+                xSemaphoreGive(sistema.mutex_sd);
+            }
+            if (res_consulta != ESP_OK) {
+                char mensaje[MQTT_STATUS_BUFFER_SIZE];
+                snprintf(mensaje, sizeof(mensaje), "Error en la consulta de agregados: %s. Use 10 [horas] o 10 <desde> <hasta>",
+                         esp_err_to_name(res_consulta));
+                mqtt_safe_publish(MQTT_TOPIC_STATUS, mensaje, false);
+                break;
+            }
+            agregados_stats_t ag;
+            agregados_get_stats(&ag);
+            char json[MQTT_MESSAGE_BUFFER_SIZE];
+            if (res.n > 0) {
+                double media = (double)res.suma_mg / res.n;
+                double varianza = res.suma_cuadrados / res.n - media * media;
+                snprintf(json, sizeof(json),
+                         "{\"desde\":%u,\"hasta\":%u,\"n\":%u,\"min_kg\":%.3f,\"max_kg\":%.3f,\"media_kg\":%.3f,"
+                         "\"desvio_kg\":%.3f,\"casilleros\":%u,\"faltantes\":%u,\"consulta_us\":%u}",
+                         (unsigned)res.desde, (unsigned)res.hasta, (unsigned)res.n,
+                         res.min_mg / 1e6, res.max_mg / 1e6, media / 1e6,
+                         (varianza > 0.0 ? sqrt(varianza) : 0.0) / 1e6,
+                         (unsigned)res.casilleros, (unsigned)res.faltantes, (unsigned)ag.consulta_us);
+            } else {
+                snprintf(json, sizeof(json),
+                         "{\"desde\":%u,\"hasta\":%u,\"n\":0,\"casilleros\":%u,\"faltantes\":%u,\"consulta_us\":%u}",
+                         (unsigned)res.desde, (unsigned)res.hasta,
+                         (unsigned)res.casilleros, (unsigned)res.faltantes, (unsigned)ag.consulta_us);
+            }
+            mqtt_safe_publish(MQTT_TOPIC_AGREGADOS, json, false);
+            break;
+        }
+
+        case 11: {
+            // "11 [n]": últimas n muestras registradas (1 por defecto) desde la caché en RAM
+            int pedidas = 1;
+            sscanf(comando, "%*d %d", &pedidas);
+            if (pedidas < 1 || pedidas > MQTT_RECIENTES_MAX) {
+                pedidas = (pedidas < 1) ? 1 : MQTT_RECIENTES_MAX;
+            }
+            muestra_bin_t regs[MQTT_RECIENTES_MAX];
+            size_t n = recientes_ultimas(regs, (size_t)pedidas);
+            char json[MQTT_DATA_BUFFER_SIZE];
+            int usado = snprintf(json, sizeof(json), "{\"muestras\":[");
+            for (size_t i = 0; i < n && usado > 0 && usado < (int)sizeof(json); i++) {
+                usado += snprintf(json + usado, sizeof(json) - usado, "%s{\"epoch\":%u,\"kg\":%.3f,\"estable\":%d}",
+                                  i > 0 ? "," : "", (unsigned)regs[i].epoch, regs[i].peso_mg / 1e6,
+                                  (regs[i].flags & MUESTRA_BIN_ESTABLE) ? 1 : 0);
+            }
+            if (usado > 0 && usado < (int)sizeof(json)) {
+                snprintf(json + usado, sizeof(json) - usado, "]}");
+            }
+            mqtt_safe_publish(MQTT_TOPIC_RECIENTES, json, false);
+            break;
+        }
             
         case 2:
             ESP_LOGI(MQTT_TAG, "⏱️ Esperando configuración de intervalo de muestreo...");
@@ -794,7 +989,7 @@ void menu_mqtt(const char* comando) {
             
             char mensaje_error[MQTT_STATUS_BUFFER_SIZE];
             snprintf(mensaje_error, sizeof(mensaje_error),
-                     "Error: Comando %d no reconocido. Comandos válidos: 0,1,2,6,7,8,9,99",
+                     "Error: Comando %d no reconocido. Comandos válidos: 0,1,2,3,4,5,6,7,8,9,10,11,99",
                      comando_num);
             mqtt_safe_publish(MQTT_TOPIC_STATUS, mensaje_error, false);
             break;
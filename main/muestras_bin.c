@@ -0,0 +1,1430 @@
+#include "../include/muestras_bin.h"
+#include "../include/HALO.h"
+#include <esp_rom_crc.h>
+#include <esp_cpu.h>
+#include <esp_timer.h>
+#include <stddef.h>
+#include <dirent.h>
+#include <strings.h>
+#include <math.h>
+
+static const char *MUESTRAS_BIN_TAG = "MUESTRAS_BIN";
+
+// El formato en disco no debe depender del relleno del compilador
+_Static_assert(sizeof(muestras_bin_cabecera_t) == 20, "cabecera binaria con relleno inesperado");
+_Static_assert(sizeof(muestra_bin_t) == 20 + (HX711_NUM_CANALES > 1 ? 4 * HX711_NUM_CANALES : 0),
+               "registro binario con relleno inesperado");
+
+#define MUESTRAS_BIN_LOTE   32          // Registros por lectura en la exportación y la rotación
+#define MUESTRAS_BIN_EXPORTAR_FILAS 256  // Filas del CSV por toma de sistema.mutex_sd
+#define MUESTRAS_BIN_EPOCH_MIN  1704067200u // 2024-01-01: antes de esto la hora no es confiable
+
+// Una fila del manifiesto del histórico
+typedef struct {
+    char nombre[9];                     // AAMMDDNN (8.3, la FATFS no usa nombres largos)
+    uint32_t primera;                   // Epoch de la primera muestra
+    uint32_t ultima;                    // Epoch de la última muestra
+    uint32_t muestras;
+} muestras_bin_segmento_t;
+
+// Rotación en curso (NVS_KEY_ROTACION): el segmento ya archivado y la cabecera
+// del pesos.bin del que salió. Si al montar pesos.bin sigue siendo ese, la
+// rotación no llegó a borrarlo y el segmento duplicaría lo que todavía tiene.
+typedef struct {
+    char nombre[9];
+    uint8_t segmento;                   // muestras_bin_cabecera_t.segmento del pesos.bin rotado
+} muestras_bin_rotacion_t;
+
+// Búfer de lectura compartido (todas las funciones que lo usan van con sistema.mutex_sd)
+static muestra_bin_t lote[MUESTRAS_BIN_LOTE];
+static muestras_bin_stats_t stats;
+// Cambia cada vez que MUESTRAS_BIN_RUTA se recrea, recorta o rota (invalida las vistas)
+static uint32_t generacion = 0;
+// Secuencia de la próxima muestra que se escriba en MUESTRAS_BIN_RUTA
+static volatile uint32_t escritas = 0;
+static muestras_bin_cursor_t cursor_guardado = MUESTRAS_BIN_CURSOR_INICIAL;
+static uint32_t t_cursor_guardado_ms = 0;
+// Fin lógico de MUESTRAS_BIN_RUTA (escrito y con fsync) y registros asignados en disco
+static uint32_t registros = 0;
+static uint32_t confirmados = 0;
+static uint32_t asignados = 0;
+
+static esp_err_t muestras_bin_leer_en(const char *ruta, uint32_t indice, muestra_bin_t *regs, size_t max, size_t *leidos);
+static esp_err_t muestras_bin_rotacion_anotar(const muestras_bin_rotacion_t *rot);
+static void muestras_bin_rotacion_deshacer(const char *nombre);
+
+static void muestras_bin_ruta(char *buffer, size_t tam, const char *ruta) {
+    snprintf(buffer, tam, "%s%s", sdcard_info.mount_point, ruta);
+}
+
+static uint32_t muestras_bin_crc_cabecera(const muestras_bin_cabecera_t *cab) {
+    return esp_rom_crc32_le(0, (const uint8_t *)cab, offsetof(muestras_bin_cabecera_t, crc));
+}
+
+void muestras_bin_sellar(muestra_bin_t *reg) {
+    reg->crc = esp_rom_crc32_le(0, (const uint8_t *)reg, offsetof(muestra_bin_t, crc));
+}
+
+bool muestras_bin_valido(const muestra_bin_t *reg) {
+    return reg->crc == esp_rom_crc32_le(0, (const uint8_t *)reg, offsetof(muestra_bin_t, crc));
+}
+
+/**
+ * @brief Abre 'ruta' vacío con la cabecera escrita; NULL si falla
+ *
+ * Con 'reservados' > 0 el archivo se crea antes como un tramo contiguo de ese
+ * tamaño (f_expand); si la FAT no tiene un hueco así, con clústeres sueltos al
+ * rellenarlo. En ambos casos el llamador termina con muestras_bin_rellenar().
+ */
+static FILE *muestras_bin_abrir_nuevo(const char *ruta, uint32_t segmento, uint32_t reservados) {
+    muestras_bin_cabecera_t cab = {
+        .magia = { MUESTRAS_BIN_MAGIA[0], MUESTRAS_BIN_MAGIA[1], MUESTRAS_BIN_MAGIA[2], MUESTRAS_BIN_MAGIA[3] },
+        .version = MUESTRAS_BIN_VERSION,
+        .tam_cabecera = sizeof(muestras_bin_cabecera_t),
+        .tam_registro = sizeof(muestra_bin_t),
+        .num_canales = HX711_NUM_CANALES,
+        .segmento = (uint8_t)segmento,
+        .creado = (uint32_t)time(NULL),
+    };
+    cab.crc = muestras_bin_crc_cabecera(&cab);
+
+    // f_expand solo acepta archivos vacíos
+    espacio_remove(ruta);
+    bool contiguo = reservados > 0 &&
+                    esp_vfs_fat_create_contiguous_file(sdcard_info.mount_point, ruta,
+                                                       (uint64_t)MUESTRAS_BIN_POSICION(reservados), true) == ESP_OK;
+    FILE *f = fopen(ruta, contiguo ? "r+b" : "wb");
+    if (f == NULL) {
+        ESP_LOGE(MUESTRAS_BIN_TAG, "Error al crear %s", ruta);
+        return NULL;
+    }
+    if (contiguo) {
+        stats.preasignaciones_contiguas++;
+    }
+    if (fwrite(&cab, sizeof(cab), 1, f) != 1) {
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+/**
+ * @brief Pone en cero los registros [desde, hasta) de un archivo recién creado
+ *
+ * f_expand no borra los clústeres que reserva, y el fin lógico tras un corte se
+ * encuentra porque detrás de él solo hay ceros. Devuelve los registros
+ * asignados: 'hasta', o 'desde' si falla (el archivo se recorta ahí).
+ */
+static uint32_t muestras_bin_rellenar(FILE *f, uint32_t desde, uint32_t hasta) {
+    int64_t t_inicio = esp_timer_get_time();
+    memset(lote, 0, sizeof(lote));
+    bool ok = fseek(f, MUESTRAS_BIN_POSICION(desde), SEEK_SET) == 0;
+    for (uint32_t i = desde; ok && i < hasta; i += MUESTRAS_BIN_LOTE) {
+        size_t n = (hasta - i < MUESTRAS_BIN_LOTE) ? hasta - i : MUESTRAS_BIN_LOTE;
+        ok = fwrite(lote, sizeof(muestra_bin_t), n, f) == n;
+    }
+    stats.preasignacion_us = (uint32_t)(esp_timer_get_time() - t_inicio);
+    if (!ok) {
+        ESP_LOGW(MUESTRAS_BIN_TAG, "No se pudieron preasignar %u registros", (unsigned)(hasta - desde));
+        fflush(f);
+        ftruncate(fileno(f), MUESTRAS_BIN_POSICION(desde));
+        return desde;
+    }
+    return hasta;
+}
+
+uint32_t muestras_bin_preasignar_objetivo(void) {
+    if (CONFIG_HALO_SD_PREASIGNAR_KB == 0) {
+        return 0;
+    }
+    uint32_t maximo = (uint32_t)CONFIG_HALO_SD_PREASIGNAR_KB * 1024 / sizeof(muestra_bin_t);
+    uint32_t intervalo_ms = (sistema.envio.muestreo_ms > 0) ? (uint32_t)sistema.envio.muestreo_ms : 1000;
+    uint32_t dia = 86400000u / intervalo_ms;
+    return (dia < maximo) ? dia : maximo;
+}
+
+// El cursor pasa al principio del archivo siguiente; la secuencia continúa
+static void muestras_bin_cursor_nuevo_segmento(void) {
+    sistema.envio.cursor.segmento++;
+    sistema.envio.cursor.offset = sizeof(muestras_bin_cabecera_t);
+    generacion++;
+}
+
+static esp_err_t muestras_bin_crear(const char *ruta) {
+    uint32_t objetivo = muestras_bin_preasignar_objetivo();
+    FILE *f = muestras_bin_abrir_nuevo(ruta, sistema.envio.cursor.segmento + 1, objetivo);
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    uint32_t reservados = muestras_bin_rellenar(f, 0, objetivo);
+    if (fclose(f) != 0) {
+        return ESP_FAIL;
+    }
+    espacio_archivo(ruta, 0);
+    registros = 0;
+    confirmados = 0;
+    asignados = reservados;
+
+    // Archivo nuevo: nada pendiente y el cursor apunta a su primera muestra
+    muestras_bin_cursor_nuevo_segmento();
+    escritas = sistema.envio.cursor.secuencia;
+    muestras_bin_cursor_guardar(true);
+    ESP_LOGI(MUESTRAS_BIN_TAG, "Archivo %s creado (v%d, %u bytes por muestra, %u preasignadas en %u us)",
+             ruta, MUESTRAS_BIN_VERSION, (unsigned)sizeof(muestra_bin_t), (unsigned)reservados,
+             (unsigned)stats.preasignacion_us);
+    return ESP_OK;
+}
+
+static bool muestras_bin_cabecera_valida(const muestras_bin_cabecera_t *cab) {
+    return memcmp(cab->magia, MUESTRAS_BIN_MAGIA, sizeof(cab->magia)) == 0 &&
+           cab->version == MUESTRAS_BIN_VERSION &&
+           cab->tam_cabecera == sizeof(muestras_bin_cabecera_t) &&
+           cab->tam_registro == sizeof(muestra_bin_t) &&
+           cab->num_canales == HX711_NUM_CANALES &&
+           cab->crc == muestras_bin_crc_cabecera(cab);
+}
+
+/**
+ * @brief Cantidad de registros hasta el último con CRC válido, mirando solo la cola
+ *
+ * Cada vaciado del búfer es un solo write() de registros completos, así que un
+ * corte solo puede dañar lo escrito por el último: basta revisar hacia atrás un
+ * búfer de registros (CONFIG_HALO_SD_BUFFER_BYTES) y no el archivo entero.
+ */
+static uint32_t muestras_bin_ultimo_valido(const char *ruta, uint32_t total, uint32_t *revisados) {
+    const uint32_t ventana = CONFIG_HALO_SD_BUFFER_BYTES / sizeof(muestra_bin_t) + 1;
+    uint32_t limite = (total > ventana) ? total - ventana : 0;
+    uint32_t fin = total;
+    *revisados = 0;
+    while (fin > limite) {
+        uint32_t desde = (fin - limite > MUESTRAS_BIN_LOTE) ? fin - MUESTRAS_BIN_LOTE : limite;
+        size_t leidos = 0;
+        if (muestras_bin_leer_en(ruta, desde, lote, fin - desde, &leidos) != ESP_OK || leidos != fin - desde) {
+            return total;           // Sin poder leer no se recorta nada
+        }
+        for (size_t i = leidos; i > 0; i--) {
+            (*revisados)++;
+            if (muestras_bin_valido(&lote[i - 1])) {
+                return desde + (uint32_t)i;
+            }
+        }
+        fin = desde;
+    }
+    // Ningún registro válido en la ventana: un daño tan grande no es un corte de
+    // energía, así que no se recorta nada (el envío salta los registros inválidos)
+    return (limite > 0) ? total : 0;
+}
+
+/**
+ * @brief Aparta el registro CSV anterior y, si 'importar', pasa sus filas sin enviar a 'ruta'
+ *
+ * Solo se importa a un pesos.bin recién creado: las filas legadas son anteriores
+ * a toda muestra nueva y el orden por hora (muestras_bin_buscar_epoch) se
+ * mantiene. Las primeras NVS_KEY_ULTIMA filas ya se enviaron. Un pesos.csv con
+ * cabecera es una exportación de una versión anterior y se deja como está.
+ */
+static void muestras_bin_importar_legado(const char *ruta, bool importar) {
+    char anterior[128];
+    char legado[128];
+    struct stat st;
+    muestras_bin_ruta(anterior, sizeof(anterior), MUESTRAS_BIN_RUTA_CSV_ANTERIOR);
+    muestras_bin_ruta(legado, sizeof(legado), MUESTRAS_BIN_RUTA_LEGADO);
+    FILE *csv = fopen(anterior, "r");
+    if (csv == NULL) {
+        return;
+    }
+    // "Fecha,Hora,Peso_kg" es la cabecera del registro anterior; con ",Estable"
+    // es una exportación, que no tiene nada pendiente y se deja como está
+    char linea[96];
+    if (fgets(linea, sizeof(linea), csv) == NULL || strstr(linea, ",Estable") != NULL) {
+        fclose(csv);
+        return;
+    }
+
+    uint32_t enviadas = 0;
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK) {
+        nvs_get_u32(nvs_handle, NVS_KEY_ULTIMA, &enviadas);
+        nvs_close(nvs_handle);
+    }
+    FILE *f = importar ? fopen(ruta, "r+b") : NULL;
+    bool ok = f != NULL && fseek(f, MUESTRAS_BIN_POSICION(registros), SEEK_SET) == 0;
+    uint32_t numero = 0;
+    uint32_t importadas = 0;
+    size_t n = 0;
+    do {
+        int y, m, d, h, min, s;
+        float kg;
+        // Como el contador anterior (NVS_KEY_ULTIMA): las líneas con "Fecha" no cuentan
+        if (!ok || strstr(linea, "Fecha") != NULL || ++numero <= enviadas ||
+            sscanf(linea, "%d-%d-%d,%d:%d:%d,%f", &y, &m, &d, &h, &min, &s, &kg) != 7) {
+            continue;
+        }
+        struct tm tm = { .tm_year = y - 1900, .tm_mon = m - 1, .tm_mday = d,
+                         .tm_hour = h, .tm_min = min, .tm_sec = s, .tm_isdst = -1 };
+        memset(&lote[n], 0, sizeof(lote[n]));
+        lote[n].epoch = (uint32_t)mktime(&tm);
+        lote[n].peso_mg = (int32_t)lroundf(kg * 1e6f);
+        lote[n].flags = MUESTRA_BIN_SIN_BATERIA;
+        muestras_bin_sellar(&lote[n]);
+        if (++n == MUESTRAS_BIN_LOTE) {
+            size_t escritos = fwrite(lote, sizeof(muestra_bin_t), n, f);
+            importadas += escritos;
+            ok = escritos == n;
+            n = 0;
+        }
+    } while (ok && fgets(linea, sizeof(linea), csv) != NULL);
+    if (ok && n > 0) {
+        size_t escritos = fwrite(lote, sizeof(muestra_bin_t), n, f);
+        importadas += escritos;
+        ok = escritos == n;
+    }
+    fclose(csv);
+    if (f != NULL) {
+        if (fflush(f) != 0 || fsync(fileno(f)) != 0) {
+            ok = false;
+        }
+        fclose(f);
+        muestras_bin_agregadas(importadas);
+        muestras_bin_sincronizado();
+    }
+    if (importar) {
+        ESP_LOGI(MUESTRAS_BIN_TAG, "%s: %u filas sin enviar importadas a %s (%u ya enviadas)%s", anterior,
+                 (unsigned)importadas, ruta, (unsigned)enviadas, ok ? "" : " - ERROR de escritura");
+    }
+
+    // Apartado (no borrado): la exportación ya no lo pisa y queda para revisarlo
+    if (stat(legado, &st) == 0 || rename(anterior, legado) != 0) {
+        ESP_LOGW(MUESTRAS_BIN_TAG, "No se pudo renombrar %s a %s; se conserva", anterior, legado);
+    }
+}
+
+// Primer registro en cero de [0, fisicos): el fin lógico de un archivo
+// preasignado (uno sin preasignar no tiene ninguno y da 'fisicos')
+static uint32_t muestras_bin_fin_logico(const char *ruta, uint32_t fisicos, uint32_t *lecturas) {
+    static const muestra_bin_t vacio;
+    FILE *f = fopen(ruta, "rb");
+    if (f == NULL) {
+        return fisicos;
+    }
+    setvbuf(f, NULL, _IONBF, 0);
+    uint32_t lo = 0;
+    uint32_t hi = fisicos;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        muestra_bin_t reg;
+        if (fseek(f, MUESTRAS_BIN_POSICION(mid), SEEK_SET) != 0 || fread(&reg, sizeof(reg), 1, f) != 1) {
+            hi = mid;
+            continue;
+        }
+        (*lecturas)++;
+        if (memcmp(&reg, &vacio, sizeof(reg)) == 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    fclose(f);
+    return lo;
+}
+
+esp_err_t muestras_bin_preparar(void) {
+    char ruta[128];
+    muestras_bin_ruta(ruta, sizeof(ruta), MUESTRAS_BIN_RUTA);
+
+    // Corte entre el archivado y el borrado de pesos.bin: el segmento repetiría
+    // lo que pesos.bin todavía tiene y se volvería a archivar
+    muestras_bin_rotacion_t rotacion;
+    size_t tam = sizeof(rotacion);
+    nvs_handle_t nvs_handle;
+    bool rotando = false;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK) {
+        rotando = nvs_get_blob(nvs_handle, NVS_KEY_ROTACION, &rotacion, &tam) == ESP_OK && tam == sizeof(rotacion);
+        nvs_close(nvs_handle);
+    }
+    if (rotando) {
+        muestras_bin_cabecera_t rotado;
+        FILE *f = fopen(ruta, "rb");
+        bool sin_borrar = f != NULL && fread(&rotado, sizeof(rotado), 1, f) == 1 &&
+                          muestras_bin_cabecera_valida(&rotado) && rotado.segmento == rotacion.segmento;
+        if (f != NULL) {
+            fclose(f);
+        }
+        rotacion.nombre[sizeof(rotacion.nombre) - 1] = '\0';
+        if (sin_borrar) {
+            muestras_bin_rotacion_deshacer(rotacion.nombre);
+        } else {
+            muestras_bin_rotacion_anotar(NULL);
+        }
+    }
+
+    // Rotación interrumpida: pesos.tmp tiene la cola sin enviar ya copiada
+    char temporal[128];
+    muestras_bin_ruta(temporal, sizeof(temporal), MUESTRAS_BIN_RUTA_TEMP);
+    struct stat st;
+    if (stat(temporal, &st) == 0) {
+        if (stat(ruta, &st) != 0) {
+            // El segmento ya se archivó: la cola pasa a ser el registro activo
+            ESP_LOGW(MUESTRAS_BIN_TAG, "Completando rotación interrumpida (%s -> %s)", temporal, ruta);
+            // El segmento de su cabecera mueve el cursor más abajo
+            if (rename(temporal, ruta) != 0) {
+                return ESP_FAIL;
+            }
+            generacion++;
+        } else {
+            // El corte llegó antes de archivar: pesos.bin sigue completo
+            espacio_remove(temporal);
+        }
+    }
+
+    if (stat(ruta, &st) != 0) {
+        // Primer arranque tras la migración: lo pendiente del CSV anterior pasa al archivo nuevo
+        esp_err_t res = muestras_bin_crear(ruta);
+        if (res == ESP_OK) {
+            muestras_bin_importar_legado(ruta, true);
+        }
+        return res;
+    }
+    muestras_bin_importar_legado(ruta, false);
+
+    muestras_bin_cabecera_t cab;
+    FILE *f = fopen(ruta, "rb");
+    bool valida = f != NULL && fread(&cab, sizeof(cab), 1, f) == 1 && muestras_bin_cabecera_valida(&cab);
+    if (f != NULL) {
+        fclose(f);
+    }
+    if (!valida) {
+        // Otra versión o número de canales: se conserva aparte y se empieza de nuevo
+        char anterior[128];
+        muestras_bin_ruta(anterior, sizeof(anterior), MUESTRAS_BIN_RUTA_ANTERIOR);
+        ESP_LOGW(MUESTRAS_BIN_TAG, "Cabecera incompatible en %s; se renombra a %s", ruta, anterior);
+        espacio_remove(anterior);
+        rename(ruta, anterior);
+        return muestras_bin_crear(ruta);
+    }
+
+    // Cursor de otro archivo (corte entre la rotación y el guardado del cursor):
+    // todo lo de este archivo está pendiente
+    muestras_bin_cursor_t *cursor = &sistema.envio.cursor;
+    if ((uint8_t)cursor->segmento != cab.segmento) {
+        ESP_LOGW(MUESTRAS_BIN_TAG, "Cursor del segmento %u y %s del %u; se envía el archivo completo",
+                 (unsigned)cursor->segmento, ruta, (unsigned)cab.segmento);
+        cursor->segmento += (uint8_t)(cab.segmento - (uint8_t)cursor->segmento);
+        cursor->offset = sizeof(cab);
+        muestras_bin_cursor_guardar(true);
+    }
+
+    // Un corte de energía puede dejar un registro a medias al final: sin recortarlo
+    // los siguientes quedarían desalineados
+    int64_t t_inicio = esp_timer_get_time();
+    size_t datos = (st.st_size > (off_t)sizeof(cab)) ? (size_t)st.st_size - sizeof(cab) : 0;
+    size_t sobrante = datos % sizeof(muestra_bin_t);
+    uint32_t fisicos = (uint32_t)(datos / sizeof(muestra_bin_t));
+    uint32_t lecturas_fin = 0;
+    uint32_t total = muestras_bin_fin_logico(ruta, fisicos, &lecturas_fin);
+    uint32_t validos = muestras_bin_ultimo_valido(ruta, total, &stats.recuperacion_revisados);
+    stats.recuperacion_revisados += lecturas_fin;
+    if (sobrante != 0 || validos < total) {
+        ESP_LOGW(MUESTRAS_BIN_TAG, "Recortando %u registros con CRC inválido y %u bytes de un registro incompleto",
+                 (unsigned)(total - validos), (unsigned)sobrante);
+        // También se va la preasignación: la tarea escritora la vuelve a extender
+        if (truncate(ruta, (off_t)MUESTRAS_BIN_POSICION(validos)) != 0) {
+            ESP_LOGE(MUESTRAS_BIN_TAG, "No se pudo recortar %s", ruta);
+            return ESP_FAIL;
+        }
+        espacio_cambio((uint64_t)st.st_size, MUESTRAS_BIN_POSICION(validos));
+        generacion++;
+        stats.recuperacion_recortados = total - validos;
+        total = validos;
+        fisicos = validos;
+    }
+    registros = total;
+    confirmados = total;
+    asignados = fisicos;
+    stats.recuperacion_us = (uint32_t)(esp_timer_get_time() - t_inicio);
+    uint32_t indice = muestras_bin_cursor_indice(cursor);
+    if (indice > total || cursor->offset != sizeof(cab) + (size_t)indice * sizeof(muestra_bin_t)) {
+        ESP_LOGW(MUESTRAS_BIN_TAG, "Cursor de envío en el byte %u con %u muestras; se ajusta",
+                 (unsigned)cursor->offset, (unsigned)total);
+        indice = (indice > total) ? total : indice;
+        cursor->offset = sizeof(cab) + indice * sizeof(muestra_bin_t);
+        muestras_bin_cursor_guardar(true);
+    }
+    escritas = cursor->secuencia + (total - indice);
+    ESP_LOGI(MUESTRAS_BIN_TAG, "%s: %u muestras, %u preasignadas (cola revisada: %u registros en %u us)", ruta,
+             (unsigned)total, (unsigned)(fisicos - total), (unsigned)stats.recuperacion_revisados,
+             (unsigned)stats.recuperacion_us);
+    return ESP_OK;
+}
+
+void muestras_bin_cursor_restaurar(void) {
+    muestras_bin_cursor_t cursor = MUESTRAS_BIN_CURSOR_INICIAL;
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK) {
+        size_t tam = sizeof(cursor);
+        if (nvs_get_blob(nvs_handle, NVS_KEY_CURSOR, &cursor, &tam) != ESP_OK || tam != sizeof(cursor)) {
+            // Formato anterior: solo el índice (sus archivos tienen segmento 0 en la cabecera)
+            muestras_bin_cursor_t inicial = MUESTRAS_BIN_CURSOR_INICIAL;
+            uint32_t indice;
+            cursor = inicial;
+            if (nvs_get_u32(nvs_handle, NVS_KEY_ULTIMA, &indice) == ESP_OK) {
+                muestras_bin_cursor_avanzar(&cursor, indice);
+            }
+        }
+        nvs_close(nvs_handle);
+    }
+    sistema.envio.cursor = cursor;
+    cursor_guardado = cursor;
+    ESP_LOGI(MUESTRAS_BIN_TAG, "Cursor de envío: segmento %u, byte %u, secuencia %u",
+             (unsigned)cursor.segmento, (unsigned)cursor.offset, (unsigned)cursor.secuencia);
+}
+
+/**
+ * @brief Guarda el cursor en la NVS si cambió
+ *
+ * Los avances del envío se agrupan (MUESTRAS_BIN_CURSOR_GUARDAR_MS): un corte
+ * solo repite lo enviado desde el último guardado. Los cambios de archivo
+ * (crear, rotar) se guardan siempre.
+ */
+esp_err_t muestras_bin_cursor_guardar(bool forzar) {
+    muestras_bin_cursor_t cursor = sistema.envio.cursor;
+    if (memcmp(&cursor, &cursor_guardado, sizeof(cursor)) == 0) {
+        return ESP_OK;
+    }
+    uint32_t ahora_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    if (!forzar && stats.cursor_guardados > 0 && ahora_ms - t_cursor_guardado_ms < MUESTRAS_BIN_CURSOR_GUARDAR_MS) {
+        return ESP_OK;
+    }
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs_handle, NVS_KEY_CURSOR, &cursor, sizeof(cursor));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    if (err == ESP_OK) {
+        cursor_guardado = cursor;
+        t_cursor_guardado_ms = ahora_ms;
+        stats.cursor_guardados++;
+    }
+    return err;
+}
+
+uint32_t muestras_bin_cursor_indice(const muestras_bin_cursor_t *cursor) {
+    if (cursor->offset <= sizeof(muestras_bin_cabecera_t)) {
+        return 0;
+    }
+    return (cursor->offset - sizeof(muestras_bin_cabecera_t)) / sizeof(muestra_bin_t);
+}
+
+void muestras_bin_cursor_avanzar(muestras_bin_cursor_t *cursor, uint32_t muestras) {
+    cursor->offset += muestras * sizeof(muestra_bin_t);
+    cursor->secuencia += muestras;
+}
+
+void muestras_bin_agregadas(uint32_t muestras) {
+    escritas += muestras;
+    registros += muestras;
+    if (registros > asignados) {
+        // Se escribió más allá de la preasignación: la FAT asignó clústeres nuevos
+        espacio_cambio(MUESTRAS_BIN_POSICION(asignados), MUESTRAS_BIN_POSICION(registros));
+        asignados = registros;
+    }
+}
+
+void muestras_bin_sincronizado(void) {
+    confirmados = registros;
+}
+
+uint32_t muestras_bin_registros(void) {
+    return registros;
+}
+
+uint32_t muestras_bin_asignados(void) {
+    return asignados;
+}
+
+void muestras_bin_asignados_actualizar(uint32_t n) {
+    espacio_cambio(MUESTRAS_BIN_POSICION(asignados), MUESTRAS_BIN_POSICION(n));
+    asignados = n;
+}
+
+uint32_t muestras_bin_pendientes(void) {
+    uint32_t total = escritas;
+    uint32_t enviadas = sistema.envio.cursor.secuencia;
+    return (total > enviadas) ? total - enviadas : 0;
+}
+
+void muestras_bin_get_stats(muestras_bin_stats_t *out) {
+    if (out != NULL) {
+        *out = stats;
+    }
+}
+
+static uint32_t muestras_bin_contar_en(const char *ruta) {
+    struct stat st;
+    if (!sdcard_info.is_mounted || stat(ruta, &st) != 0 || st.st_size <= (off_t)sizeof(muestras_bin_cabecera_t)) {
+        return 0;
+    }
+    return (uint32_t)(((size_t)st.st_size - sizeof(muestras_bin_cabecera_t)) / sizeof(muestra_bin_t));
+}
+
+uint32_t muestras_bin_contar(void) {
+    // El tamaño del archivo incluye la preasignación: cuenta el fin lógico
+    return sdcard_info.is_mounted ? confirmados : 0;
+}
+
+static esp_err_t muestras_bin_leer_en(const char *ruta, uint32_t indice, muestra_bin_t *regs, size_t max, size_t *leidos) {
+    if (regs == NULL || leidos == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *leidos = 0;
+    if (!sdcard_info.is_mounted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    FILE *f = fopen(ruta, "rb");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    long posicion = (long)(sizeof(muestras_bin_cabecera_t) + (size_t)indice * sizeof(muestra_bin_t));
+    if (fseek(f, posicion, SEEK_SET) != 0) {
+        fclose(f);
+        return ESP_FAIL;
+    }
+    *leidos = fread(regs, sizeof(muestra_bin_t), max, f);
+    fclose(f);
+    return ESP_OK;
+}
+
+void muestras_bin_vista(muestras_bin_vista_t *vista) {
+    vista->total = muestras_bin_contar();
+    vista->generacion = generacion;
+}
+
+bool muestras_bin_vista_vigente(const muestras_bin_vista_t *vista) {
+    return vista->generacion == generacion && sdcard_info.is_mounted;
+}
+
+esp_err_t muestras_bin_leer(uint32_t indice, muestra_bin_t *regs, size_t max, size_t *leidos) {
+    char ruta[128];
+    muestras_bin_ruta(ruta, sizeof(ruta), MUESTRAS_BIN_RUTA);
+    return muestras_bin_leer_en(ruta, indice, regs, max, leidos);
+}
+
+static uint32_t muestras_bin_buscar_en(const char *ruta, uint32_t desde, uint32_t hasta, uint32_t epoch,
+                                       uint32_t *lecturas) {
+    uint32_t n_lecturas = 0;
+    if (lecturas != NULL) {
+        *lecturas = 0;
+    }
+    if (desde >= hasta || !sdcard_info.is_mounted) {
+        return hasta;
+    }
+
+    FILE *f = fopen(ruta, "rb");
+    if (f == NULL) {
+        return hasta;
+    }
+    // Sin búfer de stdio: cada sondeo lee solo su registro
+    setvbuf(f, NULL, _IONBF, 0);
+
+    uint32_t lo = desde;
+    uint32_t hi = hasta;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        muestra_bin_t reg;
+        long posicion = (long)(sizeof(muestras_bin_cabecera_t) + (size_t)mid * sizeof(muestra_bin_t));
+        if (fseek(f, posicion, SEEK_SET) != 0 || fread(&reg, sizeof(reg), 1, f) != 1) {
+            hi = mid;
+            continue;
+        }
+        n_lecturas++;
+        // Un registro dañado no aporta hora: se trata como anterior al límite
+        if (muestras_bin_valido(&reg) && reg.epoch > epoch) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    fclose(f);
+    if (lecturas != NULL) {
+        *lecturas = n_lecturas;
+    }
+    return lo;
+}
+
+uint32_t muestras_bin_buscar_epoch(uint32_t desde, uint32_t hasta, uint32_t epoch, uint32_t *lecturas) {
+    char ruta[128];
+    muestras_bin_ruta(ruta, sizeof(ruta), MUESTRAS_BIN_RUTA);
+    return muestras_bin_buscar_en(ruta, desde, hasta, epoch, lecturas);
+}
+
+// Segmento del histórico con la extensión dada ("cmp" comprimido, "bin" sin comprimir, "tmp" en escritura)
+static void muestras_bin_ruta_segmento(char *buffer, size_t tam, const char *nombre, const char *extension) {
+    snprintf(buffer, tam, "%s%s/%s.%s", sdcard_info.mount_point, MUESTRAS_BIN_DIR_HISTORICO, nombre, extension);
+}
+
+// Lee la siguiente fila válida del manifiesto; false al final
+static bool muestras_bin_manifiesto_siguiente(FILE *f, muestras_bin_segmento_t *seg) {
+    char linea[64];
+    while (fgets(linea, sizeof(linea), f) != NULL) {
+        unsigned primera, ultima, muestras;
+        if (sscanf(linea, "%8[0-9],%u,%u,%u", seg->nombre, &primera, &ultima, &muestras) == 4) {
+            seg->primera = primera;
+            seg->ultima = ultima;
+            seg->muestras = muestras;
+            return true;
+        }
+    }
+    return false;
+}
+
+static esp_err_t muestras_bin_manifiesto_agregar(const muestras_bin_segmento_t *seg) {
+    char ruta[128];
+    struct stat st;
+    muestras_bin_ruta(ruta, sizeof(ruta), MUESTRAS_BIN_RUTA_MANIFIESTO);
+    bool nuevo = stat(ruta, &st) != 0;
+    FILE *f = fopen(ruta, "a");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    if (nuevo) {
+        fputs("Segmento,Primera,Ultima,Muestras\n", f);
+    }
+    fprintf(f, "%s,%u,%u,%u\n", seg->nombre, (unsigned)seg->primera, (unsigned)seg->ultima, (unsigned)seg->muestras);
+    esp_err_t res = fclose(f) == 0 ? ESP_OK : ESP_FAIL;
+    espacio_archivo(ruta, nuevo ? 0 : (uint64_t)st.st_size);
+    return res;
+}
+
+// Reescribe el manifiesto sin las filas de segmentos que ya no existen
+static esp_err_t muestras_bin_manifiesto_reescribir(void) {
+    char ruta[128];
+    char manifiesto[128];
+    char nuevo[128];
+    muestras_bin_ruta(manifiesto, sizeof(manifiesto), MUESTRAS_BIN_RUTA_MANIFIESTO);
+    snprintf(nuevo, sizeof(nuevo), "%s%s/indice.tmp", sdcard_info.mount_point, MUESTRAS_BIN_DIR_HISTORICO);
+    FILE *entrada_f = fopen(manifiesto, "r");
+    FILE *salida = fopen(nuevo, "w");
+    esp_err_t res = (entrada_f != NULL && salida != NULL) ? ESP_OK : ESP_FAIL;
+    if (res == ESP_OK) {
+        fputs("Segmento,Primera,Ultima,Muestras\n", salida);
+        muestras_bin_segmento_t seg;
+        struct stat st;
+        while (muestras_bin_manifiesto_siguiente(entrada_f, &seg)) {
+            char anterior[128];
+            muestras_bin_ruta_segmento(ruta, sizeof(ruta), seg.nombre, "cmp");
+            muestras_bin_ruta_segmento(anterior, sizeof(anterior), seg.nombre, "bin");
+            if (stat(ruta, &st) == 0 || stat(anterior, &st) == 0) {
+                fprintf(salida, "%s,%u,%u,%u\n", seg.nombre, (unsigned)seg.primera,
+                        (unsigned)seg.ultima, (unsigned)seg.muestras);
+            }
+        }
+    }
+    if (entrada_f != NULL) {
+        fclose(entrada_f);
+    }
+    if (salida != NULL && fclose(salida) != 0) {
+        res = ESP_FAIL;
+    }
+    if (res == ESP_OK) {
+        // rename() de la FATFS no reemplaza: se borra el anterior primero
+        espacio_remove(manifiesto);
+        if (rename(nuevo, manifiesto) != 0) {
+            res = ESP_FAIL;
+        } else {
+            espacio_archivo(manifiesto, 0);
+        }
+    } else {
+        remove(nuevo);
+    }
+    if (res != ESP_OK) {
+        ESP_LOGW(MUESTRAS_BIN_TAG, "No se pudo reescribir el manifiesto");
+    }
+    return res;
+}
+
+// Anota la rotación en curso; con NULL la borra
+static esp_err_t muestras_bin_rotacion_anotar(const muestras_bin_rotacion_t *rot) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (rot != NULL) {
+        err = nvs_set_blob(nvs_handle, NVS_KEY_ROTACION, rot, sizeof(*rot));
+    } else {
+        err = nvs_erase_key(nvs_handle, NVS_KEY_ROTACION);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    return err;
+}
+
+// Deshace el archivado de una rotación que no llegó a borrar pesos.bin
+static void muestras_bin_rotacion_deshacer(const char *nombre) {
+    char segmento[128];
+    muestras_bin_ruta_segmento(segmento, sizeof(segmento), nombre, "cmp");
+    ESP_LOGW(MUESTRAS_BIN_TAG, "Rotación sin completar: se descarta el segmento %s", nombre);
+    espacio_remove(segmento);
+    muestras_bin_manifiesto_reescribir();
+    muestras_bin_rotacion_anotar(NULL);
+}
+
+/**
+ * @brief Archiva las muestras ya enviadas como segmento del histórico (llamar con sistema.mutex_sd)
+ *
+ * Comprime lo enviado en /hist/AAMMDDNN.cmp (se escribe como .tmp y se renombra
+ * al terminar), lo anota en el manifiesto, copia la cola sin enviar a
+ * MUESTRAS_BIN_RUTA_TEMP y la deja como registro activo con el cursor de envío
+ * al principio del segmento siguiente. Si algo falla antes de borrar pesos.bin,
+ * el segmento se borra y sale del manifiesto; tras un corte en ese tramo lo hace
+ * muestras_bin_preparar() con la anotación de NVS_KEY_ROTACION. Un corte en el
+ * último paso lo completa muestras_bin_preparar().
+ */
+esp_err_t muestras_bin_rotar(void) {
+    static compresion_escritor_t escritor;
+
+    if (!sdcard_info.is_mounted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sdcard_registros_vaciar(true);
+
+    char ruta[128];
+    char temporal[128];
+    char directorio[128];
+    char segmento[128];
+    char parcial[128];
+    muestras_bin_ruta(ruta, sizeof(ruta), MUESTRAS_BIN_RUTA);
+    muestras_bin_ruta(temporal, sizeof(temporal), MUESTRAS_BIN_RUTA_TEMP);
+    muestras_bin_ruta(directorio, sizeof(directorio), MUESTRAS_BIN_DIR_HISTORICO);
+
+    uint32_t total = muestras_bin_contar();
+    uint32_t enviadas = muestras_bin_cursor_indice(&sistema.envio.cursor);
+    if (enviadas == 0 || enviadas > total) {
+        return ESP_OK;
+    }
+
+    muestra_bin_t primera;
+    muestra_bin_t ultima;
+    size_t leidos = 0;
+    if (muestras_bin_leer_en(ruta, 0, &primera, 1, &leidos) != ESP_OK || leidos != 1 ||
+        muestras_bin_leer_en(ruta, enviadas - 1, &ultima, 1, &leidos) != ESP_OK || leidos != 1) {
+        return ESP_FAIL;
+    }
+
+    // Nombre por fecha de la primera muestra y secuencia del día
+    muestras_bin_segmento_t seg = {
+        .primera = primera.epoch,
+        .ultima = ultima.epoch,
+        .muestras = enviadas,
+    };
+    struct tm tm;
+    time_t t = (time_t)primera.epoch;
+    localtime_r(&t, &tm);
+    mkdir(directorio, 0775);
+    struct stat st;
+    int secuencia;
+    for (secuencia = 0; secuencia < 100; secuencia++) {
+        snprintf(seg.nombre, sizeof(seg.nombre), "%02d%02d%02d%02d",
+                 tm.tm_year % 100, tm.tm_mon + 1, tm.tm_mday, secuencia);
+        char anterior[128];
+        muestras_bin_ruta_segmento(segmento, sizeof(segmento), seg.nombre, "cmp");
+        muestras_bin_ruta_segmento(anterior, sizeof(anterior), seg.nombre, "bin");
+        if (stat(segmento, &st) != 0 && stat(anterior, &st) != 0) {
+            break;
+        }
+    }
+    if (secuencia == 100) {
+        ESP_LOGE(MUESTRAS_BIN_TAG, "Sin nombres libres para el segmento del %02d/%02d", tm.tm_mday, tm.tm_mon + 1);
+        return ESP_FAIL;
+    }
+
+    // 1. Lo enviado se comprime al histórico; pesos.bin no se toca todavía
+    muestras_bin_ruta_segmento(parcial, sizeof(parcial), seg.nombre, "tmp");
+    FILE *f = fopen(parcial, "wb");
+    if (f == NULL) {
+        ESP_LOGE(MUESTRAS_BIN_TAG, "Error al crear %s", parcial);
+        return ESP_FAIL;
+    }
+    // Sin búfer de stdio: el escritor ya entrega bloques de 4 KB
+    setvbuf(f, NULL, _IONBF, 0);
+    compresion_escritor_iniciar(&escritor, f);
+    esp_err_t res = ESP_OK;
+    for (uint32_t indice = 0; indice < enviadas && res == ESP_OK; indice += leidos) {
+        size_t max = enviadas - indice;
+        if (max > MUESTRAS_BIN_LOTE) {
+            max = MUESTRAS_BIN_LOTE;
+        }
+        if (muestras_bin_leer_en(ruta, indice, lote, max, &leidos) != ESP_OK || leidos == 0) {
+            res = ESP_FAIL;
+            break;
+        }
+        for (size_t i = 0; i < leidos && res == ESP_OK; i++) {
+            // Un registro dañado no se puede reconstruir: no pasa al histórico
+            if (muestras_bin_valido(&lote[i])) {
+                res = compresion_escritor_agregar(&escritor, &lote[i]);
+            }
+        }
+    }
+    if (res == ESP_OK) {
+        res = compresion_escritor_terminar(&escritor);
+    }
+    // Anotada antes de que el segmento exista: tras un corte, muestras_bin_preparar() sabe cuál deshacer
+    muestras_bin_rotacion_t rotacion = { .segmento = (uint8_t)sistema.envio.cursor.segmento };
+    memcpy(rotacion.nombre, seg.nombre, sizeof(rotacion.nombre));
+    if (fclose(f) != 0 || res != ESP_OK || muestras_bin_rotacion_anotar(&rotacion) != ESP_OK ||
+        rename(parcial, segmento) != 0) {
+        ESP_LOGE(MUESTRAS_BIN_TAG, "Error al escribir el segmento %s", segmento);
+        remove(parcial);
+        muestras_bin_rotacion_anotar(NULL);
+        return ESP_FAIL;
+    }
+    espacio_archivo(segmento, 0);
+    if (muestras_bin_manifiesto_agregar(&seg) != ESP_OK) {
+        ESP_LOGW(MUESTRAS_BIN_TAG, "No se pudo anotar %s en el manifiesto", seg.nombre);
+    }
+
+    // 2. Cola sin enviar a pesos.tmp (el escritor tiene pesos.bin abierto: se
+    // cierra y lo reabre en el próximo vaciado)
+    // El archivo nuevo ya lleva su preasignación detrás de la cola
+    sdcard_registros_cerrar();
+    uint32_t pendientes = total - enviadas;
+    uint32_t objetivo = muestras_bin_preasignar_objetivo();
+    FILE *cola = muestras_bin_abrir_nuevo(temporal, sistema.envio.cursor.segmento + 1,
+                                          (objetivo > 0) ? pendientes + objetivo : 0);
+    if (cola == NULL) {
+        espacio_remove(temporal);
+        muestras_bin_rotacion_deshacer(seg.nombre);
+        return ESP_FAIL;
+    }
+    for (uint32_t indice = enviadas; indice < total && res == ESP_OK; indice += leidos) {
+        size_t max = (total - indice < MUESTRAS_BIN_LOTE) ? total - indice : MUESTRAS_BIN_LOTE;
+        if (muestras_bin_leer_en(ruta, indice, lote, max, &leidos) != ESP_OK || leidos == 0 ||
+            fwrite(lote, sizeof(muestra_bin_t), leidos, cola) != leidos) {
+            res = ESP_FAIL;
+        }
+    }
+    uint32_t reservados = pendientes;
+    if (res == ESP_OK && objetivo > 0) {
+        reservados = muestras_bin_rellenar(cola, pendientes, pendientes + objetivo);
+    }
+    if (fclose(cola) != 0 || res != ESP_OK) {
+        ESP_LOGE(MUESTRAS_BIN_TAG, "Error al copiar la cola sin enviar a %s", temporal);
+        espacio_remove(temporal);
+        muestras_bin_rotacion_deshacer(seg.nombre);
+        return ESP_FAIL;
+    }
+    espacio_archivo(temporal, 0);
+
+    // 3. La cola pasa a ser el registro activo; desde aquí muestras_bin_preparar() completa la rotación
+    if (espacio_remove(ruta) != 0) {
+        ESP_LOGE(MUESTRAS_BIN_TAG, "Error al borrar %s", ruta);
+        espacio_remove(temporal);
+        muestras_bin_rotacion_deshacer(seg.nombre);
+        return ESP_FAIL;
+    }
+    // Sin borrar la anotación, preparar() igual reconoce el archivo nuevo por su cabecera
+    muestras_bin_rotacion_anotar(NULL);
+    muestras_bin_cursor_nuevo_segmento();
+    muestras_bin_cursor_guardar(true);
+    if (rename(temporal, ruta) != 0) {
+        ESP_LOGE(MUESTRAS_BIN_TAG, "Error al activar %s", temporal);
+        return ESP_FAIL;
+    }
+    registros = pendientes;
+    confirmados = pendientes;
+    asignados = reservados;
+    ESP_LOGI(MUESTRAS_BIN_TAG, "Segmento %s archivado: %u muestras en %u bloques (%u bytes, %u sin comprimir), "
+             "%u pendientes siguen en %s", seg.nombre, (unsigned)escritor.muestras, (unsigned)escritor.bloques,
+             (unsigned)(escritor.bloques * COMPRESION_BLOQUE_BYTES), (unsigned)(enviadas * sizeof(muestra_bin_t)),
+             (unsigned)(total - enviadas), MUESTRAS_BIN_RUTA);
+
+    muestras_bin_depurar();
+    return ESP_OK;
+}
+
+// Segmento archivado (AAMMDDNN.cmp o .bin, de versiones anteriores)
+static bool muestras_bin_es_segmento(const char *nombre, int *aa, int *mm, int *dd, char extension[4]) {
+    return sscanf(nombre, "%2d%2d%2d%*2d.%3s", aa, mm, dd, extension) == 4 &&
+           (strcasecmp(extension, "cmp") == 0 || strcasecmp(extension, "bin") == 0);
+}
+
+// Nombre del segmento más viejo de 'directorio' (AAMMDDNN ordena por fecha); false si no queda ninguno
+static bool muestras_bin_mas_viejo(const char *directorio, char *nombre, size_t tam) {
+    DIR *dir = opendir(directorio);
+    if (dir == NULL) {
+        return false;
+    }
+    bool hay = false;
+    struct dirent *entrada;
+    while ((entrada = readdir(dir)) != NULL) {
+        int aa, mm, dd;
+        char extension[4];
+        if (muestras_bin_es_segmento(entrada->d_name, &aa, &mm, &dd, extension) &&
+            (!hay || strcasecmp(entrada->d_name, nombre) < 0)) {
+            snprintf(nombre, tam, "%s", entrada->d_name);
+            hay = true;
+        }
+    }
+    closedir(dir);
+    return hay;
+}
+
+// Espacio libre en caché por debajo de CONFIG_HALO_SD_LIBRE_MIN_MB (sin recorrer la FAT)
+static bool muestras_bin_espacio_escaso(void) {
+    espacio_t espacio;
+    espacio_get(&espacio);
+    return CONFIG_HALO_SD_LIBRE_MIN_MB > 0 && espacio.valido &&
+           espacio.libres_bytes < (uint64_t)CONFIG_HALO_SD_LIBRE_MIN_MB * 1024 * 1024;
+}
+
+/**
+ * @brief Aplica la retención del histórico (llamar con sistema.mutex_sd)
+ *
+ * Borra los segmentos con más de CONFIG_HALO_SD_RETENCION_DIAS. La antigüedad
+ * sale del nombre (fecha de la primera muestra), así que también se borran
+ * segmentos que un corte dejó fuera del manifiesto. Si después el espacio libre
+ * en caché sigue por debajo de CONFIG_HALO_SD_LIBRE_MIN_MB, se borran los más
+ * viejos hasta recuperarlo (todo el histórico ya se envió). Al final el
+ * manifiesto se reescribe sin las filas de archivos que ya no existen.
+ */
+esp_err_t muestras_bin_depurar(void) {
+    if (!sdcard_info.is_mounted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Sin hora confiable no se puede medir la antigüedad
+    time_t ahora = time(NULL);
+    bool por_edad = CONFIG_HALO_SD_RETENCION_DIAS > 0 && ahora >= (time_t)MUESTRAS_BIN_EPOCH_MIN;
+    time_t limite = ahora - (time_t)CONFIG_HALO_SD_RETENCION_DIAS * 86400;
+
+    char directorio[128];
+    char ruta[128];
+    muestras_bin_ruta(directorio, sizeof(directorio), MUESTRAS_BIN_DIR_HISTORICO);
+    DIR *dir = opendir(directorio);
+    if (dir == NULL) {
+        return ESP_OK;
+    }
+    int borrados = 0;
+    int por_espacio = 0;
+    struct dirent *entrada;
+    while ((entrada = readdir(dir)) != NULL) {
+        int aa, mm, dd;
+        char extension[4];
+        if (sscanf(entrada->d_name, "%2d%2d%2d%*2d.%3s", &aa, &mm, &dd, extension) != 4) {
+            continue;
+        }
+        if (strcasecmp(extension, "tmp") == 0) {
+            // Segmento a medio escribir por un corte: se reescribe en la próxima rotación
+            snprintf(ruta, sizeof(ruta), "%s/%s", directorio, entrada->d_name);
+            espacio_remove(ruta);
+            continue;
+        }
+        if (!por_edad || (strcasecmp(extension, "cmp") != 0 && strcasecmp(extension, "bin") != 0)) {
+            continue;
+        }
+        struct tm fecha = { .tm_year = aa + 100, .tm_mon = mm - 1, .tm_mday = dd, .tm_isdst = -1 };
+        if (mktime(&fecha) < limite) {
+            snprintf(ruta, sizeof(ruta), "%s/%s", directorio, entrada->d_name);
+            if (espacio_remove(ruta) == 0) {
+                borrados++;
+            }
+        }
+    }
+    closedir(dir);
+
+    char nombre[16];
+    while (muestras_bin_espacio_escaso() && muestras_bin_mas_viejo(directorio, nombre, sizeof(nombre))) {
+        snprintf(ruta, sizeof(ruta), "%s/%s", directorio, nombre);
+        if (espacio_remove(ruta) != 0) {
+            break;
+        }
+        por_espacio++;
+    }
+    if (borrados == 0 && por_espacio == 0) {
+        return ESP_OK;
+    }
+
+    esp_err_t res = muestras_bin_manifiesto_reescribir();
+    ESP_LOGI(MUESTRAS_BIN_TAG, "Retención: %d segmentos con más de %d días y %d por espacio libre "
+             "(mínimo %d MB) borrados", borrados, CONFIG_HALO_SD_RETENCION_DIAS, por_espacio,
+             CONFIG_HALO_SD_LIBRE_MIN_MB);
+    return res;
+}
+
+// Misma fila que escribía sdcard_log_peso, más la batería y las cuentas crudas
+static int muestras_bin_a_csv(const muestra_bin_t *reg, char *linea, size_t tam) {
+    struct tm tm;
+    time_t t = (time_t)reg->epoch;
+    localtime_r(&t, &tm);
+    int n = snprintf(linea, tam, "%04d-%02d-%02d,%02d:%02d:%02d,%.2f,%d",
+                     tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                     (float)reg->peso_mg * 1e-6f, (reg->flags & MUESTRA_BIN_ESTABLE) ? 1 : 0);
+#if HX711_NUM_CANALES > 1
+    // Desglose con la calibración de celdas vigente al exportar
+    for (int c = 0; c < HX711_NUM_CANALES && n > 0 && (size_t)n < tam; c++) {
+        n += snprintf(linea + n, tam - n, ",%.2f", (float)hx711_calcular_peso_canal_mg(c, reg->raw_canal[c]) * 1e-6f);
+    }
+#endif
+    if (n > 0 && (size_t)n < tam) {
+        n += snprintf(linea + n, tam - n, ",%u,%d\n", (unsigned)reg->bateria_mv, (int)reg->raw);
+    }
+    return (n > 0 && (size_t)n < tam) ? n : -1;
+}
+
+// La exportación toma sistema.mutex_sd de a tandas de MUESTRAS_BIN_EXPORTAR_FILAS:
+// entre una y otra la tarea escritora vacía su cola y el envío lee. El CSV y los
+// archivos leídos se reabren en cada tanda (un remontaje entre tandas no los invalida).
+static bool muestras_bin_exportar_tomar(void) {
+    return xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(SISTEMA_TIMEOUT_MUTEX)) == pdTRUE;
+}
+
+/**
+ * @brief Agrega al CSV las muestras de un archivo con epoch >= 'desde' (búsqueda binaria del inicio)
+ *
+ * Con 'activo' es MUESTRAS_BIN_RUTA: en la primera tanda se vacía el registro y
+ * se toma una vista; si después cambia la generación (rotación, recorte) la
+ * exportación se corta con ESP_ERR_INVALID_STATE.
+ */
+static esp_err_t muestras_bin_exportar_archivo(const char *ruta_csv, const char *ruta, bool activo, const char *etiqueta,
+                                               uint32_t desde, uint32_t *ok, uint32_t *corruptas) {
+    char linea[128];
+    muestras_bin_vista_t vista = { 0 };
+    uint32_t inicio = 0;
+    uint32_t indice = 0;
+    uint32_t total = 0;
+    bool primera = true;
+    esp_err_t res = ESP_OK;
+    while (res == ESP_OK && (primera || indice < total)) {
+        if (!muestras_bin_exportar_tomar()) {
+            return ESP_ERR_TIMEOUT;
+        }
+        if (primera) {
+            if (activo) {
+                sdcard_registros_vaciar(false);
+                muestras_bin_vista(&vista);
+                total = vista.total;
+            } else {
+                total = muestras_bin_contar_en(ruta);
+            }
+            inicio = (desde > 0) ? muestras_bin_buscar_en(ruta, 0, total, desde - 1, NULL) : 0;
+            indice = inicio;
+            primera = false;
+        }
+        FILE *csv = NULL;
+        if (activo && !muestras_bin_vista_vigente(&vista)) {
+            res = ESP_ERR_INVALID_STATE;
+        } else if (indice < total && (!sdcard_info.is_mounted || (csv = fopen(ruta_csv, "a")) == NULL)) {
+            res = ESP_FAIL;
+        }
+        uint32_t hasta = (total - indice < MUESTRAS_BIN_EXPORTAR_FILAS) ? total : indice + MUESTRAS_BIN_EXPORTAR_FILAS;
+        while (res == ESP_OK && indice < hasta) {
+            size_t leidos = 0;
+            size_t max = (hasta - indice < MUESTRAS_BIN_LOTE) ? hasta - indice : MUESTRAS_BIN_LOTE;
+            if (muestras_bin_leer_en(ruta, indice, lote, max, &leidos) != ESP_OK || leidos == 0) {
+                res = ESP_FAIL;
+                break;
+            }
+            for (size_t i = 0; i < leidos; i++) {
+                if (!muestras_bin_valido(&lote[i])) {
+                    (*corruptas)++;
+                    continue;
+                }
+                if (muestras_bin_a_csv(&lote[i], linea, sizeof(linea)) > 0 && fputs(linea, csv) >= 0) {
+                    (*ok)++;
+                }
+            }
+            indice += leidos;
+        }
+        if (csv != NULL && fclose(csv) != 0) {
+            res = ESP_FAIL;
+        }
+        xSemaphoreGive(sistema.mutex_sd);
+        if (res == ESP_OK && total > inicio) {
+            comandos_publicar_avance((int)((uint64_t)(indice - inicio) * 100 / (total - inicio)), etiqueta);
+        }
+    }
+    return res;
+}
+
+// Igual para un segmento comprimido: los bloques anteriores a 'desde' se saltan
+// sin decodificar. Cada tanda reabre el segmento y sigue desde el byte en que
+// quedó; el bloque en curso sigue decodificado en el lector.
+static esp_err_t muestras_bin_exportar_comprimido(const char *ruta_csv, const char *ruta, uint32_t desde,
+                                                  uint32_t *ok, uint32_t *corruptas) {
+    static compresion_lector_t lector;
+    char linea[128];
+    long pos = 0;
+    bool fin = false;
+    esp_err_t res = ESP_OK;
+    compresion_lector_iniciar(&lector, NULL);
+    while (res == ESP_OK && !fin) {
+        if (!muestras_bin_exportar_tomar()) {
+            return ESP_ERR_TIMEOUT;
+        }
+        struct stat st = { 0 };
+        FILE *csv = NULL;
+        FILE *f = fopen(ruta, "rb");
+        if (f == NULL || fstat(fileno(f), &st) != 0 || st.st_size == 0) {
+            // Segmento sin registros válidos, o borrado por la retención entre tandas
+            fin = true;
+        } else if (fseek(f, pos, SEEK_SET) != 0 || (csv = fopen(ruta_csv, "a")) == NULL) {
+            res = ESP_FAIL;
+        } else {
+            lector.f = f;
+            muestra_bin_t reg;
+            for (uint32_t n = 0; n < MUESTRAS_BIN_EXPORTAR_FILAS; n++) {
+                if (compresion_lector_siguiente(&lector, desde, &reg) != ESP_OK) {
+                    fin = true;
+                    break;
+                }
+                if (muestras_bin_a_csv(&reg, linea, sizeof(linea)) > 0 && fputs(linea, csv) >= 0) {
+                    (*ok)++;
+                }
+            }
+            pos = ftell(f);
+            if (fclose(csv) != 0) {
+                res = ESP_FAIL;
+            }
+        }
+        if (f != NULL) {
+            fclose(f);
+        }
+        xSemaphoreGive(sistema.mutex_sd);
+        if (res == ESP_OK && !fin) {
+            comandos_publicar_avance((int)((int64_t)pos * 100 / st.st_size), "exportando histórico");
+        }
+    }
+    if (lector.bloques_invalidos > 0) {
+        ESP_LOGW(MUESTRAS_BIN_TAG, "%s: %u bloques con CRC inválido omitidos", ruta, (unsigned)lector.bloques_invalidos);
+    }
+    *corruptas += lector.bloques_invalidos;
+    return res;
+}
+
+// Próximo segmento del manifiesto después de 'ultimo' (por nombre, que sigue
+// la fecha) que llega a 'desde'. Se relee en cada paso: la retención puede
+// reescribir el manifiesto entre tandas.
+static bool muestras_bin_manifiesto_despues(uint32_t desde, const char *ultimo, muestras_bin_segmento_t *seg) {
+    char ruta[128];
+    muestras_bin_ruta(ruta, sizeof(ruta), MUESTRAS_BIN_RUTA_MANIFIESTO);
+    FILE *f = fopen(ruta, "r");
+    if (f == NULL) {
+        return false;
+    }
+    bool hay = false;
+    muestras_bin_segmento_t fila;
+    while (muestras_bin_manifiesto_siguiente(f, &fila)) {
+        if (fila.ultima < desde || strcmp(fila.nombre, ultimo) <= 0) {
+            continue;
+        }
+        if (!hay || strcmp(fila.nombre, seg->nombre) < 0) {
+            *seg = fila;
+            hay = true;
+        }
+    }
+    fclose(f);
+    return hay;
+}
+
+/**
+ * @brief Exporta muestras a MUESTRAS_BIN_RUTA_CSV (llamar sin sistema.mutex_sd: lo toma por tandas)
+ *
+ * Con 'desde' = 0 solo se exporta el registro activo. Con un epoch se agregan
+ * antes los segmentos del histórico que según el manifiesto llegan a esa hora;
+ * el resto no se abre. Los registros con CRC inválido se omiten y se cuentan en el log.
+ */
+esp_err_t muestras_bin_exportar_csv(uint32_t desde, uint32_t *exportadas) {
+    char ruta_csv[128];
+    muestras_bin_ruta(ruta_csv, sizeof(ruta_csv), MUESTRAS_BIN_RUTA_CSV);
+    if (exportadas != NULL) {
+        *exportadas = 0;
+    }
+    if (!muestras_bin_exportar_tomar()) {
+        return ESP_ERR_TIMEOUT;
+    }
+    if (!sdcard_info.is_mounted) {
+        xSemaphoreGive(sistema.mutex_sd);
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint64_t antes = espacio_tam(ruta_csv);
+    FILE *csv = fopen(ruta_csv, "w");
+    if (csv != NULL) {
+        fprintf(csv, "Fecha,Hora,Peso_kg,Estable");
+        for (int c = 0; HX711_NUM_CANALES > 1 && c < HX711_NUM_CANALES; c++) {
+            fprintf(csv, ",Celda%d_kg", c);
+        }
+        fprintf(csv, ",Bateria_mV,Raw\n");
+    }
+    esp_err_t res = (csv != NULL && fclose(csv) == 0) ? ESP_OK : ESP_FAIL;
+    xSemaphoreGive(sistema.mutex_sd);
+    if (res != ESP_OK) {
+        ESP_LOGE(MUESTRAS_BIN_TAG, "Error al crear %s", ruta_csv);
+        return res;
+    }
+
+    char ruta[128];
+    muestras_bin_segmento_t seg;
+    char ultimo[sizeof(seg.nombre)] = "";
+    uint32_t ok = 0;
+    uint32_t corruptas = 0;
+    int segmentos = 0;
+    while (desde > 0 && res == ESP_OK) {
+        struct stat st;
+        bool comprimido = false;
+        bool hay = false;
+        if (!muestras_bin_exportar_tomar()) {
+            res = ESP_ERR_TIMEOUT;
+            break;
+        }
+        while (!hay && muestras_bin_manifiesto_despues(desde, ultimo, &seg)) {
+            memcpy(ultimo, seg.nombre, sizeof(ultimo));
+            muestras_bin_ruta_segmento(ruta, sizeof(ruta), seg.nombre, "cmp");
+            comprimido = stat(ruta, &st) == 0;
+            if (!comprimido) {
+                // Segmento archivado sin comprimir (versiones anteriores)
+                muestras_bin_ruta_segmento(ruta, sizeof(ruta), seg.nombre, "bin");
+            }
+            hay = comprimido || stat(ruta, &st) == 0;
+        }
+        xSemaphoreGive(sistema.mutex_sd);
+        if (!hay) {
+            break;
+        }
+        res = comprimido ? muestras_bin_exportar_comprimido(ruta_csv, ruta, desde, &ok, &corruptas)
+                         : muestras_bin_exportar_archivo(ruta_csv, ruta, false, "exportando histórico",
+                                                         desde, &ok, &corruptas);
+        segmentos++;
+    }
+    if (res == ESP_OK) {
+        muestras_bin_ruta(ruta, sizeof(ruta), MUESTRAS_BIN_RUTA);
+        res = muestras_bin_exportar_archivo(ruta_csv, ruta, true, "exportando CSV", desde, &ok, &corruptas);
+    }
+    if (muestras_bin_exportar_tomar()) {
+        espacio_archivo(ruta_csv, antes);
+        xSemaphoreGive(sistema.mutex_sd);
+    }
+
+    ESP_LOGI(MUESTRAS_BIN_TAG, "Exportadas %u muestras a %s (%d segmentos del histórico, %u con CRC inválido)",
+             (unsigned)ok, ruta_csv, segmentos, (unsigned)corruptas);
+    if (exportadas != NULL) {
+        *exportadas = ok;
+    }
+    return res;
+}
+
+#if CONFIG_HALO_BENCHMARKS
+/**
+ * @brief Bytes por muestra y coste de decodificar: CSV (sscanf + mktime) frente a binario
+ *
+ * Ambos caminos producen lo que necesita el envío diferido: peso, hora local y epoch.
+ */
+void muestras_bin_benchmark(int muestras) {
+    if (muestras <= 0) {
+        return;
+    }
+    muestra_bin_t *regs = calloc(muestras, sizeof(muestra_bin_t));
+    char (*lineas)[64] = calloc(muestras, sizeof(*lineas));
+    if (regs == NULL || lineas == NULL) {
+        free(regs);
+        free(lineas);
+        ESP_LOGW(MUESTRAS_BIN_TAG, "⏱️ Benchmark binario omitido (sin memoria)");
+        return;
+    }
+
+    size_t bytes_csv = 0;
+    uint32_t base = 1767225600u;        // 2026-01-01 00:00:00
+    for (int i = 0; i < muestras; i++) {
+        regs[i] = (muestra_bin_t){
+            .epoch = base + (uint32_t)i * 60,
+            .raw = 8388000 - i * 37,
+            .peso_mg = 12345678 + i * 1000,
+            .bateria_mv = 3900,
+            .flags = (i & 1) ? MUESTRA_BIN_ESTABLE : 0,
+        };
+        muestras_bin_sellar(&regs[i]);
+        struct tm tm;
+        time_t t = (time_t)regs[i].epoch;
+        localtime_r(&t, &tm);
+        // Fila de pesos.csv más la de voltajes.csv que la acompañaba
+        int n = snprintf(lineas[i], sizeof(lineas[i]), "%04d-%02d-%02d,%02d:%02d:%02d,%.2f,%d\n",
+                         tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                         (float)regs[i].peso_mg * 1e-6f, (i & 1));
+        char voltaje[40];
+        int nv = snprintf(voltaje, sizeof(voltaje), "%04d-%02d-%02d,%02d:%02d:%02d,%.2f\n",
+                          tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                          regs[i].bateria_mv / 1000.0f);
+        bytes_csv += (size_t)n + (size_t)nv;
+    }
+
+    volatile float sumidero = 0.0f;
+    uint32_t t0 = esp_cpu_get_cycle_count();
+    for (int i = 0; i < muestras; i++) {
+        int y, m, d, h, min, s;
+        float p;
+        if (sscanf(lineas[i], "%d-%d-%d,%d:%d:%d,%f", &y, &m, &d, &h, &min, &s, &p) == 7) {
+            struct tm tm = { .tm_year = y - 1900, .tm_mon = m - 1, .tm_mday = d,
+                             .tm_hour = h, .tm_min = min, .tm_sec = s };
+            sumidero += p + (float)(mktime(&tm) & 1);
+        }
+    }
+    uint32_t ciclos_csv = esp_cpu_get_cycle_count() - t0;
+
+    t0 = esp_cpu_get_cycle_count();
+    for (int i = 0; i < muestras; i++) {
+        if (muestras_bin_valido(&regs[i])) {
+            struct tm tm;
+            time_t t = (time_t)regs[i].epoch;
+            localtime_r(&t, &tm);
+            sumidero += (float)regs[i].peso_mg * 1e-6f + (float)(tm.tm_sec & 1);
+        }
+    }
+    uint32_t ciclos_bin = esp_cpu_get_cycle_count() - t0;
+    (void)sumidero;
+
+    ESP_LOGI(MUESTRAS_BIN_TAG, "⏱️ Bytes por muestra: CSV %u (pesos + voltajes), binario %u",
+             (unsigned)(bytes_csv / muestras), (unsigned)sizeof(muestra_bin_t));
+    ESP_LOGI(MUESTRAS_BIN_TAG, "⏱️ Decodificación: CSV %u ciclos/muestra, binario %u ciclos/muestra (CRC + hora local)",
+             (unsigned)(ciclos_csv / muestras), (unsigned)(ciclos_bin / muestras));
+    free(regs);
+    free(lineas);
+
+    // Ubicar el fin de un lote en el archivo real: búsqueda binaria frente a recorrido lineal
+    if (sdcard_info.is_mounted && xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(1000)) == pdTRUE) {
+        uint32_t total = muestras_bin_contar();
+        if (total > 0) {
+            muestra_bin_t ultimo;
+            size_t leidos = 0;
+            if (muestras_bin_leer(total - 1, &ultimo, 1, &leidos) == ESP_OK && leidos == 1) {
+                uint32_t lecturas = 0;
+                int64_t t_inicio = esp_timer_get_time();
+                uint32_t fin = muestras_bin_buscar_epoch(0, total, ultimo.epoch - 1, &lecturas);
+                uint32_t us_busqueda = (uint32_t)(esp_timer_get_time() - t_inicio);
+
+                uint32_t recorridas = 0;
+                t_inicio = esp_timer_get_time();
+                while (recorridas < fin) {
+                    if (muestras_bin_leer(recorridas, lote, MUESTRAS_BIN_LOTE, &leidos) != ESP_OK ||
+                        leidos == 0) {
+                        break;
+                    }
+                    recorridas += leidos;
+                }
+                uint32_t us_lineal = (uint32_t)(esp_timer_get_time() - t_inicio);
+                ESP_LOGI(MUESTRAS_BIN_TAG, "⏱️ Búsqueda por hora en %u registros: binaria %u us (%u lecturas), lineal %u us",
+                         (unsigned)total, (unsigned)us_busqueda, (unsigned)lecturas, (unsigned)us_lineal);
+            }
+        }
+        xSemaphoreGive(sistema.mutex_sd);
+    }
+}
+#endif // CONFIG_HALO_BENCHMARKS
@@ -0,0 +1,119 @@
+#include "../include/muestreo.h"
+#include "../include/HALO.h"
+#include <esp_timer.h>
+
+static const char *MUESTREO_TAG = "MUESTREO";
+
+_Static_assert((CONFIG_HALO_MUESTREO_CAPACIDAD & (CONFIG_HALO_MUESTREO_CAPACIDAD - 1)) == 0,
+               "CONFIG_HALO_MUESTREO_CAPACIDAD debe ser potencia de 2");
+
+static muestra_t buffers[MUESTREO_NUM_CONSUMIDORES][CONFIG_HALO_MUESTREO_CAPACIDAD];
+static cola_spsc_t colas[MUESTREO_NUM_CONSUMIDORES];
+static atomic_bool habilitados[MUESTREO_NUM_CONSUMIDORES];
+static volatile uint32_t muestras_ok = 0;
+static volatile uint32_t muestras_error = 0;
+
+static const char *nombres_consumidor[MUESTREO_NUM_CONSUMIDORES] = {
+    "registro",
+    "vivo",
+};
+
+void create_task_muestreo(void) {
+    for (int i = 0; i < MUESTREO_NUM_CONSUMIDORES; i++) {
+        cola_spsc_init(&colas[i], buffers[i], sizeof(muestra_t), CONFIG_HALO_MUESTREO_CAPACIDAD);
+        atomic_init(&habilitados[i], false);
+    }
+    // El registro en SD siempre consume; la publicación en vivo se habilita al conectar
+    atomic_store(&habilitados[MUESTREO_CONSUMIDOR_REGISTRO], true);
+
+    xTaskCreatePinnedToCore(
+        task_muestreo,                  // Función de la tarea
+        "HX711_Muestreo",               // Nombre descriptivo
+        TAREA_MUESTREO_STACK_SIZE,      // Stack: 2560 bytes
+        NULL,                           // Parámetros
+        TAREA_MUESTREO_PRIORIDAD,       // Prioridad: 7 (por encima del registro)
+        NULL,                           // Handle (no necesario)
+        NUCLEO_PROTOCOLO                // NÚCLEO 0: junto al resto del HX711
+    );
+}
+
+void task_muestreo(void *pvParameters) {
+    uint32_t secuencia = 0;
+
+    while (1) {
+        int32_t raw;
+#if HX711_NUM_CANALES > 1
+        int32_t raw_canal[HX711_NUM_CANALES];
+        esp_err_t res = hx711_leer_raw_canales(&raw, raw_canal);
+#else
+        esp_err_t res = hx711_leer_raw(&raw);
+#endif
+        if (res != ESP_OK) {
+            muestras_error++;
+            vTaskDelay(100 / portTICK_PERIOD_MS);
+            continue;
+        }
+        muestras_ok++;
+
+        muestra_t muestra = {
+            .t_us = esp_timer_get_time(),
+            .epoch = (uint32_t)time(NULL),
+            .raw = raw,
+            .secuencia = secuencia++,
+        };
+#if HX711_NUM_CANALES > 1
+        memcpy(muestra.raw_canal, raw_canal, sizeof(raw_canal));
+#endif
+        for (int i = 0; i < MUESTREO_NUM_CONSUMIDORES; i++) {
+            if (atomic_load_explicit(&habilitados[i], memory_order_relaxed)) {
+                cola_spsc_push(&colas[i], &muestra);
+            }
+        }
+
+#if !CONFIG_HX711_DATA_READY_IRQ && !CONFIG_HX711_SIM_BACKEND
+        // En modo sondeo la lectura no bloquea: ceder la CPU al resto del núcleo
+        vTaskDelay(1);
+#endif
+    }
+}
+
+void muestreo_habilitar(muestreo_consumidor_t consumidor, bool habilitado) {
+    if (consumidor >= MUESTREO_NUM_CONSUMIDORES) {
+        return;
+    }
+    bool anterior = atomic_exchange(&habilitados[consumidor], habilitado);
+    if (habilitado && !anterior) {
+        // Lo llama el propio consumidor: descarta muestras viejas
+        cola_spsc_vaciar(&colas[consumidor]);
+    }
+}
+
+bool muestreo_leer(muestreo_consumidor_t consumidor, muestra_t *muestra) {
+    if (consumidor >= MUESTREO_NUM_CONSUMIDORES || muestra == NULL) {
+        return false;
+    }
+    return cola_spsc_pop(&colas[consumidor], muestra);
+}
+
+void muestreo_get_stats(muestreo_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    stats->muestras = muestras_ok;
+    stats->errores = muestras_error;
+    for (int i = 0; i < MUESTREO_NUM_CONSUMIDORES; i++) {
+        cola_spsc_get_stats(&colas[i], &stats->colas[i]);
+    }
+}
+
+void muestreo_log_stats(void) {
+    muestreo_stats_t stats;
+    muestreo_get_stats(&stats);
+    ESP_LOGI(MUESTREO_TAG, "Muestras: %u | errores: %u", (unsigned)stats.muestras, (unsigned)stats.errores);
+    for (int i = 0; i < MUESTREO_NUM_CONSUMIDORES; i++) {
+        ESP_LOGI(MUESTREO_TAG, "Cola %s: %u/%u (max %u) | desbordes: %u",
+                 nombres_consumidor[i],
+                 (unsigned)stats.colas[i].ocupacion, (unsigned)stats.colas[i].capacidad,
+                 (unsigned)stats.colas[i].max_ocupacion, (unsigned)stats.colas[i].desbordes);
+    }
+}
@@ -89,6 +89,7 @@ static esp_err_t ota_http_event_handler(esp_http_client_event_t *evt) {
                     ESP_LOGI(OTA_TAG, "📥 Progreso: %d%% (%d/%d bytes)",
                             progress, ota_config.downloaded_size, ota_config.total_size);
                     ota_config.last_progress_log = current_time;
+                    comandos_publicar_avance(progress, "descargando");
                 }
             }
             break;
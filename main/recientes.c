@@ -0,0 +1,119 @@
+#include "../include/recientes.h"
+#include "../include/HALO.h"
+#include <esp_attr.h>
+
+static const char *RECIENTES_TAG = "RECIENTES";
+
+typedef struct {
+    uint32_t magia;                     // RECIENTES_MAGIA si el contenido es válido
+    uint32_t fin;                       // Secuencia de la próxima muestra
+    uint32_t cantidad;                  // Muestras retenidas (las de [fin - cantidad, fin))
+    muestra_bin_t regs[CONFIG_HALO_RECIENTES_MUESTRAS];
+} recientes_anillo_t;
+
+#if CONFIG_HALO_RECIENTES_RTC
+// La memoria RTC lenta del ESP32 es de 8 KB y la comparten otros componentes
+// (los rangos de HALO_RECIENTES_MUESTRAS en Kconfig siguen este límite)
+_Static_assert(sizeof(recientes_anillo_t) <= 6144, "caché de muestras demasiado grande para la memoria RTC");
+static RTC_NOINIT_ATTR recientes_anillo_t anillo;
+#else
+static recientes_anillo_t anillo;
+#endif
+
+static portMUX_TYPE recientes_lock = portMUX_INITIALIZER_UNLOCKED;
+static recientes_stats_t stats;
+
+void recientes_init(void) {
+    uint32_t validas = 0;
+    if (anillo.magia == RECIENTES_MAGIA && anillo.cantidad <= CONFIG_HALO_RECIENTES_MUESTRAS) {
+        // Se conserva la cola de muestras con CRC válido más reciente
+        while (validas < anillo.cantidad &&
+               muestras_bin_valido(&anillo.regs[(anillo.fin - 1 - validas) % CONFIG_HALO_RECIENTES_MUESTRAS])) {
+            validas++;
+        }
+    }
+    if (validas == 0) {
+        memset(&anillo, 0, sizeof(anillo));
+        anillo.magia = RECIENTES_MAGIA;
+    } else {
+        anillo.cantidad = validas;
+        ESP_LOGI(RECIENTES_TAG, "Caché de muestras restaurada de la memoria RTC: %u muestras", (unsigned)validas);
+    }
+    stats.restauradas = validas;
+}
+
+void recientes_agregar(const muestra_bin_t *reg) {
+    if (reg == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&recientes_lock);
+    anillo.regs[anillo.fin % CONFIG_HALO_RECIENTES_MUESTRAS] = *reg;
+    anillo.fin++;
+    if (anillo.cantidad < CONFIG_HALO_RECIENTES_MUESTRAS) {
+        anillo.cantidad++;
+    }
+    stats.agregadas++;
+    portEXIT_CRITICAL(&recientes_lock);
+}
+
+uint32_t recientes_ventana(uint32_t *primera) {
+    portENTER_CRITICAL(&recientes_lock);
+    uint32_t fin = anillo.fin;
+    uint32_t cantidad = anillo.cantidad;
+    portEXIT_CRITICAL(&recientes_lock);
+    if (primera != NULL) {
+        *primera = fin - cantidad;
+    }
+    return fin;
+}
+
+bool recientes_leer(uint32_t secuencia, muestra_bin_t *reg) {
+    if (reg == NULL) {
+        return false;
+    }
+    bool ok = false;
+    portENTER_CRITICAL(&recientes_lock);
+    // Distancia desde la última (en aritmética modular: tolera el desborde de la secuencia)
+    uint32_t atras = anillo.fin - 1 - secuencia;
+    if (atras < anillo.cantidad) {
+        *reg = anillo.regs[secuencia % CONFIG_HALO_RECIENTES_MUESTRAS];
+        stats.de_cache++;
+        ok = true;
+    }
+    portEXIT_CRITICAL(&recientes_lock);
+    return ok;
+}
+
+bool recientes_ultima(muestra_bin_t *reg) {
+    return recientes_ultimas(reg, 1) == 1;
+}
+
+size_t recientes_ultimas(muestra_bin_t *regs, size_t max) {
+    if (regs == NULL || max == 0) {
+        return 0;
+    }
+    portENTER_CRITICAL(&recientes_lock);
+    size_t n = (anillo.cantidad < max) ? anillo.cantidad : max;
+    uint32_t secuencia = anillo.fin - (uint32_t)n;
+    for (size_t i = 0; i < n; i++, secuencia++) {
+        regs[i] = anillo.regs[secuencia % CONFIG_HALO_RECIENTES_MUESTRAS];
+    }
+    stats.de_cache += n;
+    portEXIT_CRITICAL(&recientes_lock);
+    return n;
+}
+
+void recientes_contar_sd(uint32_t muestras) {
+    portENTER_CRITICAL(&recientes_lock);
+    stats.de_sd += muestras;
+    portEXIT_CRITICAL(&recientes_lock);
+}
+
+void recientes_get_stats(recientes_stats_t *out) {
+    if (out == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&recientes_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&recientes_lock);
+}
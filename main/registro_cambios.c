@@ -0,0 +1,217 @@
+#include "../include/registro_cambios.h"
+#include "../include/HALO.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *REGISTRO_TAG = "REGISTRO";
+
+typedef enum {
+    MOTIVO_NINGUNO = 0,
+    MOTIVO_PERIODO,
+    MOTIVO_BANDA,
+    MOTIVO_LATIDO,
+} registro_motivo_t;
+
+static registro_config_t config = REGISTRO_CONFIG_DEFECTO;
+static portMUX_TYPE registro_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+// Estado del consumidor de registro (solo lo toca task_HX711)
+static int32_t ventana[REGISTRO_ESTABLE_MAX_N];
+static uint8_t ventana_pos = 0;
+static uint8_t ventana_llenos = 0;
+static int32_t ultimo_guardado_mg = 0;
+static bool hay_guardado = false;
+static uint32_t t_ultimo_ms = 0;
+static uint32_t t_evaluacion_ms = 0;
+static uint32_t t_inicio_ms = 0;
+static registro_motivo_t motivo_pendiente = MOTIVO_NINGUNO;
+static registro_stats_t stats;
+
+static esp_err_t registro_guardar_nvs(const registro_config_t *cfg) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs_handle, NVS_KEY_REGISTRO, cfg, sizeof(*cfg));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    return err;
+}
+
+void registro_init(void) {
+    nvs_handle_t nvs_handle;
+    registro_config_t leida;
+    size_t tam = sizeof(leida);
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK) {
+        if (nvs_get_blob(nvs_handle, NVS_KEY_REGISTRO, &leida, &tam) == ESP_OK && tam == sizeof(leida) &&
+            leida.estable_n >= 1 && leida.estable_n <= REGISTRO_ESTABLE_MAX_N) {
+            config = leida;
+        }
+        nvs_close(nvs_handle);
+    }
+    t_inicio_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    ESP_LOGI(REGISTRO_TAG, "Registro %s - banda %u g, latido %u s, estable %u g / %u muestras",
+             config.modo == REGISTRO_MODO_CAMBIOS ? "por cambios" : "periódico",
+             (unsigned)(config.banda_mg / 1000), (unsigned)config.latido_s,
+             (unsigned)(config.estable_mg / 1000), (unsigned)config.estable_n);
+}
+
+void registro_actualizar(int32_t peso_mg) {
+    ventana[ventana_pos] = peso_mg;
+    ventana_pos = (ventana_pos + 1) % REGISTRO_ESTABLE_MAX_N;
+    if (ventana_llenos < REGISTRO_ESTABLE_MAX_N) {
+        ventana_llenos++;
+    }
+}
+
+// Estable si las últimas n muestras caben en una ventana de estable_mg
+static bool registro_es_estable(uint8_t n, uint32_t estable_mg) {
+    if (ventana_llenos < n) {
+        return false;
+    }
+    int32_t min = INT32_MAX;
+    int32_t max = INT32_MIN;
+    for (uint8_t i = 0; i < n; i++) {
+        int32_t v = ventana[(ventana_pos + REGISTRO_ESTABLE_MAX_N - 1 - i) % REGISTRO_ESTABLE_MAX_N];
+        if (v < min) min = v;
+        if (v > max) max = v;
+    }
+    return (uint32_t)(max - min) <= estable_mg;
+}
+
+bool registro_estable(void) {
+    registro_config_t cfg;
+    portENTER_CRITICAL(&registro_spinlock);
+    cfg = config;
+    portEXIT_CRITICAL(&registro_spinlock);
+    return registro_es_estable(cfg.estable_n, cfg.estable_mg);
+}
+
+bool registro_evaluar(bool hay_muestra, int32_t peso_mg, uint32_t ahora_ms, bool *estable) {
+    registro_config_t cfg;
+    portENTER_CRITICAL(&registro_spinlock);
+    cfg = config;
+    portEXIT_CRITICAL(&registro_spinlock);
+
+    motivo_pendiente = MOTIVO_NINGUNO;
+    t_evaluacion_ms = ahora_ms;
+    *estable = registro_es_estable(cfg.estable_n, cfg.estable_mg);
+
+    if (cfg.modo == REGISTRO_MODO_PERIODICO) {
+        if (ahora_ms - t_ultimo_ms < (uint32_t)sistema.envio.muestreo_ms) {
+            return false;
+        }
+        t_ultimo_ms = ahora_ms;
+        if (hay_muestra) {
+            stats.evaluadas++;
+        }
+        motivo_pendiente = MOTIVO_PERIODO;
+        return true;
+    }
+
+    if (!hay_muestra) {
+        return false;
+    }
+    stats.evaluadas++;
+
+    if (!hay_guardado || ahora_ms - t_ultimo_ms >= cfg.latido_s * 1000U) {
+        motivo_pendiente = MOTIVO_LATIDO;
+    } else if (*estable && (uint32_t)abs(peso_mg - ultimo_guardado_mg) > cfg.banda_mg) {
+        // Solo cambios asentados: los transitorios no generan filas
+        motivo_pendiente = MOTIVO_BANDA;
+    }
+    return motivo_pendiente != MOTIVO_NINGUNO;
+}
+
+void registro_confirmar(int32_t peso_mg, bool estable) {
+    stats.guardadas++;
+    if (motivo_pendiente == MOTIVO_BANDA) {
+        stats.por_banda++;
+    } else if (motivo_pendiente == MOTIVO_LATIDO) {
+        stats.por_latido++;
+    }
+    if (estable) {
+        stats.estables++;
+    }
+    ultimo_guardado_mg = peso_mg;
+    hay_guardado = true;
+    if (motivo_pendiente != MOTIVO_PERIODO) {
+        t_ultimo_ms = t_evaluacion_ms;
+    }
+    motivo_pendiente = MOTIVO_NINGUNO;
+}
+
+esp_err_t registro_configurar(const char *clave_valor) {
+    char clave[16];
+    const char *igual = (clave_valor != NULL) ? strchr(clave_valor, '=') : NULL;
+    if (igual == NULL || (size_t)(igual - clave_valor) >= sizeof(clave)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(clave, clave_valor, igual - clave_valor);
+    clave[igual - clave_valor] = '\0';
+    const char *valor = igual + 1;
+    long v = strtol(valor, NULL, 10);
+
+    registro_config_t nueva;
+    portENTER_CRITICAL(&registro_spinlock);
+    nueva = config;
+    portEXIT_CRITICAL(&registro_spinlock);
+
+    if (strcmp(clave, "modo") == 0) {
+        if (strcmp(valor, "cambios") == 0) {
+            nueva.modo = REGISTRO_MODO_CAMBIOS;
+        } else if (strcmp(valor, "periodico") == 0) {
+            nueva.modo = REGISTRO_MODO_PERIODICO;
+        } else {
+            return ESP_ERR_INVALID_ARG;
+        }
+    } else if (strcmp(clave, "banda_g") == 0 && v >= 0 && v <= 1000000) {
+        nueva.banda_mg = (uint32_t)v * 1000;
+    } else if (strcmp(clave, "latido_s") == 0 && v >= 10 && v <= 86400) {
+        nueva.latido_s = (uint32_t)v;
+    } else if (strcmp(clave, "estable_g") == 0 && v >= 0 && v <= 1000000) {
+        nueva.estable_mg = (uint32_t)v * 1000;
+    } else if (strcmp(clave, "estable_n") == 0 && v >= 1 && v <= REGISTRO_ESTABLE_MAX_N) {
+        nueva.estable_n = (uint8_t)v;
+    } else if (strcmp(clave, "banda_g") == 0 || strcmp(clave, "latido_s") == 0 ||
+               strcmp(clave, "estable_g") == 0 || strcmp(clave, "estable_n") == 0) {
+        return ESP_ERR_INVALID_ARG;
+    } else {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    portENTER_CRITICAL(&registro_spinlock);
+    config = nueva;
+    portEXIT_CRITICAL(&registro_spinlock);
+
+    esp_err_t err = registro_guardar_nvs(&nueva);
+    if (err != ESP_OK) {
+        ESP_LOGE(REGISTRO_TAG, "❌ Error al guardar configuración de registro: %s", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(REGISTRO_TAG, "✅ Registro actualizado: %s", clave_valor);
+    return ESP_OK;
+}
+
+void registro_get_config(registro_config_t *cfg) {
+    if (cfg == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&registro_spinlock);
+    *cfg = config;
+    portEXIT_CRITICAL(&registro_spinlock);
+}
+
+void registro_get_stats(registro_stats_t *out) {
+    if (out == NULL) {
+        return;
+    }
+    *out = stats;
+    uint32_t ahora_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    uint32_t periodo = (sistema.envio.muestreo_ms > 0) ? (uint32_t)sistema.envio.muestreo_ms : 1;
+    out->equivalentes = (ahora_ms - t_inicio_ms) / periodo;
+}
@@ -4,6 +4,8 @@
 #include "esp_vfs_fat.h"
 #include "mqtt_lib.h"
 #include "../include/HALO.h"
+#include "esp_timer.h"
+#include "esp_system.h"
 static const char *TAG = "SDCARD";
 //esp_mqtt_client_handle_t mqtt_client = NULL;
 
@@ -14,6 +16,43 @@ sdcard_info_t sdcard_info = {
     .mount_point = MOUNT_POINT
 };
 
+// Registro con búfer: un archivo abierto y un búfer en RAM por CSV
+typedef struct {
+    const char *ruta;
+    FILE *f;
+    size_t usado;
+    uint32_t t_primera_ms;              // Llegada de la fila más antigua sin escribir
+    bool sin_sync;                      // Hay datos escritos pendientes de fsync
+    char buffer[CONFIG_HALO_SD_BUFFER_BYTES];
+} sdcard_escritor_t;
+
+static sdcard_escritor_t escritores[SDCARD_NUM_REGISTROS] = {
+    [SDCARD_REGISTRO_PESOS]    = { .ruta = MUESTRAS_BIN_RUTA },
+};
+static sdcard_stats_t stats;
+static uint32_t t_ultimo_sync_ms = 0;
+static bool registros_cerrando = false;
+static bool apagado_registrado = false;
+
+// Cola en RAM entre task_HX711 y la tarea escritora: toda muestra pasa por
+// aquí y durante un corte de la SD se acumula. Tiene su propio spinlock, así
+// que dejar una muestra nunca espera a mutex_sd ni a la FAT.
+static muestra_bin_t reserva[CONFIG_HALO_SD_RESERVA_MUESTRAS];
+static uint32_t reserva_inicio = 0;
+static uint32_t reserva_cantidad = 0;
+static portMUX_TYPE reserva_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Corte de la SD en curso: los vaciados fallan sin reintentar y la tarea
+// escritora prueba con espera creciente (SDCARD_REMONTAJE_MIN_MS..CONFIG_HALO_SD_REMONTAJE_MAX_MS)
+static volatile bool sd_en_falla = false;
+static uint32_t t_inicio_falla_ms = 0;
+static TaskHandle_t tarea_escritor = NULL;
+
+static void sdcard_registros_apagado(void);
+static void task_sd_escritor(void *pvParameters);
+static uint32_t sdcard_ahora_ms(void);
+static uint32_t sdcard_reserva_drenar(uint32_t max);
+
 esp_err_t sdcard_init(void) {
     esp_err_t ret;
     
@@ -57,32 +96,50 @@ esp_err_t sdcard_init(void) {
     slot_config.gpio_cs = PIN_NUM_CS;
     slot_config.host_id = host.slot;
 
+    // La tarea escritora existe desde el primer montaje (también si falla)
+    if (tarea_escritor == NULL) {
+        BaseType_t result = xTaskCreatePinnedToCore(
+            task_sd_escritor,               // Función de la tarea
+            "SD_Escritor",                  // Nombre descriptivo
+            TAREA_SD_STACK_SIZE,            // Stack: 4096 bytes (montaje FATFS)
+            NULL,                           // Parámetros
+            TAREA_SD_PRIORIDAD,             // Prioridad: 2 (en segundo plano)
+            &tarea_escritor,                // Handle (para despertarla con muestras nuevas)
+            NUCLEO_APLICACION               // NÚCLEO 1: aplicación y red
+        );
+        if (result != pdPASS) {
+            ESP_LOGE(TAG, "❌ No se pudo crear la tarea escritora de la SD");
+        }
+    }
+
     // Montar el sistema de archivos
     ESP_LOGI(TAG, "Montando sistema de archivos...");
-    esp_vfs_fat_sdspi_mount(sdcard_info.mount_point, &host, &slot_config,&mount_config, &sdcard_info.card);
+    ret = esp_vfs_fat_sdspi_mount(sdcard_info.mount_point, &host, &slot_config,&mount_config, &sdcard_info.card);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error al montar la SD: %s", esp_err_to_name(ret));
+        sdcard_info.card = NULL;
+        sdcard_info.is_mounted = false;
+        sdcard_falla_iniciar();
+        return ret;
+    }
 
     sdcard_info.is_mounted = true;
     ESP_LOGI(TAG, "Tarjeta SD inicializada correctamente");
+
+    // Espacio libre en caché (NVS): montar no recorre la FAT
+    espacio_montar();
     
-    // Crear archivos CSV si no existen
-    const char* csv_files[] = {"/pesos.csv"};
-    const char* headers[] = {"Fecha,Hora,Peso_kg\n"};
-    
-    for (int i = 0; i < sizeof(csv_files)/sizeof(csv_files[0]); i++) {
-        if (!sdcard_file_exists(csv_files[i])) {
-            sdcard_write_file(csv_files[i], headers[i]);
-            ESP_LOGI(TAG, "Archivo %s creado", csv_files[i]);
-        }
+    // Registro binario de pesos (cabecera versionada; recorta registros a medias)
+    if (muestras_bin_preparar() != ESP_OK) {
+        ESP_LOGE(TAG, "No se pudo preparar %s", MUESTRAS_BIN_RUTA);
+    }
+    if (agregados_preparar() != ESP_OK) {
+        ESP_LOGE(TAG, "No se pudo preparar %s", AGREGADOS_RUTA);
     }
 
-    const char* csv_filesV[] = {"/voltajes.csv"};
-    const char* headersV[] = {"Fecha,Hora,Voltaje\n"};
-    
-    for (int i = 0; i < sizeof(csv_filesV)/sizeof(csv_filesV[0]); i++) {
-        if (!sdcard_file_exists(csv_filesV[i])) {
-            sdcard_write_file(csv_filesV[i], headersV[i]);
-            ESP_LOGI(TAG, "Archivo %s creado", csv_filesV[i]);
-        }
+    // Vaciar los registros antes de cualquier esp_restart()
+    if (!apagado_registrado && esp_register_shutdown_handler(sdcard_registros_apagado) == ESP_OK) {
+        apagado_registrado = true;
     }
 
     // Mostrar información de la tarjeta
@@ -111,6 +168,13 @@ esp_err_t sdcard_unmount(void) {
         ESP_LOGW(TAG, "La tarjeta SD no está montada");
         return ESP_OK;
     }
+
+    // Vacía y cierra los registros abiertos (no-op si el cierre ya está en curso)
+    sdcard_registros_cerrar();
+    if (!sdcard_info.is_mounted) {
+        // Un error al vaciar ya desmontó la tarjeta
+        return ESP_OK;
+    }
     
     esp_vfs_fat_sdcard_unmount(sdcard_info.mount_point, sdcard_info.card);
     sdcard_info.is_mounted = false;
@@ -132,6 +196,7 @@ esp_err_t sdcard_write_file(const char *path, const char *data) {
     
     ESP_LOGI(TAG, "Escribiendo archivo: %s", full_path);
     
+    uint64_t antes = espacio_tam(full_path);
     FILE *f = fopen(full_path, "w");
     if (f == NULL) {
         ESP_LOGE(TAG, "Error al abrir archivo para escritura: %s", full_path);
@@ -140,79 +205,653 @@ esp_err_t sdcard_write_file(const char *path, const char *data) {
     
     fprintf(f, "%s", data);
     fclose(f);
+    espacio_archivo(full_path, antes);
     
     ESP_LOGI(TAG, "Archivo escrito correctamente");
     return ESP_OK;
 }
 
 
-esp_err_t sdcard_append_file(const char *path, const char *data) {
-    const int MAX_REINTENTOS = 10;
-    const int DELAY_ENTRE_INTENTOS_MS = 3000;
-    
-    for (int intento = 1; intento <= MAX_REINTENTOS; intento++) {
-        if (!sdcard_info.is_mounted) {
-            ESP_LOGW(TAG, "SD no montada (intento %d/%d). Reinicializando completamente...", intento, MAX_REINTENTOS);
-            
-            // Desmonta completamente y libera recursos
-            if (sdcard_info.card != NULL) {
-                sdcard_unmount();
-            }
-            sdcard_deinit();
-            
-            // Espera antes de reintentar
-            vTaskDelay(DELAY_ENTRE_INTENTOS_MS / portTICK_PERIOD_MS);
-            
-            // Reinicializa desde cero
-            if (sdcard_init() != ESP_OK) {
-                ESP_LOGE(TAG, "Fallo en reinicialización SD (intento %d/%d)", intento, MAX_REINTENTOS);
-                continue;
-            }
-            
-            ESP_LOGI(TAG, "SD reinicializada exitosamente en intento %d", intento);
-            if(mqtt_is_connected()){
-                esp_mqtt_client_publish(mqtt_client, "esp32/halo/status", "✅✅✅SISTEMA CONECTADO ✅✅✅", 0, 1, 0);
-                gpio_set_level(LED_USER, 0);
-                esp_mqtt_client_publish(mqtt_client, "esp32/halo/conection", "ON", 0, 1, 0);
-            }
+static uint32_t sdcard_ahora_ms(void) {
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+// Un intento de remontaje (la espera entre intentos la pone task_sd_escritor)
+static esp_err_t sdcard_remontar(void) {
+    if (sdcard_info.card != NULL) {
+        sdcard_unmount();
+    }
+    sdcard_deinit();
+    return sdcard_init();
+}
+
+// Cierra los archivos sin escribir el búfer (tras un error de E/S)
+static void sdcard_escritores_soltar(void) {
+    for (int i = 0; i < SDCARD_NUM_REGISTROS; i++) {
+        if (escritores[i].f != NULL) {
+            fclose(escritores[i].f);
+            escritores[i].f = NULL;
         }
-        
+        escritores[i].sin_sync = false;
+    }
+}
+
+/**
+ * @brief Marca el comienzo de un corte de la SD y despierta a la tarea escritora
+ */
+void sdcard_falla_iniciar(void) {
+    if (sd_en_falla) {
+        return;
+    }
+    sd_en_falla = true;
+    t_inicio_falla_ms = sdcard_ahora_ms();
+    stats.cortes++;
+    ESP_LOGW(TAG, "⚠️ SD sin respuesta: las muestras quedan en RAM (hasta %d) hasta remontarla",
+             CONFIG_HALO_SD_RESERVA_MUESTRAS);
+    if (tarea_escritor != NULL) {
+        xTaskNotifyGive(tarea_escritor);
+    }
+}
+
+// Error de E/S: cierra los archivos, desmonta y deja el remontaje a la tarea.
+// El corte se marca antes de desmontar para que el cierre no intente drenar la cola.
+static void sdcard_escritor_fallo(void) {
+    sdcard_escritores_soltar();
+    sdcard_falla_iniciar();
+    sdcard_unmount();
+}
+
+/**
+ * @brief Escribe el búfer de un registro con una sola llamada y, si se pide, fsync
+ *
+ * Si falla, el búfer se conserva para el próximo intento y la SD se desmonta;
+ * el remontaje lo hace task_sd_escritor, nunca quien está escribiendo.
+ */
+static esp_err_t sdcard_escritor_vaciar(sdcard_escritor_t *e, bool sincronizar) {
+    if (e->usado == 0 && !(sincronizar && e->sin_sync)) {
+        return ESP_OK;
+    }
+    if (!sdcard_info.is_mounted) {
+        sdcard_falla_iniciar();
+        return ESP_FAIL;
+    }
+
+    int64_t t_inicio = esp_timer_get_time();
+    bool pesos = (e == &escritores[SDCARD_REGISTRO_PESOS]);
+    if (e->f == NULL) {
         char full_path[128];
-        snprintf(full_path, sizeof(full_path), "%s%s", sdcard_info.mount_point, path);
-        
-        FILE *f = fopen(full_path, "a");
-        if (f == NULL) {
-            ESP_LOGE(TAG, "Error al abrir archivo %s (intento %d/%d)", full_path, intento, MAX_REINTENTOS);
-            // Fuerza desmontaje para próximo intento
-            sdcard_unmount();
-            if (intento < MAX_REINTENTOS) {
-                vTaskDelay(DELAY_ENTRE_INTENTOS_MS / portTICK_PERIOD_MS);
+        snprintf(full_path, sizeof(full_path), "%s%s", sdcard_info.mount_point, e->ruta);
+        // pesos.bin está preasignado: se escribe desde el fin lógico, no desde el final del archivo
+        e->f = fopen(full_path, pesos ? "r+b" : "a");
+        if (e->f != NULL && pesos &&
+            fseek(e->f, MUESTRAS_BIN_POSICION(muestras_bin_registros()), SEEK_SET) != 0) {
+            fclose(e->f);
+            e->f = NULL;
+        }
+        if (e->f == NULL) {
+            ESP_LOGE(TAG, "Error al abrir registro %s", full_path);
+            sdcard_escritor_fallo();
+            return ESP_FAIL;
+        }
+        // Sin búfer de stdio: el de RAM ya agrupa las filas y cada vaciado es un write()
+        setvbuf(e->f, NULL, _IONBF, 0);
+        stats.aperturas++;
+    }
+
+    if (e->usado > 0) {
+        if (fwrite(e->buffer, 1, e->usado, e->f) != e->usado) {
+            ESP_LOGE(TAG, "Error al escribir registro %s (%u bytes)", e->ruta, (unsigned)e->usado);
+            sdcard_escritor_fallo();
+            return ESP_FAIL;
+        }
+        stats.escrituras++;
+        stats.bytes += e->usado;
+        if (pesos) {
+            muestras_bin_agregadas(e->usado / sizeof(muestra_bin_t));
+            // Los agregados se vuelcan al mismo ritmo que las muestras crudas
+            agregados_persistir();
+        }
+        e->usado = 0;
+        e->sin_sync = true;
+    }
+    if (sincronizar && e->sin_sync) {
+        if (fsync(fileno(e->f)) != 0) {
+            ESP_LOGE(TAG, "Error en fsync de %s", e->ruta);
+            sdcard_escritor_fallo();
+            return ESP_FAIL;
+        }
+        stats.syncs++;
+        e->sin_sync = false;
+        if (pesos) {
+            muestras_bin_sincronizado();
+        }
+    }
+
+    uint32_t duracion_us = (uint32_t)(esp_timer_get_time() - t_inicio);
+    stats.vaciado_us = duracion_us;
+    if (duracion_us > stats.vaciado_max_us) {
+        stats.vaciado_max_us = duracion_us;
+    }
+    return ESP_OK;
+}
+
+// Con CONFIG_HALO_SD_SYNC_MS = 0 cada vaciado también sincroniza
+static bool sdcard_toca_sync(uint32_t ahora_ms) {
+    return CONFIG_HALO_SD_SYNC_MS == 0 || ahora_ms - t_ultimo_sync_ms >= CONFIG_HALO_SD_SYNC_MS;
+}
+
+/**
+ * @brief Agrega un registro al búfer; escribe en la SD solo si no cabe
+ *
+ * Los registros nunca se parten entre dos vaciados, así que un corte de
+ * energía deja en la SD registros completos (salvo el que se estaba escribiendo).
+ *
+ * @return ESP_OK si el registro quedó en el búfer, ESP_FAIL si no cupo y la SD no aceptó el vaciado
+ */
+esp_err_t sdcard_registrar_bytes(sdcard_registro_t registro, const void *datos, size_t len) {
+    if (registro >= SDCARD_NUM_REGISTROS || datos == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sdcard_escritor_t *e = &escritores[registro];
+    if (len > sizeof(e->buffer)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (e->usado + len > sizeof(e->buffer)) {
+        uint32_t ahora_ms = sdcard_ahora_ms();
+        bool sincronizar = sdcard_toca_sync(ahora_ms);
+        if (sdcard_escritor_vaciar(e, sincronizar) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        if (sincronizar) {
+            t_ultimo_sync_ms = ahora_ms;
+        }
+    }
+    if (e->usado == 0) {
+        e->t_primera_ms = sdcard_ahora_ms();
+    }
+    memcpy(e->buffer + e->usado, datos, len);
+    e->usado += len;
+    stats.lineas++;
+    return ESP_OK;
+}
+
+esp_err_t sdcard_registros_vaciar(bool sincronizar) {
+    esp_err_t res = ESP_OK;
+    // Lo que sigue en la cola también entra (p. ej. antes de leer pesos.bin para el envío)
+    if (!sd_en_falla && sdcard_info.is_mounted) {
+        sdcard_reserva_drenar(CONFIG_HALO_SD_RESERVA_MUESTRAS);
+    }
+    for (int i = 0; i < SDCARD_NUM_REGISTROS; i++) {
+        if (sdcard_escritor_vaciar(&escritores[i], sincronizar) != ESP_OK) {
+            res = ESP_FAIL;
+        }
+    }
+    if (sincronizar && res == ESP_OK) {
+        t_ultimo_sync_ms = sdcard_ahora_ms();
+    }
+    return res;
+}
+
+/**
+ * @brief Aplica los umbrales de tiempo: vacía filas más viejas que
+ * CONFIG_HALO_SD_FLUSH_MS y sincroniza cada CONFIG_HALO_SD_SYNC_MS
+ */
+esp_err_t sdcard_registros_mantener(void) {
+    uint32_t ahora_ms = sdcard_ahora_ms();
+    bool sincronizar = sdcard_toca_sync(ahora_ms);
+    bool vencido = false;
+    for (int i = 0; i < SDCARD_NUM_REGISTROS; i++) {
+        if (escritores[i].usado > 0 && ahora_ms - escritores[i].t_primera_ms >= CONFIG_HALO_SD_FLUSH_MS) {
+            vencido = true;
+        }
+        if (escritores[i].sin_sync && sincronizar) {
+            vencido = true;
+        }
+    }
+    if (!vencido) {
+        return ESP_OK;
+    }
+    esp_err_t res = ESP_OK;
+    for (int i = 0; i < SDCARD_NUM_REGISTROS; i++) {
+        if (escritores[i].usado > 0 && ahora_ms - escritores[i].t_primera_ms >= CONFIG_HALO_SD_FLUSH_MS) {
+            if (sdcard_escritor_vaciar(&escritores[i], sincronizar) != ESP_OK) {
+                res = ESP_FAIL;
             }
+        } else if (sincronizar && sdcard_escritor_vaciar(&escritores[i], true) != ESP_OK) {
+            res = ESP_FAIL;
+        }
+    }
+    if (sincronizar && res == ESP_OK) {
+        t_ultimo_sync_ms = ahora_ms;
+    }
+    return res;
+}
+
+void sdcard_registros_cerrar(void) {
+    if (registros_cerrando) {
+        return;
+    }
+    registros_cerrando = true;
+    if (sdcard_info.is_mounted && sdcard_registros_vaciar(true) == ESP_OK) {
+        // Al cerrar, pesos.bin se recorta al fin lógico (sin la preasignación)
+        sdcard_escritor_t *e = &escritores[SDCARD_REGISTRO_PESOS];
+        uint32_t fin = muestras_bin_registros();
+        if (e->f != NULL && muestras_bin_asignados() > fin &&
+            ftruncate(fileno(e->f), MUESTRAS_BIN_POSICION(fin)) == 0) {
+            muestras_bin_asignados_actualizar(fin);
+        }
+    }
+    sdcard_escritores_soltar();
+    espacio_guardar();
+    registros_cerrando = false;
+}
+
+/**
+ * @brief Pone una muestra sellada en la cola de RAM (no toca la SD ni mutex_sd)
+ *
+ * Con la cola llena se descarta la más antigua: se conservan las recientes.
+ */
+static void sdcard_reserva_poner(const muestra_bin_t *reg) {
+    portENTER_CRITICAL(&reserva_lock);
+    if (reserva_cantidad == CONFIG_HALO_SD_RESERVA_MUESTRAS) {
+        reserva_inicio = (reserva_inicio + 1) % CONFIG_HALO_SD_RESERVA_MUESTRAS;
+        reserva_cantidad--;
+        stats.perdidas++;
+    }
+    reserva[(reserva_inicio + reserva_cantidad) % CONFIG_HALO_SD_RESERVA_MUESTRAS] = *reg;
+    reserva_cantidad++;
+    stats.reservadas++;
+    if (reserva_cantidad > stats.reserva_max) {
+        stats.reserva_max = reserva_cantidad;
+    }
+    portEXIT_CRITICAL(&reserva_lock);
+}
+
+static uint32_t sdcard_reserva_ocupacion(void) {
+    portENTER_CRITICAL(&reserva_lock);
+    uint32_t ocupacion = reserva_cantidad;
+    portEXIT_CRITICAL(&reserva_lock);
+    return ocupacion;
+}
+
+/**
+ * @brief Pasa hasta 'max' muestras de la cola al registro con búfer (llamar con sistema.mutex_sd)
+ *
+ * Cada muestra se copia antes de sacarla: si la SD falla a mitad, sigue en la cola.
+ * Solo escribe en la SD cuando se llena el búfer del registro.
+ * @return Muestras que quedan en la cola
+ */
+static uint32_t sdcard_reserva_drenar(uint32_t max) {
+    for (uint32_t i = 0; i < max; i++) {
+        muestra_bin_t reg;
+        portENTER_CRITICAL(&reserva_lock);
+        if (reserva_cantidad == 0) {
+            portEXIT_CRITICAL(&reserva_lock);
+            break;
+        }
+        uint32_t indice = reserva_inicio;
+        reg = reserva[indice];
+        portEXIT_CRITICAL(&reserva_lock);
+
+        if (sdcard_registrar_bytes(SDCARD_REGISTRO_PESOS, &reg, sizeof(reg)) != ESP_OK) {
+            break;
+        }
+        agregados_agregar(&reg);
+        portENTER_CRITICAL(&reserva_lock);
+        // Si el productor descartó esta muestra mientras tanto, ya no está
+        if (reserva_cantidad > 0 && reserva_inicio == indice) {
+            reserva_inicio = (reserva_inicio + 1) % CONFIG_HALO_SD_RESERVA_MUESTRAS;
+            reserva_cantidad--;
+        }
+        portEXIT_CRITICAL(&reserva_lock);
+    }
+    return sdcard_reserva_ocupacion();
+}
+
+/**
+ * @brief Extiende la preasignación de pesos.bin con ceros, un paso por vez
+ *
+ * Tras reabrir un archivo recortado o agotar su reserva, la tarea escritora
+ * la recupera de a SDCARD_PREASIGNAR_PASO_BYTES cuando la cola está vacía,
+ * con el mismo FILE del registro (otro FILE abierto para escribir tendría un
+ * tamaño desactualizado y lo pisaría al sincronizar). Se extiende al quedar
+ * menos de un cuarto del objetivo.
+ */
+static void sdcard_preasignar_paso(void) {
+    static const uint8_t ceros[512];
+    sdcard_escritor_t *e = &escritores[SDCARD_REGISTRO_PESOS];
+    uint32_t fin = muestras_bin_registros();
+    uint32_t asignados = muestras_bin_asignados();
+    uint32_t objetivo = muestras_bin_preasignar_objetivo();
+    if (e->f == NULL || objetivo == 0 || asignados - fin >= objetivo / 4) {
+        return;
+    }
+    uint32_t n = fin + objetivo - asignados;
+    if (n > SDCARD_PREASIGNAR_PASO_BYTES / sizeof(muestra_bin_t)) {
+        n = SDCARD_PREASIGNAR_PASO_BYTES / sizeof(muestra_bin_t);
+    }
+    size_t bytes = n * sizeof(muestra_bin_t);
+    bool ok = fseek(e->f, MUESTRAS_BIN_POSICION(asignados), SEEK_SET) == 0;
+    for (size_t escritos = 0; ok && escritos < bytes; escritos += sizeof(ceros)) {
+        size_t parte = (bytes - escritos < sizeof(ceros)) ? bytes - escritos : sizeof(ceros);
+        ok = fwrite(ceros, 1, parte, e->f) == parte;
+    }
+    // Las escrituras del registro siguen desde el fin lógico
+    if (fseek(e->f, MUESTRAS_BIN_POSICION(fin), SEEK_SET) != 0 || !ok) {
+        ESP_LOGE(TAG, "Error al preasignar %s", e->ruta);
+        sdcard_escritor_fallo();
+        return;
+    }
+    muestras_bin_asignados_actualizar(asignados + n);
+    e->sin_sync = true;
+}
+
+/**
+ * @brief Única tarea que escribe /pesos.bin: drena la cola por lotes, aplica los
+ * umbrales de vaciado y sync, y remonta la SD tras un corte
+ *
+ * Despierta con cada muestra nueva o cada SDCARD_ESCRITOR_PERIODO_MS. Tras un
+ * corte espera el doble en cada intento fallido (SDCARD_REMONTAJE_MIN_MS hasta
+ * CONFIG_HALO_SD_REMONTAJE_MAX_MS). Suelta mutex_sd entre lotes para que el
+ * envío y los comandos no esperen al drenaje completo.
+ */
+static void task_sd_escritor(void *pvParameters) {
+    uint32_t espera_ms = SDCARD_REMONTAJE_MIN_MS;
+    bool pendiente = false;
+    for (;;) {
+        if (sd_en_falla) {
+            vTaskDelay(pdMS_TO_TICKS(espera_ms));
+        } else if (!pendiente) {
+            espera_ms = SDCARD_REMONTAJE_MIN_MS;
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SDCARD_ESCRITOR_PERIODO_MS));
+        }
+        // sdcard_init() corre antes de sistema_init_config(): el mutex puede no existir aún
+        if (sistema.mutex_sd == NULL ||
+            xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(SISTEMA_TIMEOUT_MUTEX)) != pdTRUE) {
+            vTaskDelay(pdMS_TO_TICKS(10));
             continue;
         }
-        
-        if (fprintf(f, "%s", data) < 0) {
-            ESP_LOGE(TAG, "Error al escribir en archivo (intento %d/%d)", intento, MAX_REINTENTOS);
-            fclose(f);
-            sdcard_unmount();
-            if (intento < MAX_REINTENTOS) {
-                vTaskDelay(DELAY_ENTRE_INTENTOS_MS / portTICK_PERIOD_MS);
+        if (sd_en_falla) {
+            stats.remontajes++;
+            if (sdcard_remontar() == ESP_OK && sdcard_info.is_mounted) {
+                uint32_t duracion_ms = sdcard_ahora_ms() - t_inicio_falla_ms;
+                sd_en_falla = false;
+                stats.corte_ms = duracion_ms;
+                if (duracion_ms > stats.corte_max_ms) {
+                    stats.corte_max_ms = duracion_ms;
+                }
+                espera_ms = SDCARD_REMONTAJE_MIN_MS;
+                ESP_LOGI(TAG, "✅ SD remontada tras %u ms; %u muestras en la cola",
+                         (unsigned)duracion_ms, (unsigned)sdcard_reserva_ocupacion());
+            } else {
+                espera_ms = (espera_ms * 2 > CONFIG_HALO_SD_REMONTAJE_MAX_MS) ? CONFIG_HALO_SD_REMONTAJE_MAX_MS
+                                                                              : espera_ms * 2;
+                ESP_LOGW(TAG, "SD sin remontar (intento %u); próximo en %u ms",
+                         (unsigned)stats.remontajes, (unsigned)espera_ms);
             }
-            continue;
         }
+        pendiente = false;
+        if (!sd_en_falla) {
+            pendiente = sdcard_reserva_drenar(SDCARD_RESERVA_LOTE) > 0 && !sd_en_falla;
+            if (!sd_en_falla) {
+                sdcard_registros_mantener();
+            }
+            if (!pendiente && !sd_en_falla) {
+                sdcard_preasignar_paso();
+                espacio_mantener();
+            }
+        }
+        xSemaphoreGive(sistema.mutex_sd);
+    }
+}
+
+/**
+ * @brief Manejador de apagado: vacía y cierra los registros dentro de esp_restart()
+ *
+ * esp_restart() llega desde el worker de comandos o la OTA mientras SD_Escritor
+ * puede estar a mitad de un vaciado: sin mutex_sd los dos tocarían el mismo
+ * búfer y FILE (y el recorte de la preasignación). Se espera el mutex como mucho
+ * SISTEMA_TIMEOUT_MUTEX; si no llega, no se cierra nada y lo escrito hasta el
+ * último vaciado se recupera al montar. El vaciado incluye la cola.
+ */
+static void sdcard_registros_apagado(void) {
+    if (sistema.mutex_sd == NULL) {
+        // Antes de sistema_init_config() no hay otras tareas usando la SD
+        sdcard_registros_cerrar();
+        return;
+    }
+    if (xSemaphoreGetMutexHolder(sistema.mutex_sd) == xTaskGetCurrentTaskHandle()) {
+        // Quien reinicia ya tiene el mutex
+        sdcard_registros_cerrar();
+        return;
+    }
+    if (xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(SISTEMA_TIMEOUT_MUTEX)) != pdTRUE) {
+        ESP_LOGW(TAG, "⚠️ SD ocupada al reiniciar: los registros no se cierran");
+        return;
+    }
+    sdcard_registros_cerrar();
+    xSemaphoreGive(sistema.mutex_sd);
+}
+
+void sdcard_get_stats(sdcard_stats_t *out) {
+    if (out != NULL) {
+        *out = stats;
+        out->reserva_ocupacion = sdcard_reserva_ocupacion();
+        if (sd_en_falla) {
+            // Corte en curso: duración hasta ahora
+            out->corte_ms = sdcard_ahora_ms() - t_inicio_falla_ms;
+        }
+    }
+}
+
+#if CONFIG_HALO_BENCHMARKS
+/**
+ * @brief Compara fopen/fprintf/fclose por fila con el registro con búfer
+ *
+ * Escribe 'lineas' filas tipo pesos.csv en dos archivos temporales y registra
+ * latencia media y máxima por fila, aperturas, write() y fsync de cada camino.
+ */
+void sdcard_benchmark(int lineas) {
+    static const char *ruta_directa = MOUNT_POINT "/bench_a.csv";
+    static const char *ruta_bufer = "/bench_b.csv";
+    char linea[64];
+
+    if (!sdcard_info.is_mounted || lineas <= 0) {
+        ESP_LOGW(TAG, "⏱️ Benchmark SD omitido (SD no montada)");
+        return;
+    }
+    remove(ruta_directa);
+    remove(MOUNT_POINT "/bench_b.csv");
+
+    // Camino anterior: abrir, escribir y cerrar por fila
+    int64_t total_us = 0;
+    uint32_t max_us = 0;
+    for (int i = 0; i < lineas; i++) {
+        snprintf(linea, sizeof(linea), "2026-01-01,00:00:%02d,%.2f,1\n", i % 60, 12.34f + i);
+        int64_t t = esp_timer_get_time();
+        FILE *f = fopen(ruta_directa, "a");
+        if (f == NULL) {
+            ESP_LOGE(TAG, "⏱️ Benchmark SD: no se pudo abrir %s", ruta_directa);
+            return;
+        }
+        fprintf(f, "%s", linea);
         fclose(f);
-        //sdcard_log_voltaje();
+        uint32_t us = (uint32_t)(esp_timer_get_time() - t);
+        total_us += us;
+        if (us > max_us) max_us = us;
+    }
+    ESP_LOGI(TAG, "⏱️ Fila a fila: %d filas, media %u us, max %u us, %d fopen/fclose",
+             lineas, (unsigned)(total_us / lineas), (unsigned)max_us, lineas);
 
-        ESP_LOGI(TAG, "Datos agregados");
-        
-        return ESP_OK;
+    // Camino nuevo: mismo escritor que los registros, con archivo propio
+    sdcard_escritor_t *e = calloc(1, sizeof(sdcard_escritor_t));
+    if (e == NULL) {
+        return;
     }
-    
-    ESP_LOGE(TAG, "FALLO CRÍTICO: No se pudo escribir en SD tras %d intentos", MAX_REINTENTOS);
-    return ESP_FAIL;
+    e->ruta = ruta_bufer;
+    sdcard_stats_t antes = stats;
+    total_us = 0;
+    max_us = 0;
+    for (int i = 0; i < lineas; i++) {
+        int len = snprintf(linea, sizeof(linea), "2026-01-01,00:00:%02d,%.2f,1\n", i % 60, 12.34f + i);
+        int64_t t = esp_timer_get_time();
+        if (e->usado + len > sizeof(e->buffer)) {
+            sdcard_escritor_vaciar(e, CONFIG_HALO_SD_SYNC_MS == 0);
+        }
+        memcpy(e->buffer + e->usado, linea, len);
+        e->usado += len;
+        uint32_t us = (uint32_t)(esp_timer_get_time() - t);
+        total_us += us;
+        if (us > max_us) max_us = us;
+    }
+    int64_t t = esp_timer_get_time();
+    sdcard_escritor_vaciar(e, true);
+    total_us += esp_timer_get_time() - t;
+    if (e->f != NULL) {
+        fclose(e->f);
+    }
+    free(e);
+    ESP_LOGI(TAG, "⏱️ Con búfer (%d B): %d filas, media %u us, max %u us, %u fopen, %u write, %u fsync, %u bytes",
+             CONFIG_HALO_SD_BUFFER_BYTES, lineas, (unsigned)(total_us / lineas), (unsigned)max_us,
+             (unsigned)(stats.aperturas - antes.aperturas), (unsigned)(stats.escrituras - antes.escrituras),
+             (unsigned)(stats.syncs - antes.syncs), (unsigned)(stats.bytes - antes.bytes));
+    // Las métricas del benchmark no cuentan como registro
+    stats = antes;
+    remove(ruta_directa);
+    remove(MOUNT_POINT "/bench_b.csv");
 }
 
+/**
+ * @brief Latencia por muestra que ve task_HX711: escritura en línea (camino
+ * anterior) frente a la cola de la tarea escritora, como histograma
+ */
+void sdcard_escritor_benchmark(int muestras) {
+    static const char *ruta_bufer = "/bench_c.bin";
+    char texto[64];
+
+    if (!sdcard_info.is_mounted || sd_en_falla || sistema.mutex_sd == NULL || muestras <= 0) {
+        ESP_LOGW(TAG, "⏱️ Benchmark del escritor omitido (SD no montada)");
+        return;
+    }
+    remove(MOUNT_POINT "/bench_c.bin");
+    sdcard_stats_t antes = stats;
+    muestra_bin_t reg = {
+        .epoch = 1767225600, .raw = 8123456, .peso_mg = 1250500, .bateria_mv = 3912, .flags = MUESTRA_BIN_ESTABLE,
+    };
+
+    // Camino anterior: tomar mutex_sd y copiar al búfer; al llenarse se escribe en línea
+    sdcard_escritor_t *e = calloc(1, sizeof(sdcard_escritor_t));
+    if (e == NULL) {
+        return;
+    }
+    e->ruta = ruta_bufer;
+    histograma_t en_linea = {0};
+    for (int i = 0; i < muestras; i++) {
+        reg.epoch += 15;
+        reg.peso_mg += (i % 7) - 3;
+        int64_t t = esp_timer_get_time();
+        xSemaphoreTake(sistema.mutex_sd, portMAX_DELAY);
+        muestras_bin_sellar(&reg);
+        if (e->usado + sizeof(reg) > sizeof(e->buffer)) {
+            sdcard_escritor_vaciar(e, CONFIG_HALO_SD_SYNC_MS == 0);
+        }
+        memcpy(e->buffer + e->usado, &reg, sizeof(reg));
+        e->usado += sizeof(reg);
+        xSemaphoreGive(sistema.mutex_sd);
+        histograma_agregar(&en_linea, (uint32_t)(esp_timer_get_time() - t));
+    }
+    sdcard_escritor_vaciar(e, true);
+    if (e->f != NULL) {
+        fclose(e->f);
+    }
+    free(e);
+
+    // Camino nuevo: sellar, encolar y avisar. Con mutex_sd tomado la tarea no
+    // drena, y cada muestra de prueba se retira de la cola sin escribirla
+    histograma_t cola = {0};
+    xSemaphoreTake(sistema.mutex_sd, portMAX_DELAY);
+    for (int i = 0; i < muestras && sdcard_reserva_ocupacion() < CONFIG_HALO_SD_RESERVA_MUESTRAS; i++) {
+        reg.epoch += 15;
+        reg.peso_mg += (i % 7) - 3;
+        int64_t t = esp_timer_get_time();
+        muestras_bin_sellar(&reg);
+        sdcard_reserva_poner(&reg);
+        xTaskNotifyGive(tarea_escritor);
+        histograma_agregar(&cola, (uint32_t)(esp_timer_get_time() - t));
+        portENTER_CRITICAL(&reserva_lock);
+        reserva_cantidad--;
+        portEXIT_CRITICAL(&reserva_lock);
+    }
+    xSemaphoreGive(sistema.mutex_sd);
+
+    ESP_LOGI(TAG, "⏱️ Latencia por muestra (cubetas <0.1/0.5/1/5/10/50/100 ms y más):");
+    histograma_a_texto(&en_linea, texto, sizeof(texto));
+    ESP_LOGI(TAG, "⏱️ En línea: %u muestras, media %u us, max %u us, %s",
+             (unsigned)en_linea.n, (unsigned)histograma_media_us(&en_linea), (unsigned)en_linea.max_us, texto);
+    histograma_a_texto(&cola, texto, sizeof(texto));
+    ESP_LOGI(TAG, "⏱️ Con cola: %u muestras, media %u us, max %u us, %s",
+             (unsigned)cola.n, (unsigned)histograma_media_us(&cola), (unsigned)cola.max_us, texto);
+    // Las métricas del benchmark no cuentan como registro
+    stats = antes;
+    remove(MOUNT_POINT "/bench_c.bin");
+}
 
+/**
+ * @brief Latencia de cada escritura de un búfer de registro: archivo que crece
+ * (la FAT busca y encadena un clúster libre en cada cruce) frente a uno
+ * preasignado contiguo con f_expand
+ */
+void sdcard_preasignacion_benchmark(int muestras) {
+    static const char *rutas[2] = { MOUNT_POINT "/bench_a.bin", MOUNT_POINT "/bench_p.bin" };
+    static const char *nombres[2] = { "Creciendo", "Preasignado" };
+    char texto[64];
+
+    if (!sdcard_info.is_mounted || sd_en_falla || sistema.mutex_sd == NULL || muestras <= 0) {
+        ESP_LOGW(TAG, "⏱️ Benchmark de preasignación omitido (SD no montada)");
+        return;
+    }
+    size_t por_bloque = CONFIG_HALO_SD_BUFFER_BYTES / sizeof(muestra_bin_t);
+    size_t bytes_bloque = por_bloque * sizeof(muestra_bin_t);
+    size_t bloques = ((size_t)muestras + por_bloque - 1) / por_bloque;
+    muestra_bin_t *bloque = calloc(por_bloque, sizeof(muestra_bin_t));
+    if (bloque == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < por_bloque; i++) {
+        bloque[i] = (muestra_bin_t){ .epoch = 1767225600 + i * 15, .raw = 8123456, .peso_mg = 1250500, .bateria_mv = 3912 };
+        muestras_bin_sellar(&bloque[i]);
+    }
+
+    xSemaphoreTake(sistema.mutex_sd, portMAX_DELAY);
+    for (int caso = 0; caso < 2; caso++) {
+        remove(rutas[caso]);
+        if (caso == 1 && esp_vfs_fat_create_contiguous_file(sdcard_info.mount_point, rutas[caso],
+                                                            (uint64_t)(bloques * bytes_bloque), true) != ESP_OK) {
+            ESP_LOGW(TAG, "⏱️ Sin espacio contiguo para %u bytes", (unsigned)(bloques * bytes_bloque));
+            break;
+        }
+        FILE *f = fopen(rutas[caso], caso == 0 ? "a" : "r+b");
+        if (f == NULL) {
+            continue;
+        }
+        setvbuf(f, NULL, _IONBF, 0);
+        histograma_t h = {0};
+        for (size_t i = 0; i < bloques; i++) {
+            int64_t t = esp_timer_get_time();
+            fwrite(bloque, 1, bytes_bloque, f);
+            histograma_agregar(&h, (uint32_t)(esp_timer_get_time() - t));
+        }
+        fclose(f);
+        remove(rutas[caso]);
+        histograma_a_texto(&h, texto, sizeof(texto));
+        ESP_LOGI(TAG, "⏱️ %s: %u escrituras de %u bytes, media %u us, max %u us, %s", nombres[caso],
+                 (unsigned)h.n, (unsigned)bytes_bloque, (unsigned)histograma_media_us(&h), (unsigned)h.max_us, texto);
+    }
+    xSemaphoreGive(sistema.mutex_sd);
+    free(bloque);
+}
+#endif // CONFIG_HALO_BENCHMARKS
 
 bool sdcard_file_exists(const char *path) {
     if (!sdcard_info.is_mounted) {
@@ -226,25 +865,21 @@ bool sdcard_file_exists(const char *path) {
     return (stat(full_path, &st) == 0);
 }
 
-esp_err_t sdcard_log_peso(float peso, struct tm *timeinfo) {
-    if (!sdcard_info.is_mounted) {
-        ESP_LOGE(TAG, "Tarjeta SD no montada");
-        return ESP_FAIL;
+/**
+ * @brief Sella una muestra y la encola para task_sd_escritor
+ *
+ * No toma mutex_sd ni toca la FAT: el coste para quien registra es una copia
+ * bajo spinlock, aunque la SD esté ocupada, lenta o caída.
+ */
+esp_err_t sdcard_log_muestra(muestra_bin_t *reg) {
+    muestras_bin_sellar(reg);
+    sdcard_reserva_poner(reg);
+    if (tarea_escritor != NULL) {
+        xTaskNotifyGive(tarea_escritor);
     }
-    
-    char log_entry[128]; 
-    int written = snprintf(log_entry, sizeof(log_entry), 
-                          "%04d-%02d-%02d,%02d:%02d:%02d,%.2f\n",
-                          timeinfo->tm_year + 1900, timeinfo->tm_mon + 1, timeinfo->tm_mday,
-                          timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec, peso);
-    
-    return sdcard_append_file("/pesos.csv", log_entry);
+    return ESP_OK;
 }
 
-
-
-
-
 void sdcard_print_info(void) {
     if (sdcard_info.card == NULL) {
         ESP_LOGI(TAG, "No hay información de tarjeta disponible");
@@ -252,12 +887,14 @@ void sdcard_print_info(void) {
     }
     ESP_LOGI(TAG, "Información de la tarjeta SD:");
 
-    uint64_t total_bytes, free_bytes;
-    esp_err_t info_err = esp_vfs_fat_info("/sdcard", &total_bytes, &free_bytes);
-    if (info_err == ESP_OK) {
-        ESP_LOGI(TAG, "Capacidad total: %.2f MB", total_bytes / (1024.0 * 1024.0));
-        ESP_LOGI(TAG, "Espacio disponible: %.2f MB", free_bytes / (1024.0 * 1024.0));
+    // Cifras en caché: esp_vfs_fat_info() recorrería la FAT entera en cada montaje
+    espacio_t espacio;
+    espacio_get(&espacio);
+    if (espacio.valido) {
+        ESP_LOGI(TAG, "Capacidad total: %.2f MB", espacio.total_bytes / (1024.0 * 1024.0));
+        ESP_LOGI(TAG, "Espacio disponible: %.2f MB", espacio.libres_bytes / (1024.0 * 1024.0));
     } else {
-        ESP_LOGW(TAG, "No se pudo obtener información de espacio de la SD: %s", esp_err_to_name(info_err));
+        ESP_LOGI(TAG, "Capacidad de la tarjeta: %.2f MB (espacio libre aún sin contar)",
+                 (double)sdcard_info.card->csd.capacity * sdcard_info.card->csd.sector_size / (1024.0 * 1024.0));
     }
 }
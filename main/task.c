@@ -256,14 +256,31 @@ static hx711_task_state_t hx711_get_next_state(bool calibracion_ejecutada) {
     return HX711_MEDICION;
 }
 
+// Desvío de cada pasada de medición respecto de MUESTREO_DRENAJE_MS (solo lo escribe task_HX711)
+static histograma_t jitter_registro;
+
+void task_HX711_get_jitter(histograma_t *out) {
+    if (out != NULL) {
+        *out = jitter_registro;
+    }
+}
+
 void task_HX711(void *pvParameters) {
     hx711_task_state_t estado = HX711_ESPERA_INICIALIZACION;
+    int64_t t_paso_anterior_us = 0;
     static bool calibracion_ejecutada = false;
     static uint32_t last_log_time = 0;
+    static uint32_t last_stats_time = 0;
+    static muestra_t ultima_muestra;
+    static bool hay_muestra = false;
     const uint32_t LOG_INTERVAL_MS = 10000; // Log cada 10 segundos para estados de espera
+    const uint32_t STATS_INTERVAL_MS = 300000; // Estadísticas de adquisición cada 5 minutos
     
     while (1) {
         uint32_t current_time = xTaskGetTickCount() * portTICK_PERIOD_MS;
+        if (estado != HX711_MEDICION) {
+            t_paso_anterior_us = 0;
+        }
         
         switch (estado) {
             case HX711_ESPERA_INICIALIZACION:
@@ -316,8 +333,45 @@ void task_HX711(void *pvParameters) {
                 break;
                 
             case HX711_MEDICION: {
+                int64_t t_paso_us = esp_timer_get_time();
+                if (t_paso_anterior_us != 0) {
+                    int64_t desvio_us = (t_paso_us - t_paso_anterior_us) - (int64_t)MUESTREO_DRENAJE_MS * 1000;
+                    histograma_agregar(&jitter_registro, (uint32_t)(desvio_us < 0 ? -desvio_us : desvio_us));
+                }
+                t_paso_anterior_us = t_paso_us;
+
+                // Drenar las muestras acumuladas y pasarlas por la cadena de filtros
+                muestra_t muestra;
+                while (muestreo_leer(MUESTREO_CONSUMIDOR_REGISTRO, &muestra)) {
+                    int32_t filtrado;
+                    if (filtros_procesar(muestra.raw, &filtrado)) {
+                        ultima_muestra = muestra;
+                        ultima_muestra.raw = filtrado;
+                        hay_muestra = true;
+                        registro_actualizar(hx711_calcular_peso_mg(filtrado));
+                        autocero_actualizar(filtrado, registro_estable(), current_time);
+                    }
+                }
+
+                if (current_time - last_stats_time >= STATS_INTERVAL_MS) {
+                    hx711_log_stats();
+                    muestreo_log_stats();
+                    last_stats_time = current_time;
+                }
+
+                // Decidir si esta pasada genera fila (periodo, banda muerta o latido)
+                int32_t peso_mg = hay_muestra ? hx711_calcular_peso_mg(ultima_muestra.raw) : 0;
+                bool estable = false;
+
+                if (!registro_evaluar(hay_muestra, peso_mg, current_time, &estable)) {
+                    vTaskDelay(MUESTREO_DRENAJE_MS / portTICK_PERIOD_MS);
+                    estado = hx711_get_next_state(calibracion_ejecutada);
+                    break;
+                }
+
                 struct tm timeinfo;
                 bool tiempo_valido = rtc_get_time(&timeinfo);
+                uint8_t flags = tiempo_valido ? 0 : MUESTRA_BIN_SIN_RTC;
                 
                 // Si no hay tiempo del RTC, usar tiempo del sistema (desde boot)
                 if (!tiempo_valido) {
@@ -341,14 +395,27 @@ void task_HX711(void *pvParameters) {
                 }
                 
                 if (tiempo_valido) {
-                    float peso = hx711_leer_peso();
-                    if (peso > HX711_ERROR_THRESHOLD) {
-                        if (xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(1000)) == pdTRUE) {
-                            sdcard_log_peso(peso, &timeinfo);
-                            sdcard_log_voltaje(&timeinfo);
-                            xSemaphoreGive(sistema.mutex_sd);
-                        } else {
-                            ESP_LOGW(TAG, "⚠️ No se pudo obtener mutex de SD - saltando medición");
+                    if (hay_muestra) {
+                        uint16_t bateria_mv = 0;
+                        if (battery_get_voltage(&bateria_mv) != ESP_OK) {
+                            flags |= MUESTRA_BIN_SIN_BATERIA;
+                        }
+                        muestra_bin_t registro = {
+                            .epoch = (uint32_t)mktime(&timeinfo),
+                            .raw = ultima_muestra.raw,
+                            .peso_mg = peso_mg,
+                            .bateria_mv = bateria_mv,
+                            .flags = flags | (estable ? MUESTRA_BIN_ESTABLE : 0),
+                        };
+#if HX711_NUM_CANALES > 1
+                        // Cuentas de cada celda de la última muestra (sin filtrar)
+                        memcpy(registro.raw_canal, ultima_muestra.raw_canal, sizeof(registro.raw_canal));
+#endif
+                        hay_muestra = false;
+                        // Solo se encola: la escritura la hace la tarea SD_Escritor
+                        if (sdcard_log_muestra(&registro) == ESP_OK) {
+                            recientes_agregar(&registro);
+                            registro_confirmar(peso_mg, estable);
                         }
                     } else {
                         ESP_LOGE(TAG, "❌ Error al obtener peso del sensor");
@@ -357,8 +424,7 @@ void task_HX711(void *pvParameters) {
                     ESP_LOGE(TAG, "❌ No se pudo obtener timestamp válido");
                 }
                 
-                vTaskDelay(sistema.envio.muestreo_ms / portTICK_PERIOD_MS);
-                // Solo verificar cambio de estado después del delay de medición
+                vTaskDelay(MUESTREO_DRENAJE_MS / portTICK_PERIOD_MS);
                 estado = hx711_get_next_state(calibracion_ejecutada);
                 break;
             }
@@ -420,106 +486,125 @@ static bool mqtt_conectar_broker(void) {
     return false;
 }
 
+// Publica el avance del envío (metadato, con mutex); false si pesos.bin cambió desde la vista
+static bool mqtt_envio_confirmar(const muestras_bin_vista_t *vista, const muestras_bin_cursor_t *cursor) {
+    bool vigente = false;
+    if (xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(5000)) == pdTRUE) {
+        vigente = muestras_bin_vista_vigente(vista);
+        if (vigente) {
+            sistema.envio.cursor = *cursor;
+            muestras_bin_cursor_guardar(false);
+        }
+        xSemaphoreGive(sistema.mutex_sd);
+    }
+    if (!vigente) {
+        ESP_LOGW(TAG, "⚠️ %s cambió o la SD no responde durante el envío - se retoma en el próximo", MUESTRAS_BIN_RUTA);
+    }
+    return vigente;
+}
+
+/**
+ * @brief Lee un lote del envío con mutex_sd tomado solo durante la lectura
+ *
+ * La vista garantiza que los registros no cambian, pero no que la SD siga
+ * montada: sin el mutex, SD_Escritor podría desmontarla o remontarla (y quitar
+ * la FATFS) con el archivo abierto aquí. Un lote de 16 registros es una lectura corta.
+ */
+static esp_err_t mqtt_envio_leer(const muestras_bin_vista_t *vista, uint32_t indice, muestra_bin_t *regs,
+                                 size_t max, size_t *leidos) {
+    *leidos = 0;
+    if (xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    esp_err_t res = muestras_bin_vista_vigente(vista) ? muestras_bin_leer(indice, regs, max, leidos)
+                                                      : ESP_ERR_INVALID_STATE;
+    xSemaphoreGive(sistema.mutex_sd);
+    return res;
+}
+
 // Función auxiliar para contar y enviar datos desde SD
+// El registro binario se lee por índice desde la última muestra enviada
 static int mqtt_enviar_datos_sd(const struct tm *timeinfo) {
-    FILE *f = NULL;
     int mensajes_enviados = 0;
-    int total_pendientes = 0;
-    
-    // Verificar si hay datos pendientes ANTES de conectar
-    if (xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(1000)) == pdTRUE) {
-        f = fopen("/sdcard/pesos.csv", "r");
-    if (f) {
-        char line[128];
-            int line_number = 0;
-            
-            // Saltar líneas ya enviadas
-            while (line_number < sistema.envio.ultima_muestra_enviada && fgets(line, sizeof(line), f)) {
-                if (strstr(line, "Fecha")) continue;
-                line_number++;
-            }
-            
-            // Contar líneas pendientes
-        struct tm limite_envio = *timeinfo;
-        limite_envio.tm_hour = sistema.envio.hora_envio;
-        limite_envio.tm_min = sistema.envio.minuto_envio;
-        limite_envio.tm_sec = 0;
-        time_t timestamp_limite = mktime(&limite_envio);
-        
-            while (fgets(line, sizeof(line), f)) {
-                if (strstr(line, "Fecha")) continue;
-                
-                int y, m, d, h, min, s;
-                float p;
-                if (sscanf(line, "%d-%d-%d,%d:%d:%d,%f", &y, &m, &d, &h, &min, &s, &p) == 7) {
-                    struct tm muestra_time = {0};
-                    muestra_time.tm_year = y - 1900;
-                    muestra_time.tm_mon = m - 1;
-                    muestra_time.tm_mday = d;
-                    muestra_time.tm_hour = h;
-                    muestra_time.tm_min = min;
-                    muestra_time.tm_sec = s;
-                    time_t timestamp_muestra = mktime(&muestra_time);
-                    
-                    if (timestamp_muestra <= timestamp_limite) {
-                        total_pendientes++;
-                    } else {
-                        break;
-                    }
-                }
-            }
-            
-            // Si hay datos pendientes, reposicionar y enviar
-            if (total_pendientes > 0) {
-                ESP_LOGI(TAG, "📤 Hay %d mensajes pendientes - iniciando envío", total_pendientes);
-                rewind(f);
-                line_number = 0;
-                
-                // Saltar líneas ya enviadas nuevamente
-        while (line_number < sistema.envio.ultima_muestra_enviada && fgets(line, sizeof(line), f)) {
-            if (strstr(line, "Fecha")) continue;
-            line_number++;
+
+    struct tm limite_envio = *timeinfo;
+    limite_envio.tm_hour = sistema.envio.hora_envio;
+    limite_envio.tm_min = sistema.envio.minuto_envio;
+    limite_envio.tm_sec = 0;
+    time_t timestamp_limite = mktime(&limite_envio);
+
+    // Vista: con mutex se confirma lo encolado (fsync), se fija el largo y se
+    // ubica el fin del lote; después el mutex se toma solo por cada lectura de 16
+    muestras_bin_vista_t vista;
+    muestras_bin_cursor_t cursor;
+    uint32_t indice;
+    uint32_t fin;
+    uint32_t lecturas = 0;
+    if (xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        return 0;
+    }
+    sdcard_registros_vaciar(true);
+    muestras_bin_vista(&vista);
+    cursor = sistema.envio.cursor;
+    indice = muestras_bin_cursor_indice(&cursor);
+    // Punto de reanudación: índice directo; fin del lote: búsqueda binaria por hora
+    fin = muestras_bin_buscar_epoch(indice, vista.total, (uint32_t)timestamp_limite, &lecturas);
+    xSemaphoreGive(sistema.mutex_sd);
+
+    if (indice < fin) {
+        ESP_LOGI(TAG, "📤 Hay %u muestras pendientes de %u (%u lecturas para ubicarlas) - iniciando envío",
+                 (unsigned)(fin - indice), (unsigned)vista.total, (unsigned)lecturas);
+    } else {
+        ESP_LOGI(TAG, "📭 No hay datos pendientes de envío");
+    }
+
+    muestra_bin_t lote[16];
+    bool terminar = false;
+    while (!terminar && indice < fin) {
+        size_t leidos = 0;
+        size_t max = fin - indice;
+        if (max > sizeof(lote) / sizeof(lote[0])) {
+            max = sizeof(lote) / sizeof(lote[0]);
         }
-        
-                // Enviar datos
-                while (fgets(line, sizeof(line), f) && mensajes_enviados < total_pendientes) {
-            if (strstr(line, "Fecha")) continue;
-            
+        // Registros por debajo de vista.total: la tarea escritora solo agrega detrás
+        if (mqtt_envio_leer(&vista, indice, lote, max, &leidos) != ESP_OK || leidos == 0) {
+            break;
+        }
+        for (size_t i = 0; i < leidos; i++) {
             if (!mqtt_is_connected()) {
-                        ESP_LOGE(TAG, "Conexión MQTT perdida");
+                ESP_LOGE(TAG, "Conexión MQTT perdida");
+                terminar = true;
                 break;
             }
-            
-            int y, m, d, h, min, s;
-            float p;
-            if (sscanf(line, "%d-%d-%d,%d:%d:%d,%f", &y, &m, &d, &h, &min, &s, &p) == 7) {
-                struct tm muestra_time = {0};
-                muestra_time.tm_year = y - 1900;
-                muestra_time.tm_mon = m - 1;
-                muestra_time.tm_mday = d;
-                muestra_time.tm_hour = h;
-                muestra_time.tm_min = min;
-                muestra_time.tm_sec = s;
-                
-                    esp_err_t result = mqtt_enviar_datos(p, &muestra_time, "Datos históricos");
-                    if (result == ESP_OK) {
-                        mensajes_enviados++;
-                        sistema.envio.ultima_muestra_enviada++;
-                            vTaskDelay(100 / portTICK_PERIOD_MS); // Reducido delay
-                } else {
-                    break;
-                }
+            if (!muestras_bin_valido(&lote[i])) {
+                // Registro dañado: se salta para no bloquear los siguientes
+                ESP_LOGW(TAG, "⚠️ Muestra %u con CRC inválido - omitida", (unsigned)indice);
+                muestras_bin_cursor_avanzar(&cursor, 1);
+                indice++;
+                continue;
             }
-                }
-            } else {
-                ESP_LOGI(TAG, "📭 No hay datos pendientes de envío");
+            if ((time_t)lote[i].epoch > timestamp_limite) {
+                terminar = true;
+                break;
+            }
+            struct tm muestra_time;
+            time_t t = (time_t)lote[i].epoch;
+            localtime_r(&t, &muestra_time);
+            esp_err_t result = mqtt_enviar_datos((float)lote[i].peso_mg * 1e-6f, &muestra_time, "Datos históricos");
+            if (result != ESP_OK) {
+                terminar = true;
+                break;
+            }
+            mensajes_enviados++;
+            muestras_bin_cursor_avanzar(&cursor, 1);
+            indice++;
+            vTaskDelay(100 / portTICK_PERIOD_MS); // Reducido delay
+        }
+        if (!mqtt_envio_confirmar(&vista, &cursor)) {
+            break;
         }
-        
-        fclose(f);
-    }
-        xSemaphoreGive(sistema.mutex_sd);
     }
-    
+
     return mensajes_enviados;
 }
 
@@ -530,8 +615,14 @@ static void mqtt_finalizar_envio(int mensajes_enviados) {
     
     vTaskDelay(2000 / portTICK_PERIOD_MS);
     
-    // Actualizar estado del sistema
-    guardar_ultima_muestra_enviada();
+    // Cursor a la NVS y lo enviado al histórico: pesos.bin queda solo con lo pendiente
+    if (xSemaphoreTake(sistema.mutex_sd, pdMS_TO_TICKS(5000)) == pdTRUE) {
+        muestras_bin_cursor_guardar(true);
+        if (muestras_bin_rotar() != ESP_OK) {
+            ESP_LOGW(TAG, "⚠️ No se pudo archivar el segmento enviado; se reintenta en el próximo envío");
+        }
+        xSemaphoreGive(sistema.mutex_sd);
+    }
     
     struct tm timeinfo;
     if (rtc_get_time(&timeinfo)) {
@@ -605,19 +696,8 @@ void task_MQTT(void *pvParameters) {
 
             case MQTT_ESPERA_HORARIO_ENVIO:
                 if (verificar_horario_envio(&timeinfo)) {
-                    // Verificar si realmente hay datos pendientes antes de conectar
-                    FILE *check_file = fopen("/sdcard/pesos.csv", "r");
-                    bool hay_datos_pendientes = false;
-                    
-                    if (check_file) {
-                        char line[128];
-                        int count = 0;
-                        while (fgets(line, sizeof(line), check_file) && count < sistema.envio.ultima_muestra_enviada + 5) {
-                            if (!strstr(line, "Fecha")) count++;
-                        }
-                        hay_datos_pendientes = (count > sistema.envio.ultima_muestra_enviada);
-                        fclose(check_file);
-                    }
+                    // Verificar si realmente hay datos pendientes antes de conectar (O(1), sin la SD)
+                    bool hay_datos_pendientes = muestras_bin_pendientes() > 0;
                     
                     if (hay_datos_pendientes) {
                         ////ESP_LOGI(TAG, "📤 Hay datos pendientes - manteniendo conexión para envío automático");
@@ -636,6 +716,7 @@ void task_MQTT(void *pvParameters) {
                         log_esperando_envio(&timeinfo);
                         ctx.last_log_tick = tick_actual;
                     }
+                    mqtt_enviar_en_vivo();
                     vTaskDelay(INTERVALO_VERIFICACION);
                 }
                 break;